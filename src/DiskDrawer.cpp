@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <filesystem>
 
 #include "DiskDrawer.hpp"
@@ -61,6 +62,63 @@ void SelectionDisk::setHeight(double height)
 	//cylinder->setRotation(att);
 }*/
 
+void SelectionDisk::setSelection(ModelSelection selection)
+{
+	for (auto& highlight : _highlights)
+	{
+		highlight.first->removeHighlight(highlight.second.get());
+	}
+	_highlights.clear();
+
+	_selection = std::move(selection);
+	for (auto& modelSelection : _selection)
+	{
+		osg::Node* highlight = modelSelection.first->addHighlight(modelSelection.second, osg::Vec4(1.0f, 1.0f, 0.0f, 1.0f));
+		if (highlight != nullptr) _highlights.push_back(std::make_pair(modelSelection.first, highlight));
+	}
+}
+
+const SelectionDisk::ModelSelection& SelectionDisk::getSelection() const
+{
+	return _selection;
+}
+
+std::size_t SelectionDisk::deleteSelectedPoints()
+{
+	std::size_t count = 0;
+	for (auto& modelSelection : _selection)
+	{
+		count += modelSelection.first->deletePoints(modelSelection.second);
+	}
+	setSelection(ModelSelection());
+	return count;
+}
+
+void SelectionDisk::remapSelection(LasModel* model, const std::vector<uint32_t>& remap)
+{
+	bool changed = false;
+	ModelSelection selection = _selection;
+	for (auto& modelSelection : selection)
+	{
+		if (modelSelection.first != model) continue;
+
+		std::vector<unsigned int>& indices = modelSelection.second;
+		std::size_t kept = 0;
+		for (unsigned int i : indices)
+		{
+			if (remap[i] != LasModel::NO_ROW) indices[kept++] = remap[i];
+		}
+		indices.resize(kept);
+		changed = true;
+	}
+	if (!changed) return;
+
+	// The highlight drew from the model's old vertex array; rebuild it on the new one.
+	selection.erase(std::remove_if(selection.begin(), selection.end(),
+		[](const ModelSelection::value_type& s) { return s.second.empty(); }), selection.end());
+	setSelection(std::move(selection));
+}
+
 void SelectionDisk::save(const std::string& path, const std::vector<PCVR_Selectable*>& points)
 {
 	int fileNum = std::distance(fs::directory_iterator(fs::path(path)), fs::directory_iterator{}) + 1;
@@ -76,11 +134,12 @@ void SelectionDisk::save(const std::string& path, const std::vector<PCVR_Selecta
 	file << "#Height: " << getHeight() << std::endl;
 	file << "#Rotation: " << r.x() << r.y() << r.z() << r.w() << std::endl;
 
-	for (PCVR_Selectable* p : points)
+	for (auto& modelSelection : _selection)
 	{
-		if ((p->getPos() - c).length() <= getRadius())
+		const LasPointTable& table = modelSelection.first->getPointTable();
+		for (unsigned int i : modelSelection.second)
 		{
-			p->writeToStream(file);
+			table.writeToStream(file, i);
 		}
 	}
 }
@@ -95,5 +154,11 @@ void SelectionDisk::remove()
 {
 	PCVR_Selection::remove();
 
+	for (auto& highlight : _highlights)
+	{
+		highlight.first->removeHighlight(highlight.second.get());
+	}
+	_highlights.clear();
+
 	_xform->getParent(0)->removeChild(_xform);
 }
\ No newline at end of file
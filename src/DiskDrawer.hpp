@@ -31,13 +31,32 @@ public:
 	void setHeight(double height);
 	//void setAttitude(const osg::Quat& att);
 
+	// Remember which rows of each model's point table fall inside the disk,
+	// and highlight them with an overlay on each model.
+	typedef std::vector<std::pair<LasModel*, std::vector<unsigned int>>> ModelSelection;
+	void setSelection(ModelSelection selection);
+	const ModelSelection& getSelection() const;
+
+	// Delete the selected points from their models and empty the selection.
+	// Returns the number of points deleted.
+	std::size_t deleteSelectedPoints();
+	// Follow a model's rows through a compaction (see LasModel::updateCompaction).
+	void remapSelection(LasModel* model, const std::vector<uint32_t>& remap);
+
+	// Writes the selected rows of the point table; disks carry their own selection,
+	// so the selectables argument is not used.
 	virtual void save(const std::string& path, const std::vector<PCVR_Selectable*>& points) override;
+	// Shows or hides the disk itself. The highlight stays until the selection
+	// changes or the disk is removed, as recolored points did.
 	virtual void show(bool b) override;
 	virtual void remove() override;
 
 protected:
 	bool _diskSaved = false;
 
+	ModelSelection _selection;
+	std::vector<std::pair<LasModel*, osg::ref_ptr<osg::Node>>> _highlights;
+
 	osg::ref_ptr<osg::ShapeDrawable> _sd;
 };
 
@@ -45,7 +64,7 @@ template <typename D>
 class DiskDrawer : public DrawingTool
 {
 public:
-	DiskDrawer(osg::ref_ptr<OpenFrames::FrameManager> fm, std::vector<PCVR_Selectable*> selectables, PCVR_Controller* controller);
+	DiskDrawer(osg::ref_ptr<OpenFrames::FrameManager> fm, const std::vector<LasModel*>& models, PCVR_Controller* controller);
 	void update() override;
 	void handleVREvent(const vr::VREvent_t& ovrEvent) override;
 	void stopUsingTool() override;
@@ -53,17 +72,15 @@ public:
 private:
 	osg::ref_ptr<OpenFrames::FrameManager> _fm;
 	osg::ref_ptr<SelectionDisk> _currentDisk = nullptr;
-	std::vector<PCVR_Selectable*> _selectables;
+	std::vector<LasModel*> _models;
 	PCVR_Controller* _controller;
 	osg::Vec3d _drawingControllerWorldPos;
-
-	float CylTest_CapsFirst(const osg::Vec3 &pt1, const osg::Vec3 &pt2, float lengthsq, float radius_sq, const osg::Vec3 &testpt);
 };
 
 template <typename D>
-DiskDrawer<D>::DiskDrawer(osg::ref_ptr<OpenFrames::FrameManager> fm, std::vector<PCVR_Selectable*> selectables,
+DiskDrawer<D>::DiskDrawer(osg::ref_ptr<OpenFrames::FrameManager> fm, const std::vector<LasModel*>& models,
 	PCVR_Controller* controller)
-	: _fm(fm), _selectables(selectables), _controller(controller)
+	: _fm(fm), _models(models), _controller(controller)
 {
 }
 
@@ -123,13 +140,13 @@ template <typename D>
 void DiskDrawer<D>::stopUsingTool()
 {
 	// Disk drawing finished, now highlight model points under cylinder
-	// Assume a single model file for now
-	// Iterate through all PCVR_Selectable ModelPoints.
-	// Set ones inside the cylinder to yellow.
+	// All models share one frame, but aligned scans carry their own model
+	// transform, so the cylinder is brought into each model's coordinates.
+	// Query each model's point grid for the points inside the cylinder.
+	// Highlight points inside the cylinder in yellow.
+	if (_currentDisk == nullptr) return;
 
 	LasModelScene* modelScene = static_cast<LasModelScene*>(PCVR_Scene::Instance);
-	LasModel* model = static_cast<LasModel*>(modelScene->getModels().at(0));	// single model assumed right now
-	osg::Vec4Array& colors = model->getColors();
 	osg::ShapeDrawable* shapeDrawable = _currentDisk->getShapeDrawable();
 	int cIndex = _controller == PCVR_Controller::Left() ? 0 : 1;
 
@@ -153,26 +170,33 @@ void DiskDrawer<D>::stopUsingTool()
 	double circumfSum = 0;
 	double circumfAvg = 0;
 	double radius = _currentDisk->getRadius();
-	//std::cout << "Selectables Size: " << _selectables.size() << std::endl;
 	long numPointsInDisk = 0;
-	for (std::size_t i = 0; i < _selectables.size(); i++)
+	SelectionDisk::ModelSelection selection;
+	for (LasModel* model : _models)
 	{
-		if (_currentDisk != nullptr)
+		const osg::Matrixd toModel = osg::Matrixd::inverse(model->getModelMatrix());
+		const osg::Vec3d center = diskCenter * toModel;
+		std::vector<unsigned int> indices;
+		model->getPointGrid().queryCylinder(pt1 * toModel, pt2 * toModel, radius, indices);
+		model->removeDeleted(indices);
+		if (indices.empty()) continue;
+
+		const osg::Vec3Array& verts = *model->getPointTable().positions;
+		for (unsigned int i : indices)
 		{
-			osg::Vec3 point = _selectables.at(i)->getPos(); 
-			
-			//std::cout << "Circumference Sum: " << circumfSum << std::endl;
-			
-			if (CylTest_CapsFirst(pt1, pt2, _currentDisk->getHeight() * _currentDisk->getHeight(),
-				_currentDisk->getRadius() *_currentDisk->getRadius(), point) != -1.0f)
-			{
-				colors.at(i) = osg::Vec4(1.0f, 1.0f, 0.0f, 1.0f); // yellow for now
-				circumfSum += 2.0 * M_PI * ((double) (point - diskCenter).length());
-				numPointsInDisk++;
-			}
+			circumfSum += 2.0 * M_PI * ((double) (verts[i] - center).length());
 		}
+
+		// Fill in the selection first when coloring by local geometry.
+		if (isFeatureColorMode(model->getColorizer().getMode())) model->computeFeatures(indices);
+
+		numPointsInDisk += indices.size();
+		selection.push_back(std::make_pair(model, std::move(indices)));
 	}
-	circumfAvg = (circumfSum / numPointsInDisk) / 10;
+	_fm->lock();
+	_currentDisk->setSelection(std::move(selection));
+	_fm->unlock();
+	if (numPointsInDisk > 0) circumfAvg = (circumfSum / numPointsInDisk) / 10;
 	//std::cout << "Circumference Avg: " << circumfAvg << std::endl;
 	modelScene->_circumferenceLabel[cIndex]->setText(QString::number(circumfAvg));
 	// Create circumference panel and position next to disk.  Face panel toward user.
@@ -258,61 +282,4 @@ void DiskDrawer<D>::stopUsingTool()
 	_fm->unlock();
 
 	_currentDisk->show(false);
-	colors.dirty();
 }
-
-template <typename D>
-float DiskDrawer<D>::CylTest_CapsFirst(const osg::Vec3 &pt1, const osg::Vec3 &pt2, float lengthsq, float radius_sq, const osg::Vec3 &testpt)
-{
-	float dx, dy, dz;	// vector d  from line segment point 1 to point 2
-	float pdx, pdy, pdz;	// vector pd from point 1 to test point
-	float dot, dsq;
-
-	dx = pt2.x() - pt1.x();	// translate so pt1 is origin.  Make vector from
-	dy = pt2.y() - pt1.y();     // pt1 to pt2.  Need for this is easily eliminated
-	dz = pt2.z() - pt1.z();
-
-	pdx = testpt.x() - pt1.x();		// vector from pt1 to test point.
-	pdy = testpt.y() - pt1.y();
-	pdz = testpt.z() - pt1.z();
-
-	// Dot the d and pd vectors to see if point lies behind the 
-	// cylinder cap at pt1.x, pt1.y, pt1.z
-
-	dot = pdx * dx + pdy * dy + pdz * dz;
-
-	// If dot is less than zero the point is behind the pt1 cap.
-	// If greater than the cylinder axis line segment length squared
-	// then the point is outside the other end cap at pt2.
-
-	if (dot < 0.0f || dot > lengthsq)
-	{
-		return(-1.0f);
-	}
-	else
-	{
-		// Point lies within the parallel caps, so find
-		// distance squared from point to line, using the fact that sin^2 + cos^2 = 1
-		// the dot = cos() * |d||pd|, and cross*cross = sin^2 * |d|^2 * |pd|^2
-		// Carefull: '*' means mult for scalars and dotproduct for vectors
-		// In short, where dist is pt distance to cyl axis: 
-		// dist = sin( pd to d ) * |pd|
-		// distsq = dsq = (1 - cos^2( pd to d)) * |pd|^2
-		// dsq = ( 1 - (pd * d)^2 / (|pd|^2 * |d|^2) ) * |pd|^2
-		// dsq = pd * pd - dot * dot / lengthsq
-		//  where lengthsq is d*d or |d|^2 that is passed into this function 
-
-		// distance squared to the cylinder axis:
-
-		dsq = (pdx*pdx + pdy * pdy + pdz * pdz) - dot * dot / lengthsq;
-
-		if (dsq > radius_sq)
-		{
-			return(-1.0f);
-		}
-		else
-		{
-			return(dsq);		// return distance squared to axis
-		}
-	}
-}
\ No newline at end of file
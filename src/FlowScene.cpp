@@ -34,6 +34,7 @@
 #include <QStackedWidget>
 #include <QComboBox>
 
+#include "PCVR_Color.hpp"
 #include "PCVR_Scene.hpp"
 #include "FlowScene.hpp"
 #include "DarwinNetcdfs.hpp"
@@ -104,7 +105,8 @@ void FlowScene::buildScene()
 			cout << "------------>> dataset number is: <<--------" << _datasetNum << endl;
 			
 			ptVerts.push_back(new osg::Vec3Array());
-			ptColors.push_back(new osg::Vec4Array());
+			ptColors.push_back(new osg::Vec4ubArray());
+			ptColors.back()->setNormalize(true);
 
 			allCoco.push_back(std::vector<float>());
 			allDino.push_back(std::vector<float>());
@@ -197,7 +199,7 @@ void FlowScene::addPoints(const float phyto[DarwinNetcdfs::NZ][DarwinNetcdfs::NL
 					ptVerts[_datasetNum]->push_back(vert);
 					filteredDensities[_datasetNum].push_back(phyto[z][l][lo]);
 					pcolor = phyto_color * (phyto[z][l][lo] / scaling_factor);
-					ptColors[_datasetNum]->push_back(pcolor);
+					ptColors[_datasetNum]->push_back(quantizeColor(pcolor));
 					ptCount++;
 				}
 			}
@@ -275,7 +277,7 @@ void FlowScene::addAll()
 					ptVerts[_datasetNum]->push_back(vert);
 				    
 					phyto_color = osg::Vec4(dino_color, diatom_color, coco_color, alphaScale);
-					ptColors[_datasetNum]->push_back(phyto_color);
+					ptColors[_datasetNum]->push_back(quantizeColor(phyto_color));
 				
 					allDiatom[_datasetNum].push_back(diatom_value);
 					allCoco[_datasetNum].push_back(coco_value);
@@ -400,14 +402,14 @@ void FlowScene::updateColorChannel(std::string colorText, int colorIndex, float
 		{
 			for (int i = 0; i < ptColors[fileIndex]->size(); i++)
 			{
-				(ptColors[fileIndex]->at(i))[colorIndex] = allDino[fileIndex][i] / scale;
+				(ptColors[fileIndex]->at(i))[colorIndex] = quantizeColorChannel(allDino[fileIndex][i] / scale);
 			}
 		}
 		else if (colorText == "Diatoms")
 		{
 			for (int i = 0; i < ptColors[fileIndex]->size(); i++)
 			{
-				(ptColors[fileIndex]->at(i))[colorIndex] = allDiatom[fileIndex][i] / scale;
+				(ptColors[fileIndex]->at(i))[colorIndex] = quantizeColorChannel(allDiatom[fileIndex][i] / scale);
 			}
 
 		}
@@ -415,14 +417,14 @@ void FlowScene::updateColorChannel(std::string colorText, int colorIndex, float
 		{
 			for (int i = 0; i < ptColors[fileIndex]->size(); i++)
 			{
-				(ptColors[fileIndex]->at(i))[colorIndex] = allCoco[fileIndex][i] / scale;
+				(ptColors[fileIndex]->at(i))[colorIndex] = quantizeColorChannel(allCoco[fileIndex][i] / scale);
 			}
 		}
 		else if (colorText == "Prokaryotes")
 		{
 			for (int i = 0; i < ptColors[fileIndex]->size(); i++)
 			{
-				(ptColors[fileIndex]->at(i))[colorIndex] = allProk[fileIndex][i] / scale;
+				(ptColors[fileIndex]->at(i))[colorIndex] = quantizeColorChannel(allProk[fileIndex][i] / scale);
 			}
 
 		}
@@ -438,12 +440,13 @@ void FlowScene::updateAlpha(float alpha)
 
 	cout << "alpha Scale is:" << alphaScale;
 
+	const unsigned char alphaValue = quantizeColorChannel(alphaScale);
 	for (unsigned int fileIndex = 0; fileIndex < _ptSwitch->getNumChildren(); fileIndex++)
 	{
 
 		for (int i = 0; i < ptColors[fileIndex]->size(); i++)
 		{
-			(ptColors[fileIndex]->at(i))[3] = alphaScale;
+			(ptColors[fileIndex]->at(i))[3] = alphaValue;
 		}
 
 
@@ -31,7 +31,7 @@ private:
 	osg::ref_ptr<osg::Switch> _ptSwitch = new osg::Switch();
 
 	std::vector<osg::ref_ptr<osg::Vec3Array>> ptVerts;
-	std::vector<osg::ref_ptr<osg::Vec4Array>> ptColors;
+	std::vector<osg::ref_ptr<osg::Vec4ubArray>> ptColors;
 
 
 	std::vector<vector<float>> filteredDensities;
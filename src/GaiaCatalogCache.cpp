@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <tuple>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "PCVR_Parallel.hpp"
+
+#include "GaiaCatalogCache.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	// Bump whenever the layout below or the meaning of a column changes.
+	const uint32_t CACHE_VERSION = 1;
+	const char CACHE_MAGIC[8] = { 'P', 'C', 'V', 'R', 'G', 'A', 'I', 'A' };
+	const std::size_t COLUMN_ALIGNMENT = 16;
+
+	struct CacheHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t magColor;
+		uint64_t sourceHash;
+		uint64_t knownStarsHash;
+		double minPc, maxPc;
+		double minParallax, maxParallax;
+		double minMag, maxMag;
+		double minTeff, maxTeff;
+		uint64_t numStars;
+	};
+	static_assert(sizeof(CacheHeader) == 104, "CacheHeader must not contain padding");
+
+	// The per-star double columns, in file order after the point columns.
+	double GaiaStar::* const STAR_COLUMNS[] =
+	{
+		&GaiaStar::ra, &GaiaStar::dec, &GaiaStar::l, &GaiaStar::b, &GaiaStar::parallax, &GaiaStar::teff,
+		&GaiaStar::abs_g_mag, &GaiaStar::phot_bp_mean_mag, &GaiaStar::phot_rp_mean_mag,
+		&GaiaStar::a_g_val, &GaiaStar::e_bp_min_rp_val
+	};
+	const std::size_t NUM_STAR_COLUMNS = sizeof(STAR_COLUMNS) / sizeof(STAR_COLUMNS[0]);
+
+	std::size_t alignUp(std::size_t offset)
+	{
+		return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+	}
+
+	// Bytes per star of every column, in file order.
+	std::vector<std::size_t> columnSizes()
+	{
+		std::vector<std::size_t> sizes = { sizeof(int64_t), sizeof(osg::Vec3), sizeof(osg::Vec3), sizeof(osg::Vec4ub) };
+		sizes.insert(sizes.end(), NUM_STAR_COLUMNS, sizeof(double));
+		return sizes;
+	}
+
+	void hashBytes(uint64_t& hash, const void* data, std::size_t size)
+	{
+		// FNV-1a
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (std::size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ULL;
+		}
+	}
+
+	// Fingerprint of the files in dataPath; independent of the listing order.
+	bool hashSourceFiles(const std::string& dataPath, uint64_t& hash)
+	{
+		std::vector<std::tuple<std::string, uint64_t, int64_t>> files;
+		std::error_code ec;
+		for (fs::directory_iterator it(dataPath, ec), end; !ec && it != end; it.increment(ec))
+		{
+			uint64_t size = fs::file_size(it->path(), ec);
+			if (ec) return false;
+			int64_t time = static_cast<int64_t>(fs::last_write_time(it->path(), ec).time_since_epoch().count());
+			if (ec) return false;
+			files.emplace_back(it->path().filename().string(), size, time);
+		}
+		if (ec) return false;
+		std::sort(files.begin(), files.end());
+
+		hash = 0xcbf29ce484222325ULL;
+		for (const auto& file : files)
+		{
+			hashBytes(hash, std::get<0>(file).c_str(), std::get<0>(file).size() + 1);
+			hashBytes(hash, &std::get<1>(file), sizeof(uint64_t));
+			hashBytes(hash, &std::get<2>(file), sizeof(int64_t));
+		}
+		return true;
+	}
+
+	uint64_t hashKnownStars(const GaiaKnownStars& knownStars)
+	{
+		std::vector<long long> ids;
+		ids.reserve(knownStars.size());
+		for (const auto& known : knownStars)
+		{
+			ids.push_back(known.first);
+		}
+		std::sort(ids.begin(), ids.end());
+
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		if (!ids.empty()) hashBytes(hash, ids.data(), ids.size() * sizeof(long long));
+		return hash;
+	}
+
+	bool makeHeader(const std::string& dataPath, const GaiaCatalogFilter& filter,
+		const GaiaKnownStars& knownStars, CacheHeader& header)
+	{
+		header = CacheHeader();
+		std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.version = CACHE_VERSION;
+		header.magColor = filter.magColor ? 1 : 0;
+		header.knownStarsHash = hashKnownStars(knownStars);
+		header.minPc = filter.minPc;
+		header.maxPc = filter.maxPc;
+		header.minParallax = filter.minParallax;
+		header.maxParallax = filter.maxParallax;
+		header.minMag = filter.minMag;
+		header.maxMag = filter.maxMag;
+		header.minTeff = filter.minTeff;
+		header.maxTeff = filter.maxTeff;
+		return hashSourceFiles(dataPath, header.sourceHash);
+	}
+
+	template <typename T>
+	const T* columnAt(const char* data, std::size_t& offset, std::size_t n)
+	{
+		offset = alignUp(offset);
+		const T* first = reinterpret_cast<const T*>(data + offset);
+		offset += sizeof(T) * n;
+		return first;
+	}
+}
+
+std::string GaiaCatalogCache::GetCachePath(const std::string& dataPath)
+{
+	// Beside the directory, not in it, so it is never read as a CSV file.
+	std::string path = dataPath;
+	while (path.size() > 1 && (path.back() == '/' || path.back() == '\\'))
+	{
+		path.pop_back();
+	}
+	return path + ".pcvrgaia";
+}
+
+bool GaiaCatalogCache::Read(const std::string& dataPath, const GaiaCatalogFilter& filter,
+	const GaiaKnownStars& knownStars, GaiaStarBuffer& buffer)
+{
+	std::string cachePath = GetCachePath(dataPath);
+	CacheHeader expected;
+	if (!fs::exists(cachePath) || !makeHeader(dataPath, filter, knownStars, expected)) return false;
+
+	boost::iostreams::mapped_file_source file;
+	try
+	{
+		file.open(cachePath);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+	if (file.size() < sizeof(CacheHeader)) return false;
+
+	CacheHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	expected.numStars = header.numStars;
+	if (std::memcmp(&header, &expected, sizeof(header)) != 0) return false;
+
+	// Check the file holds every column before reading any.
+	const std::size_t n = static_cast<std::size_t>(header.numStars);
+	std::size_t offset = sizeof(CacheHeader);
+	for (std::size_t bytesPerStar : columnSizes())
+	{
+		offset = alignUp(offset) + bytesPerStar * n;
+	}
+	if (offset > file.size()) return false;
+
+	// The point columns are bulk copies straight out of the mapping.
+	const char* data = file.data();
+	offset = sizeof(CacheHeader);
+	const int64_t* sourceIds = columnAt<int64_t>(data, offset, n);
+	const osg::Vec3* positions = columnAt<osg::Vec3>(data, offset, n);
+	const osg::Vec3* velocities = columnAt<osg::Vec3>(data, offset, n);
+	const osg::Vec4ub* colors = columnAt<osg::Vec4ub>(data, offset, n);
+	buffer.positions.assign(positions, positions + n);
+	buffer.velocities.assign(velocities, velocities + n);
+	buffer.colors.assign(colors, colors + n);
+
+	const double* starColumns[NUM_STAR_COLUMNS];
+	for (std::size_t c = 0; c < NUM_STAR_COLUMNS; c++)
+	{
+		starColumns[c] = columnAt<double>(data, offset, n);
+	}
+
+	buffer.stars.resize(n);
+	parallelFor(0, n, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			GaiaStar* star = new GaiaStar();
+			star->sourceId = sourceIds[i];
+			star->pos = positions[i];
+			star->vel = velocities[i];
+			star->starVert = positions[i];
+			star->starVertOrig = positions[i];
+			for (std::size_t c = 0; c < NUM_STAR_COLUMNS; c++)
+			{
+				star->*STAR_COLUMNS[c] = starColumns[c][i];
+			}
+			buffer.stars[i] = star;
+		}
+	});
+	return true;
+}
+
+bool GaiaCatalogCache::Write(const std::string& dataPath, const GaiaCatalogFilter& filter,
+	const GaiaKnownStars& knownStars, const GaiaStarBuffer* buffers, std::size_t count)
+{
+	CacheHeader header;
+	if (!makeHeader(dataPath, filter, knownStars, header)) return false;
+	for (std::size_t b = 0; b < count; b++)
+	{
+		header.numStars += buffers[b].stars.size();
+	}
+
+	// Write next to the final name and swap it in, so an interrupted write
+	// never leaves a cache that looks valid.
+	std::string cachePath = GetCachePath(dataPath);
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream ofs(tempPath, std::ios::binary);
+		if (!ofs)
+		{
+			std::cout << "Could not write Gaia cache " << cachePath << std::endl;
+			return false;
+		}
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::size_t offset = sizeof(header);
+		const char zeros[COLUMN_ALIGNMENT] = {};
+		auto startColumn = [&](std::size_t bytesPerStar)
+		{
+			std::size_t aligned = alignUp(offset);
+			ofs.write(zeros, aligned - offset);
+			offset = aligned + bytesPerStar * header.numStars;
+		};
+		auto writeColumn = [&](const void* column, std::size_t bytes)
+		{
+			if (bytes > 0) ofs.write(static_cast<const char*>(column), bytes);
+		};
+
+		startColumn(sizeof(int64_t));
+		for (std::size_t b = 0; b < count; b++)
+		{
+			std::vector<int64_t> ids;
+			ids.reserve(buffers[b].stars.size());
+			for (const GaiaStar* star : buffers[b].stars)
+			{
+				ids.push_back(star->sourceId);
+			}
+			writeColumn(ids.data(), ids.size() * sizeof(int64_t));
+		}
+		startColumn(sizeof(osg::Vec3));
+		for (std::size_t b = 0; b < count; b++)
+		{
+			writeColumn(buffers[b].positions.data(), buffers[b].positions.size() * sizeof(osg::Vec3));
+		}
+		startColumn(sizeof(osg::Vec3));
+		for (std::size_t b = 0; b < count; b++)
+		{
+			writeColumn(buffers[b].velocities.data(), buffers[b].velocities.size() * sizeof(osg::Vec3));
+		}
+		startColumn(sizeof(osg::Vec4ub));
+		for (std::size_t b = 0; b < count; b++)
+		{
+			writeColumn(buffers[b].colors.data(), buffers[b].colors.size() * sizeof(osg::Vec4ub));
+		}
+		for (std::size_t c = 0; c < NUM_STAR_COLUMNS; c++)
+		{
+			startColumn(sizeof(double));
+			for (std::size_t b = 0; b < count; b++)
+			{
+				std::vector<double> values;
+				values.reserve(buffers[b].stars.size());
+				for (const GaiaStar* star : buffers[b].stars)
+				{
+					values.push_back(star->*STAR_COLUMNS[c]);
+				}
+				writeColumn(values.data(), values.size() * sizeof(double));
+			}
+		}
+
+		if (!ofs)
+		{
+			std::cout << "Could not write Gaia cache " << cachePath << std::endl;
+			ofs.close();
+			std::error_code ec;
+			fs::remove(tempPath, ec);
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::remove(cachePath, ec);
+	fs::rename(tempPath, cachePath, ec);
+	if (ec)
+	{
+		std::cout << "Could not write Gaia cache " << cachePath << ": " << ec.message() << std::endl;
+		fs::remove(tempPath, ec);
+		return false;
+	}
+	return true;
+}
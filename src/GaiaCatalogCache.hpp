@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <osg/Vec3>
+#include <osg/Vec4ub>
+
+#include "GaiaStar.hpp"
+
+// Stars read from Gaia data, in file order, with their point columns.
+struct GaiaStarBuffer
+{
+	std::vector<GaiaStar*> stars;
+	std::vector<osg::Vec3> positions;
+	std::vector<osg::Vec3> velocities;
+	std::vector<osg::Vec4ub> colors;
+};
+
+// The command line filters and coloring a catalog was built with.
+struct GaiaCatalogFilter
+{
+	double minPc, maxPc;
+	double minParallax, maxParallax;
+	double minMag, maxMag;
+	double minTeff, maxTeff;
+	bool magColor;
+};
+
+//-----------------------------------------------------------------------------
+// GaiaCatalogCache
+//    Sidecar file (<data directory>.pcvrgaia) holding the stars GaiaScene
+// kept from one directory of Gaia CSV files, already filtered and
+// transformed to galactic positions and velocities. Each column (source_id,
+// position, velocity, point color, ra/dec/l/b, parallax, teff, magnitudes
+// and extinction) is stored contiguously, so loading is one bulk copy per
+// column out of the mapped file instead of a CSV parse.
+//
+//    The header records the filters the stars were kept with, a fingerprint
+// of the directory's files (names, sizes and modification times) and of the
+// known star source_ids, which pass the filters regardless. Any mismatch
+// makes Read fail and the caller rebuilds the cache from the CSV files.
+//-----------------------------------------------------------------------------
+class GaiaCatalogCache
+{
+public:
+	static std::string GetCachePath(const std::string& dataPath);
+
+	// Fill 'buffer' with the cached stars of dataPath, if the cache matches.
+	static bool Read(const std::string& dataPath, const GaiaCatalogFilter& filter,
+		const GaiaKnownStars& knownStars, GaiaStarBuffer& buffer);
+
+	// Write the stars of 'count' buffers, in order, as the cache of dataPath.
+	// Failure only costs the next launch a full parse.
+	static bool Write(const std::string& dataPath, const GaiaCatalogFilter& filter,
+		const GaiaKnownStars& knownStars, const GaiaStarBuffer* buffers, std::size_t count);
+};
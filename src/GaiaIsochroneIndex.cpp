@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "GaiaIsochroneIndex.hpp"
+
+namespace
+{
+	const int MAX_CELLS_PER_AXIS = 1024;
+}
+
+void GaiaIsochroneIndex::build(const std::vector<osg::Vec2d>& points, double tolerance)
+{
+	_cellStart.clear();
+	_points.clear();
+
+	_min.set(DBL_MAX, DBL_MAX);
+	_max.set(-DBL_MAX, -DBL_MAX);
+	std::vector<osg::Vec2d> finite;
+	for (const osg::Vec2d& p : points)
+	{
+		if (!std::isfinite(p.x()) || !std::isfinite(p.y())) continue;
+		finite.push_back(p);
+		for (int axis = 0; axis < 2; axis++)
+		{
+			_min[axis] = std::min(_min[axis], p[axis]);
+			_max[axis] = std::max(_max[axis], p[axis]);
+		}
+	}
+	if (finite.empty()) return;
+
+	osg::Vec2d extent = _max - _min;
+	_cellSize = std::max(tolerance, std::max(extent.x(), extent.y()) / MAX_CELLS_PER_AXIS);
+	if (!(_cellSize > 0.0)) _cellSize = 1.0;
+	for (int axis = 0; axis < 2; axis++)
+	{
+		_dims[axis] = std::max(1, static_cast<int>(std::ceil(extent[axis] / _cellSize)));
+	}
+
+	// Counting sort of the points by cell.
+	std::vector<uint32_t> cells(finite.size());
+	_cellStart.assign(std::size_t(_dims[0]) * _dims[1] + 1, 0);
+	for (std::size_t i = 0; i < finite.size(); i++)
+	{
+		cells[i] = cellCoord(finite[i].x(), 0) + _dims[0] * cellCoord(finite[i].y(), 1);
+		_cellStart[cells[i] + 1]++;
+	}
+	for (std::size_t c = 0; c + 1 < _cellStart.size(); c++)
+	{
+		_cellStart[c + 1] += _cellStart[c];
+	}
+
+	_points.resize(finite.size());
+	std::vector<uint32_t> next(_cellStart.begin(), _cellStart.end() - 1);
+	for (std::size_t i = 0; i < finite.size(); i++)
+	{
+		_points[next[cells[i]]++] = finite[i];
+	}
+}
+
+int GaiaIsochroneIndex::cellCoord(double v, int axis) const
+{
+	int c = static_cast<int>((v - _min[axis]) / _cellSize);
+	return std::min(std::max(c, 0), _dims[axis] - 1);
+}
+
+bool GaiaIsochroneIndex::hasPointNear(const osg::Vec2d& p, double tolerance) const
+{
+	if (_points.empty() || !std::isfinite(p.x()) || !std::isfinite(p.y())) return false;
+	for (int axis = 0; axis < 2; axis++)
+	{
+		if (p[axis] + tolerance < _min[axis] || p[axis] - tolerance > _max[axis]) return false;
+	}
+
+	const int x0 = cellCoord(p.x() - tolerance, 0), x1 = cellCoord(p.x() + tolerance, 0);
+	const int y0 = cellCoord(p.y() - tolerance, 1), y1 = cellCoord(p.y() + tolerance, 1);
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			const uint32_t c = x + _dims[0] * y;
+			for (uint32_t k = _cellStart[c]; k < _cellStart[c + 1]; k++)
+			{
+				if (std::abs(p.x() - _points[k].x()) <= tolerance && std::abs(p.y() - _points[k].y()) <= tolerance)
+				{
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <osg/Vec2d>
+
+//-----------------------------------------------------------------------------
+// GaiaIsochroneIndex
+//    Uniform grid over the (absolute G magnitude, BP-RP color) points of an
+// isochrone table, for matching stars against the table. Cells are as wide
+// as the match tolerance (coarser if the table would need too many), so a
+// star only looks at the few cells its tolerance box overlaps instead of
+// every entry. Points are counting-sorted by cell, so each cell is one
+// contiguous run of _points.
+//
+//    Rebuild the index when the tolerance changes.
+//-----------------------------------------------------------------------------
+class GaiaIsochroneIndex
+{
+public:
+	void build(const std::vector<osg::Vec2d>& points, double tolerance);
+
+	// Whether a point lies within 'tolerance' of p on both axes. The same
+	// tolerance the index was built for keeps the query to a few cells.
+	bool hasPointNear(const osg::Vec2d& p, double tolerance) const;
+
+private:
+	osg::Vec2d _min, _max;
+	double _cellSize = 1.0;
+	int _dims[2] = { 0, 0 };
+	std::vector<uint32_t> _cellStart;	// _points[_cellStart[c], _cellStart[c + 1]) are in cell c
+	std::vector<osg::Vec2d> _points;
+
+	int cellCoord(double v, int axis) const;
+};
@@ -1,4 +1,5 @@
-﻿#include <filesystem>
+﻿#include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <sstream>
 #define _USE_MATH_DEFINES
@@ -13,6 +14,9 @@
 #include "csv.h"
 
 #include "GaiaStar.hpp"
+#include "PCVR_Color.hpp"
+#include "PCVR_Kernels.hpp"
+#include "PCVR_Parallel.hpp"
 #include "GaiaSphere.hpp"
 #include "SphereDrawer.hpp"
 
@@ -50,6 +54,34 @@ const std::vector<std::string> stringCOLORS =
 	"gray"		// Gray
 };
 
+// Coefficients that move a star 't' thousand years from its position at
+// time 0, by epicyclic motion in the galactic disk or in a straight line.
+KernelMotion getStarMotion(float t, bool straightLine)
+{
+	if (straightLine)
+	{
+		KernelMotion motion = { t, 0.0f, 0.0f, 0.0f, t, 1.0f, t };
+		return motion;
+	}
+
+	const double omega = 2.828427e-5;
+	const double nu = 7.5e-5;
+	const double a = omega / 2;
+	const double b = -omega / 2;
+	const double kappa = std::sqrt(-4 * omega * b);
+	const double s = std::sin(kappa * t), c = std::cos(kappa * t);
+
+	KernelMotion motion;
+	motion.xu = static_cast<float>(s / kappa);
+	motion.xv = static_cast<float>(b / 2 * (1.0 - c));
+	motion.yx = static_cast<float>(2 * a * t);
+	motion.yu = static_cast<float>(2 * omega / (kappa * kappa) * (1.0 - c));
+	motion.yv = static_cast<float>(2 * a * t / (2 * b) - omega / (b * kappa) * s);
+	motion.zz = static_cast<float>(std::cos(nu * t));
+	motion.zw = static_cast<float>(std::sin(nu * t) / nu);
+	return motion;
+}
+
 double deg2rad(double deg)
 {
 	return deg * M_PI / 180.0;
@@ -93,6 +125,8 @@ void GaiaScene::parseArgs(osg::ArgumentParser& args)
 	args.read("--maxTeff", _maxTeff);
 
 	_magColor = args.read("--magColor");
+
+	args.read("--isochroneTolerance", _isochroneTolerance);
 }
 
 void GaiaScene::initWindowAndVR()
@@ -120,125 +154,64 @@ void GaiaScene::buildScene()
 	_windowProxy->getGridPosition(0, 0)->setBackgroundColor(0, 0, 0);
 	_windowProxy->getGridPosition(0, 0)->setSkySphereStarData("../../data/images/Stars_HYGv3.txt", -2.0, 8.0, 40000, 1.0, 4.0, 0.1);
 
-	std::unordered_map<long long, GaiaStar*> knownStars;
-	setKnownStars(knownStars);	// Fill in _knownStars
+	GaiaKnownStars knownStars;
+	setKnownStars(knownStars);	// Fill in _knownGroups and index them by source_id
 	readSpheres();		// Read in existing selection spheres
 	readIsochrones();	// Read in Isochrone tables
 
-	osg::ref_ptr<osg::Vec4Array> ptColors = new osg::Vec4Array();
-	for (auto& dataPath : _dataPaths)
+	std::vector<GaiaStarBuffer> buffers;
+	readCatalog(knownStars, buffers);
+
+	std::size_t numStars = 0;
+	for (const GaiaStarBuffer& buffer : buffers)
+	{
+		numStars += buffer.stars.size();
+	}
+	_allStars.reserve(numStars);
+	_ptVertsOrig->reserve(numStars);
+	_ptVerts->reserve(numStars);
+	_ptVels->reserve(numStars);
+	osg::ref_ptr<osg::Vec4ubArray> ptColors = new osg::Vec4ubArray();
+	ptColors->setNormalize(true);
+	ptColors->reserve(numStars);
+	for (GaiaStarBuffer& buffer : buffers)
 	{
-		for (auto & fname : fs::directory_iterator(dataPath))
+		for (GaiaStar* star : buffer.stars)
 		{
-			std::string fileString = fname.path().string();
-			std::cout << "Reading data file: " << fileString << std::endl;
-
-			io::CSVReader<15> in(fileString);
-			try
-			{
-				// Note radial_velocity is only valid for DR2
-				in.read_header(io::ignore_extra_column,
-					"source_id", "ra", "dec", "l", "b", "parallax", "pmra", "pmdec", "phot_g_mean_mag",
-					"radial_velocity", "teff_val", "phot_bp_mean_mag", "phot_rp_mean_mag", "a_g_val",
-					"e_bp_min_rp_val");
-			}
-			catch (const std::exception& e)
+			// If star source_id is found in known stars, then fill pos and vel in groups to which it belongs.
+			auto known = knownStars.find(star->sourceId);
+			if (known != knownStars.end())
 			{
-				std::cout << e.what() << std::endl;
-			}
-
-			long long source_id;
-			double ra, dec, l, b, parallax, pmra, pmdec, a_g_val, e_bp_min_rp_val,
-				phot_g_mean_mag, rv, teff, phot_bp_mean_mag, phot_rp_mean_mag;
-
-			while (in.read_row(source_id, ra, dec, l, b, parallax, pmra, pmdec, phot_g_mean_mag, rv,
-				teff, phot_bp_mean_mag, phot_rp_mean_mag, a_g_val, e_bp_min_rp_val))
-			{
-				if (_minParallax <= parallax && parallax <= _maxParallax)
+				for (GaiaStar* knownStar : known->second)
 				{
-					// Compute dependent columns and store array values and points
-					double dist = 1000.0 / parallax;
-					double phi = 90.0 - b;
-
-					double abs_g_mag = phot_g_mean_mag + 5 * (log10(parallax / 1000) + 1);
-
-					double x = dist * cos(deg2rad(l)) * sin(deg2rad(phi));
-					double y = dist * sin(deg2rad(l)) * sin(deg2rad(phi));
-					double z = dist * cos(deg2rad(phi));
-					osg::Vec3 pos = osg::Vec3(x, y, z);
-
-					double c1 = sin(deg2rad(27.12825)) * cos(deg2rad(dec)) - cos(deg2rad(27.12825)) *
-						sin(deg2rad(dec)) * cos(deg2rad(ra - 192.85948));
-					double c2 = cos(deg2rad(27.12825)) * sin(deg2rad(ra - 192.85948));
-					double pml = (1 / cos(deg2rad(b))) * (c1 * pmra + c2 * pmdec);
-					double thetadot = pml / cos(deg2rad(b));
-					double pmb = (1 / cos(deg2rad(b))) * (c1 * pmdec - c2 * pmra);
-
-					const double pc_per_1kYR_to_km_per_sec = 977.813106;
-					double u = (rv / pc_per_1kYR_to_km_per_sec) * x / dist - (dist / 206264.806) * (sin(deg2rad(phi)) *
-						sin(deg2rad(l)) * thetadot - cos(deg2rad(phi)) * cos(deg2rad(l)) * (-pmb));
-					double v = (rv / pc_per_1kYR_to_km_per_sec) * y / dist + (dist / 206264.806) * (sin(deg2rad(phi)) *
-						cos(deg2rad(l)) * thetadot + cos(deg2rad(phi)) * sin(deg2rad(l)) * (-pmb));
-					double w = (rv / pc_per_1kYR_to_km_per_sec) * z / dist - dist * sin(deg2rad(phi)) * (-pmb) / 206264.806;
-					osg::Vec3 vel = osg::Vec3(u, v, w);
-
-					// And only stars that are known or satisfy command line parameters.
-					if (knownStars.count(source_id) ||
-						_minPc <= pos.length() && pos.length() <= _maxPc &&
-						_minMag <= abs_g_mag && abs_g_mag <= _maxMag &&
-						_minTeff <= teff && teff <= _maxTeff)
-					{
-						double normMag = (abs_g_mag - (-7.0)) / (12.0 - (-7.0));
-						double normTeff = (teff - (3000.0)) / (10000.0 - (3000.0));
-						double colorVal = _magColor ? normMag : normTeff;
-
-						// If star source_id is found in known stars, then fill pos and vel in groups to which it belongs.
-						auto itr = knownStars.find(source_id);
-						if (itr != knownStars.end()) {
-							for (auto& group : _knownGroups)
-							{
-								auto i = std::find_if(group.begin(), group.end(),
-									[=](GaiaStar* star) { return star->sourceId == source_id; });
-								if (i != group.end())
-								{
-									(*i)->pos = pos;
-									(*i)->vel = vel;
-									(*i)->found = true;
-									(*i)->starVert = pos;
-									(*i)->starVertOrig = pos;
-								}
-							}
-						}
-
-						// Add to Vector of All Stars
-						GaiaStar* star = new GaiaStar();
-						star->sourceId = source_id;
-
-						star->pos = pos;
-						star->vel = vel;
-						star->ra = ra;
-						star->dec = dec;
-						star->parallax = parallax;
-						star->teff = teff;
-						star->l = l;
-						star->b = b;
-
-						star->starVert = pos;
-						star->starVertOrig = pos;
-						star->abs_g_mag = abs_g_mag;
-						star->a_g_val = a_g_val;
-						star->e_bp_min_rp_val = e_bp_min_rp_val;
-						star->phot_bp_mean_mag = phot_bp_mean_mag;
-						star->phot_rp_mean_mag = phot_rp_mean_mag;
-						_allStars.push_back(star);
-
-						_ptVertsOrig->push_back(pos);
-						_ptVerts->push_back(pos);
-						_ptVels->push_back(vel);
-						ptColors->push_back(getHeatMapColor(1 - colorVal));
-					}
+					knownStar->pos = star->pos;
+					knownStar->vel = star->vel;
+					knownStar->found = true;
+					knownStar->starVert = star->pos;
+					knownStar->starVertOrig = star->pos;
 				}
 			}
+
+			_allStars.push_back(star);
+		}
+		_ptVertsOrig->insert(_ptVertsOrig->end(), buffer.positions.begin(), buffer.positions.end());
+		_ptVerts->insert(_ptVerts->end(), buffer.positions.begin(), buffer.positions.end());
+		_ptVels->insert(_ptVels->end(), buffer.velocities.begin(), buffer.velocities.end());
+		ptColors->insert(ptColors->end(), buffer.colors.begin(), buffer.colors.end());
+		buffer = GaiaStarBuffer();
+	}
+
+	for (int k = 0; k < 3; k++)
+	{
+		_motionColumns[k].resize(numStars);
+		_motionColumns[k + 3].resize(numStars);
+	}
+	for (std::size_t i = 0; i < numStars; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			_motionColumns[k][i] = (*_ptVertsOrig)[i][k];
+			_motionColumns[k + 3][i] = (*_ptVels)[i][k];
 		}
 	}
 
@@ -256,183 +229,253 @@ void GaiaScene::buildScene()
 
 	std::cout << "Total Number of Stars (with filtering, if used): " << _ptVerts->size() << std::endl;
 
+	std::size_t numFound = 0;
+	for (const auto& known : knownStars)
+	{
+		if (known.second.front()->found) numFound++;
+	}
+	std::cout << "Known stars found in data: " << numFound << " of " << knownStars.size()
+		<< " (" << knownStars.size() - numFound << " missing)" << std::endl;
+
 	matchStarsInIsochrones();
 	markersForIsochrones();
 	markersForKnownStars();
 }
 
-void GaiaScene::step(OpenFrames::FramerateLimiter& waitLimiter)
+void GaiaScene::readCatalog(const GaiaKnownStars& knownStars,
+	std::vector<GaiaStarBuffer>& buffers)
 {
-	PCVR_Scene::step(waitLimiter);
-
-	static int tick = 0;
-	if (_yearIncrement != 0 && !_paused && tick % 4 == 0)
+	GaiaCatalogFilter filter = { _minPc, _maxPc, _minParallax, _maxParallax, _minMag, _maxMag,
+		_minTeff, _maxTeff, _magColor };
+
+	// A data directory with a matching cache is read from it; the files of
+	// the others are parsed, filtered and transformed in parallel, each into
+	// its own buffer, and appended in file order so the stars keep the order
+	// of a sequential read.
+	std::vector<GaiaStarBuffer> cached(_dataPaths.size());
+	std::vector<char> isCached(_dataPaths.size(), 0);
+	std::vector<std::string> fileNames;
+	std::vector<std::size_t> firstFile(_dataPaths.size() + 1, 0);
+	for (std::size_t d = 0; d < _dataPaths.size(); d++)
 	{
-		updateToYear(_currentYear + (4 * _yearIncrement / waitLimiter.getFramerate()));
+		firstFile[d] = fileNames.size();
+		isCached[d] = GaiaCatalogCache::Read(_dataPaths[d], filter, knownStars, cached[d]);
+		if (isCached[d])
+		{
+			std::cout << "Read " << cached[d].stars.size() << " stars from "
+				<< GaiaCatalogCache::GetCachePath(_dataPaths[d]) << std::endl;
+			continue;
+		}
+		for (auto& fname : fs::directory_iterator(_dataPaths[d]))
+		{
+			fileNames.push_back(fname.path().string());
+		}
 	}
-	tick++;
-}
-
-void GaiaScene::updateToYear(long year)
-{
-	_currentYear = year;
-
-	_yearLabel[0]->setText(QString::number(_currentYear / 1000000.0, 'f', 8));
-	_yearLabel[1]->setText(QString::number(_currentYear / 1000000.0, 'f', 8));
-
-	// Move all stars to proper location based on _currentYear.
-	float t = _currentYear / 1000;
-	const float omega = 2.828427e-5;
-	const float nu = 7.5e-5;
-	const float a = omega / 2;
-	const float b = -omega / 2;
-	const float kappa = std::sqrt(-4 * omega * b);
+	firstFile[_dataPaths.size()] = fileNames.size();
+	if (!fileNames.empty()) std::cout << "Reading " << fileNames.size() << " data files..." << std::endl;
 
-	if (_straightVel == 0 && t != 0)
+	std::vector<GaiaStarBuffer> parsed(fileNames.size());
+	std::vector<char> failed(fileNames.size(), 0);
+	parallelFor(0, fileNames.size(), [&](std::size_t first, std::size_t last)
 	{
-		// Only move all stars if they are visible.
-		if (_ptSwitch->getChildValue(_ptSwitch->getChild(0)))
+		for (std::size_t f = first; f < last; f++)
 		{
-			for (int i = 0; i < _ptVerts->size(); i++)
+			try
 			{
-				float x0 = _ptVerts->at(i).x();
-				float y0 = _ptVerts->at(i).y();
-				float z0 = _ptVerts->at(i).z();
-
-				float u = _ptVels->at(i).x();
-				float v = _ptVels->at(i).y();
-				float w = _ptVels->at(i).z();
-
-				float x = x0 + (v / 2 * b) * (1.0 - cos(kappa*t)) + (u / kappa) * sin(kappa*t);
-				float y = y0 + 2 * a *(x0 + (v / (2 * b))) * t - (omega / (b*kappa))* v * sin(kappa*t)
-					+ (2 * omega / (kappa*kappa)) * u * (1.0 - cos(kappa*t));
-				float z = (w / nu) * sin(nu*t) + z0 * cos(nu * t);
-
-				_ptVerts->at(i).set(x, y, z);
+				readStarFile(fileNames[f], knownStars, parsed[f]);
 			}
-			_ptVerts->dirty();
-		}
-
-		// Move other known star markers once each
-		for (auto& group : _knownGroups)
-		{
-			for (auto star : group)
+			catch (const std::exception& e)
 			{
-				if (star->found)
-				{
-					float x0 = star->starVert.x();
-					float y0 = star->starVert.y();
-					float z0 = star->starVert.z();
-
-					float u = star->vel.x();
-					float v = star->vel.y();
-					float w = star->vel.z();
-
-					float x = x0 + (v / 2 * b) * (1.0 - cos(kappa*t)) + (u / kappa) * sin(kappa*t);
-					float y = y0 + 2 * a *(x0 + (v / (2 * b))) * t - (omega / (b*kappa))* v * sin(kappa*t)
-						+ (2 * omega / (kappa*kappa)) * u * (1.0 - cos(kappa*t));
-					float z = (w / nu) * sin(nu*t) + z0 * cos(nu * t);
-
-					star->traj->setPosition(x, y, z);
-
-					star->starVert.set(osg::Vec3(x, y, z));
-				}
+				std::cout << fileNames[f] << ": " << e.what() << std::endl;
+				failed[f] = 1;
 			}
 		}
+	}, 1);
 
-		// Move markers for isochrone stars by epicyclic motion
-		for (auto table : _isochroneTables)
+	for (std::size_t d = 0; d < _dataPaths.size(); d++)
+	{
+		if (isCached[d])
 		{
-			for (auto star : table->starsMatchingTable)
-			{
-				float x0 = star->starVert.x();
-				float y0 = star->starVert.y();
-				float z0 = star->starVert.z();
-
-				float u = star->vel.x();
-				float v = star->vel.y();
-				float w = star->vel.z();
-
-				float x = x0 + (v / 2 * b) * (1.0 - cos(kappa*t)) + (u / kappa) * sin(kappa*t);
-				float y = y0 + 2 * a *(x0 + (v / (2 * b))) * t - (omega / (b*kappa))* v * sin(kappa*t)
-					+ (2 * omega / (kappa*kappa)) * u * (1.0 - cos(kappa*t));
-				float z = (w / nu) * sin(nu*t) + z0 * cos(nu * t);
-
-				star->traj->setPosition(x, y, z);
+			buffers.push_back(std::move(cached[d]));
+			continue;
+		}
 
-				star->starVert.set(osg::Vec3(x, y, z));
-			}
+		// A directory that did not parse cleanly is not cached.
+		bool complete = true;
+		for (std::size_t f = firstFile[d]; f < firstFile[d + 1]; f++)
+		{
+			std::cout << "Read " << parsed[f].stars.size() << " stars from " << fileNames[f] << std::endl;
+			if (failed[f]) complete = false;
 		}
-	}
-	else if (t != 0)
-	{
-		if (_ptSwitch->getChildValue(_ptSwitch->getChild(0)))
+		if (complete)
 		{
-			// Move all stars but known ones first
-			for (int i = 0; i < _ptVerts->size(); i++)
-			{
-				_ptVerts->at(i).set(_ptVertsOrig->at(i) + _ptVels->at(i) * t);
-			}
-			_ptVerts->dirty();
+			GaiaCatalogCache::Write(_dataPaths[d], filter, knownStars, parsed.data() + firstFile[d],
+				firstFile[d + 1] - firstFile[d]);
 		}
-
-		// Move other known star markers once each
-		for (auto& group : _knownGroups)
+		for (std::size_t f = firstFile[d]; f < firstFile[d + 1]; f++)
 		{
-			for (auto star : group)
-			{
-				if (star->found)
-				{
-					star->traj->setPosition(star->starVert + star->vel * t);
-				}
-			}
+			buffers.push_back(std::move(parsed[f]));
 		}
+	}
+}
+
+void GaiaScene::readStarFile(const std::string& fileString, const GaiaKnownStars& knownStars,
+	GaiaStarBuffer& buffer)
+{
+	io::CSVReader<15> in(fileString);
+	try
+	{
+		// Note radial_velocity is only valid for DR2
+		in.read_header(io::ignore_extra_column,
+			"source_id", "ra", "dec", "l", "b", "parallax", "pmra", "pmdec", "phot_g_mean_mag",
+			"radial_velocity", "teff_val", "phot_bp_mean_mag", "phot_rp_mean_mag", "a_g_val",
+			"e_bp_min_rp_val");
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << e.what() << std::endl;
+	}
+
+	long long source_id;
+	double ra, dec, l, b, parallax, pmra, pmdec, a_g_val, e_bp_min_rp_val,
+		phot_g_mean_mag, rv, teff, phot_bp_mean_mag, phot_rp_mean_mag;
 
-		// Move markers for isochrone stars that were in the selected table
-		for (auto table : _isochroneTables)
+	while (in.read_row(source_id, ra, dec, l, b, parallax, pmra, pmdec, phot_g_mean_mag, rv,
+		teff, phot_bp_mean_mag, phot_rp_mean_mag, a_g_val, e_bp_min_rp_val))
+	{
+		if (_minParallax <= parallax && parallax <= _maxParallax)
 		{
-			for (auto star : table->starsMatchingTable)
+			// Compute dependent columns and store array values and points
+			double dist = 1000.0 / parallax;
+			double phi = 90.0 - b;
+
+			double abs_g_mag = phot_g_mean_mag + 5 * (log10(parallax / 1000) + 1);
+
+			double x = dist * cos(deg2rad(l)) * sin(deg2rad(phi));
+			double y = dist * sin(deg2rad(l)) * sin(deg2rad(phi));
+			double z = dist * cos(deg2rad(phi));
+			osg::Vec3 pos = osg::Vec3(x, y, z);
+
+			double c1 = sin(deg2rad(27.12825)) * cos(deg2rad(dec)) - cos(deg2rad(27.12825)) *
+				sin(deg2rad(dec)) * cos(deg2rad(ra - 192.85948));
+			double c2 = cos(deg2rad(27.12825)) * sin(deg2rad(ra - 192.85948));
+			double pml = (1 / cos(deg2rad(b))) * (c1 * pmra + c2 * pmdec);
+			double thetadot = pml / cos(deg2rad(b));
+			double pmb = (1 / cos(deg2rad(b))) * (c1 * pmdec - c2 * pmra);
+
+			const double pc_per_1kYR_to_km_per_sec = 977.813106;
+			double u = (rv / pc_per_1kYR_to_km_per_sec) * x / dist - (dist / 206264.806) * (sin(deg2rad(phi)) *
+				sin(deg2rad(l)) * thetadot - cos(deg2rad(phi)) * cos(deg2rad(l)) * (-pmb));
+			double v = (rv / pc_per_1kYR_to_km_per_sec) * y / dist + (dist / 206264.806) * (sin(deg2rad(phi)) *
+				cos(deg2rad(l)) * thetadot + cos(deg2rad(phi)) * sin(deg2rad(l)) * (-pmb));
+			double w = (rv / pc_per_1kYR_to_km_per_sec) * z / dist - dist * sin(deg2rad(phi)) * (-pmb) / 206264.806;
+			osg::Vec3 vel = osg::Vec3(u, v, w);
+
+			// And only stars that are known or satisfy command line parameters.
+			if (knownStars.count(source_id) ||
+				_minPc <= pos.length() && pos.length() <= _maxPc &&
+				_minMag <= abs_g_mag && abs_g_mag <= _maxMag &&
+				_minTeff <= teff && teff <= _maxTeff)
 			{
-				star->traj->setPosition(star->starVert + star->vel * t);
+				double normMag = (abs_g_mag - (-7.0)) / (12.0 - (-7.0));
+				double normTeff = (teff - (3000.0)) / (10000.0 - (3000.0));
+				double colorVal = _magColor ? normMag : normTeff;
+
+				// Add to the stars of this file
+				GaiaStar* star = new GaiaStar();
+				star->sourceId = source_id;
+
+				star->pos = pos;
+				star->vel = vel;
+				star->ra = ra;
+				star->dec = dec;
+				star->parallax = parallax;
+				star->teff = teff;
+				star->l = l;
+				star->b = b;
+
+				star->starVert = pos;
+				star->starVertOrig = pos;
+				star->abs_g_mag = abs_g_mag;
+				star->a_g_val = a_g_val;
+				star->e_bp_min_rp_val = e_bp_min_rp_val;
+				star->phot_bp_mean_mag = phot_bp_mean_mag;
+				star->phot_rp_mean_mag = phot_rp_mean_mag;
+				buffer.stars.push_back(star);
+				buffer.positions.push_back(pos);
+				buffer.velocities.push_back(vel);
+				buffer.colors.push_back(quantizeColor(getHeatMapColor(1 - colorVal)));
 			}
 		}
 	}
-	
+}
+
+void GaiaScene::step(OpenFrames::FramerateLimiter& waitLimiter)
+{
+	PCVR_Scene::step(waitLimiter);
+
+	static int tick = 0;
+	if (_yearIncrement != 0 && !_paused && tick % 4 == 0)
+	{
+		updateToYear(_currentYear + (4 * _yearIncrement / waitLimiter.getFramerate()));
+	}
+	tick++;
+}
+
+const osg::Vec3Array& GaiaScene::getStarPositions() const
+{
+	return *_ptVertsOrig;
+}
+
+void GaiaScene::updateToYear(long year)
+{
+	_currentYear = year;
+
+	_yearLabel[0]->setText(QString::number(_currentYear / 1000000.0, 'f', 8));
+	_yearLabel[1]->setText(QString::number(_currentYear / 1000000.0, 'f', 8));
+
+	// Move all stars to proper location based on _currentYear, always from
+	// their locations at time 0.
+	float t = _currentYear / 1000;
+	const KernelMotion motion = getStarMotion(t, _straightVel != 0);
 
-	if (t == 0)
+	// Only move all stars if they are visible; going back to time 0 resets them regardless.
+	if (t == 0 || _ptSwitch->getChildValue(_ptSwitch->getChild(0)))
 	{
-		for (int i = 0; i < _ptVerts->size(); i++)
+		const KernelMotionColumns columns = { _motionColumns[0].data(), _motionColumns[1].data(),
+			_motionColumns[2].data(), _motionColumns[3].data(), _motionColumns[4].data(), _motionColumns[5].data() };
+		parallelFor(0, _ptVerts->size(), [&](std::size_t first, std::size_t last)
 		{
-			_ptVerts->at(i).set(_ptVertsOrig->at(i));
-		}
+			propagateMotion(columns, first, last, motion, &_ptVerts->front());
+		});
 		_ptVerts->dirty();
+	}
 
-		// Reset known groups to time 0
-		for (auto& group : _knownGroups)
+	// Move other known star markers once each
+	for (auto& group : _knownGroups)
+	{
+		for (auto star : group)
 		{
-			for (auto star : group)
+			if (star->found)
 			{
-				if (star->found)
-				{
-					star->traj->setPosition(star->starVertOrig);
-					star->starVert.set(star->starVertOrig);
-				}
+				star->starVert = motion.apply(star->starVertOrig, star->vel);
+				star->traj->setPosition(star->starVert);
 			}
 		}
+	}
 
-		// Reset Isochrone markers to time 0
-		for (auto table : _isochroneTables)
+	// Move markers for isochrone stars that were in the selected table
+	for (auto table : _isochroneTables)
+	{
+		for (auto star : table->starsMatchingTable)
 		{
-			for (auto star : table->starsMatchingTable)
-			{
-				star->traj->setPosition(star->starVertOrig);
-				star->starVert.set(star->starVertOrig);
-			}
+			star->starVert = motion.apply(star->starVertOrig, star->vel);
+			star->traj->setPosition(star->starVert);
 		}
 	}
 }
 
-void GaiaScene::setKnownStars(std::unordered_map<long long, GaiaStar*>& knownStars)
+void GaiaScene::setKnownStars(GaiaKnownStars& knownStars)
 {
 	std::string path = "../../data/particles/KnownGaiaStars/DR2";
 
@@ -467,7 +510,7 @@ void GaiaScene::setKnownStars(std::unordered_map<long long, GaiaStar*>& knownSta
 			star->name = name;
 			star->sourceId = source_id;
 			star->colorIndex = fileCounter;
-			knownStars.insert(std::make_pair(source_id, star));
+			knownStars[source_id].push_back(star);
 			_knownGroups.back().push_back(star);
 		}
 		/*fileCounter++;*/
@@ -629,28 +672,83 @@ void GaiaScene::readIsochrones()
 
 void GaiaScene::matchStarsInIsochrones()
 {
-	for (PCVR_Selectable* sel : _allStars)
+	std::vector<osg::Vec2d> points;
+	for (auto table : _isochroneTables)
 	{
-		GaiaStar* star = static_cast<GaiaStar*>(sel);
+		points.clear();
+		for (auto& entry : table->entries)
+		{
+			points.push_back(osg::Vec2d(entry->abs_g_mag, entry->bp_rp));
+		}
+		table->index.build(points, _isochroneTolerance);
+		table->starsMatchingTable.clear();
+	}
 
-		for (auto table : _isochroneTables)
+	// Each block of stars collects its matches per table; appending the
+	// blocks in order keeps every table's stars in star order.
+	const std::size_t grain = 16384;
+	const std::size_t numBlocks = (_allStars.size() + grain - 1) / grain;
+	std::vector<std::vector<std::vector<GaiaStar*>>> blockMatches(numBlocks,
+		std::vector<std::vector<GaiaStar*>>(_isochroneTables.size()));
+	parallelFor(0, _allStars.size(), [&](std::size_t first, std::size_t last)
+	{
+		std::vector<std::vector<GaiaStar*>>& matches = blockMatches[first / grain];
+		for (std::size_t i = first; i < last; i++)
 		{
-			for (auto& entry : table->entries)
-			{  //  + star->a_g_val   + star->e_bp_min_rp_val
-				if (abs(star->abs_g_mag - entry->abs_g_mag + star->a_g_val) <= 0.25 &&
-					abs((star->phot_bp_mean_mag - star->phot_rp_mean_mag 
-						+ star->e_bp_min_rp_val) - entry->bp_rp) <= 0.25)
-				{
-					table->starsMatchingTable.push_back(star);
-					break;
-				}
+			GaiaStar* star = static_cast<GaiaStar*>(_allStars[i]);
+
+			// Extinction corrected magnitude and color
+			osg::Vec2d p(star->abs_g_mag + star->a_g_val,
+				star->phot_bp_mean_mag - star->phot_rp_mean_mag + star->e_bp_min_rp_val);
+			for (std::size_t t = 0; t < _isochroneTables.size(); t++)
+			{
+				if (_isochroneTables[t]->index.hasPointNear(p, _isochroneTolerance)) matches[t].push_back(star);
 			}
 		}
+	}, grain);
+
+	for (std::size_t t = 0; t < _isochroneTables.size(); t++)
+	{
+		std::vector<GaiaStar*>& stars = _isochroneTables[t]->starsMatchingTable;
+		for (auto& matches : blockMatches)
+		{
+			stars.insert(stars.end(), matches[t].begin(), matches[t].end());
+		}
 	}
 }
 
+void GaiaScene::setIsochroneTolerance(double tolerance)
+{
+	_isochroneTolerance = tolerance;
+	for (int i = 0; i < 2; i++)
+	{
+		_isochroneToleranceLabel[i]->setText(QString(QChar(0x00b1)) + QString::number(tolerance, 'f', 2));
+		_isochroneToleranceSlider[i]->blockSignals(true);
+		_isochroneToleranceSlider[i]->setValue(static_cast<int>(tolerance * 100 + 0.5));
+		_isochroneToleranceSlider[i]->blockSignals(false);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	matchStarsInIsochrones();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Matched stars to isochrones within " << tolerance << " mag in " << seconds << " s" << std::endl;
+
+	_FM->lock();
+	markersForIsochrones();
+	_FM->unlock();
+	updateToYear(_currentYear);
+}
+
 void GaiaScene::markersForIsochrones()
 {
+	// Markers are rebuilt after every match; tables that were shown stay shown.
+	std::vector<bool> shown;
+	for (unsigned int i = 0; i < _isochroneSwitch->getNumChildren(); i++)
+	{
+		shown.push_back(_isochroneSwitch->getValue(i));
+	}
+	_isochroneSwitch->removeChildren(0, _isochroneSwitch->getNumChildren());
+
 	int colorIndex = 0;
 	for (auto table : _isochroneTables)
 	{
@@ -675,11 +773,10 @@ void GaiaScene::markersForIsochrones()
 			star->traj->setPosition(star->pos);
 			tableGroup->addChild(star->traj->getGroup());
 		}
-		_isochroneSwitch->addChild(tableGroup);
+		_isochroneSwitch->addChild(tableGroup, static_cast<std::size_t>(colorIndex) < shown.size() && shown[colorIndex]);
 		colorIndex++;
 	}
-	_isochroneSwitch->setAllChildrenOff();
-	_rootFrame->getGroup()->addChild(_isochroneSwitch);
+	if (!_rootFrame->getGroup()->containsNode(_isochroneSwitch)) _rootFrame->getGroup()->addChild(_isochroneSwitch);
 }
 
 void GaiaScene::markersForKnownStars()
@@ -809,6 +906,18 @@ void GaiaScene::setupMenuEventListeners(PCVR_Controller* controller)
 	_groups[cIndex] = controllerWidget->findChild<QWidget*>("groupsArea")->layout();
 	_isochrones[cIndex] = controllerWidget->findChild<QWidget*>("isochroneArea")->layout();
 
+	// Match tolerance in hundredths of a magnitude. The slider does not track,
+	// so stars are matched again once it is released.
+	_isochroneToleranceSlider[cIndex] = controllerWidget->findChild<QSlider*>("isochroneToleranceSlider");
+	_isochroneToleranceLabel[cIndex] = controllerWidget->findChild<QLabel*>("isochroneToleranceLabel");
+	_isochroneToleranceSlider[cIndex]->setValue(static_cast<int>(_isochroneTolerance * 100 + 0.5));
+	_isochroneToleranceLabel[cIndex]->setText(QString(QChar(0x00b1)) + QString::number(_isochroneTolerance, 'f', 2));
+	QLabel* toleranceLabel = _isochroneToleranceLabel[cIndex];
+	QObject::connect(_isochroneToleranceSlider[cIndex], &QSlider::sliderMoved, toleranceLabel,
+		[=](int tolerance) { toleranceLabel->setText(QString(QChar(0x00b1)) + QString::number(tolerance / 100.0, 'f', 2)); });
+	QObject::connect(_isochroneToleranceSlider[cIndex], &QSlider::valueChanged, this,
+		[=](int tolerance) { setIsochroneTolerance(tolerance / 100.0); });
+
 	QPushButton* resetToPresentButton = controllerWidget->findChild<QPushButton*>("resetToPresentButton");
 	QObject::connect(resetToPresentButton, &QPushButton::clicked, this,
 		[=]() {
@@ -19,7 +19,10 @@
 #include <QFutureWatcher>
 #include <QLayout>
 
+#include "GaiaIsochroneIndex.hpp"
+#include "PCVR_Kernels.hpp"
 #include "PCVR_Scene.hpp"
+#include "GaiaCatalogCache.hpp"
 #include "GaiaStar.hpp"
 
 typedef struct
@@ -34,10 +37,12 @@ typedef struct
 	std::string name;
 	int millionYrs;	// parsed from name
 	std::vector<IsochroneEntry*> entries;
+	GaiaIsochroneIndex index;	// of the entries, for the current match tolerance
 	std::vector<GaiaStar*> starsMatchingTable;
 } IsochroneTable;
 
 // Stateless utility functions and variables
+KernelMotion getStarMotion(float t, bool straightLine);
 double deg2rad(double deg);
 std::vector<std::string> split(const std::string &text, char sep);
 
@@ -52,6 +57,10 @@ public:
 	void initWindowAndVR() override;
 	void buildScene() override;
 
+	// Positions of the stars passed to selections, in the same order; what
+	// GaiaStar::getPos returns for each, as one contiguous array.
+	const osg::Vec3Array& getStarPositions() const;
+
 	// Qt
 	QLayout* _spheres[2];
 
@@ -71,17 +80,22 @@ private:
 
 	bool _magColor = false;
 
+	double _isochroneTolerance = 0.25;	// magnitudes, on both G and BP-RP
+
 	// Qt
 	QLabel* _positionValueLabel[2];
 	QLabel* _yearLabel[2];
 	QSlider* _yearIncSlider[2];
 	QLayout* _groups[2];
 	QLayout* _isochrones[2];
+	QSlider* _isochroneToleranceSlider[2];
+	QLabel* _isochroneToleranceLabel[2];
 
 	osg::ref_ptr<osg::Switch> _ptSwitch = new osg::Switch();
 	osg::ref_ptr<osg::Vec3Array> _ptVerts = new osg::Vec3Array();
 	osg::ref_ptr<osg::Vec3Array> _ptVertsOrig = new osg::Vec3Array();
 	osg::ref_ptr<osg::Vec3Array> _ptVels = new osg::Vec3Array();
+	std::vector<float> _motionColumns[6];	// x, y, z of _ptVertsOrig and u, v, w of _ptVels, for the motion kernel
 
 	// Astrophysics variables
 	int _yearIncrement = 0;
@@ -98,11 +112,19 @@ private:
 	void step(OpenFrames::FramerateLimiter& waitLimiter);
 	void updateToYear(long year);
 
-	void setKnownStars(std::unordered_map<long long, GaiaStar*>& knownStars);
+	void setKnownStars(GaiaKnownStars& knownStars);
+	// Parse one data file into 'buffer', keeping the stars that pass the
+	// command line filters or are known. Safe to run on several files at once.
+	void readStarFile(const std::string& fileName, const GaiaKnownStars& knownStars,
+		GaiaStarBuffer& buffer);
+	// Stars of every data directory, from its catalog cache or its CSV files.
+	void readCatalog(const GaiaKnownStars& knownStars, std::vector<GaiaStarBuffer>& buffers);
 	void readSpheres();
 	void readIsochrones();
 
 	void matchStarsInIsochrones();
+	// Match the stars against the isochrones again with a new tolerance.
+	void setIsochroneTolerance(double tolerance);
 	void markersForIsochrones();
 	void markersForKnownStars();
 	osg::Vec4 getHeatMapColor(double value);
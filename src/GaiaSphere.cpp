@@ -37,16 +37,16 @@ void GaiaSphere::save(const std::string& path, const std::vector<PCVR_Selectable
 		 << "#Radius: " << getRadius() << std::endl
 	     << "id, x, y, z, u, v, w, ra, dec, parallax, teff, l, b" << std::endl;
 
-	osg::Vec3 selPos = osg::Vec3(x, y, z);
-	for (PCVR_Selectable* p : points)
+	// The scene's star positions spare gathering them through every star.
+	GaiaScene* gaiaScene = dynamic_cast<GaiaScene*>(PCVR_Scene::Instance);
+	const osg::Vec3Array& positions = gaiaScene->getStarPositions();
+	std::vector<PCVR_Selectable*> inside = positions.size() == points.size() && !points.empty() ?
+		getPointsInside(points, &positions.front()) : getPointsInside(points);
+	for (PCVR_Selectable* p : inside)
 	{
-		if ((p->getPos() - selPos).length() <= getRadius())
-		{
-			p->writeToStream(file);
-		}
+		p->writeToStream(file);
 	}
 	// Put saved sphere into GUI list
-	GaiaScene* gaiaScene = dynamic_cast<GaiaScene*>(PCVR_Scene::Instance);
 	for (int i = 0; i < 2; i++)
 	{
 		QCheckBox* check = new QCheckBox(QString::fromStdString("SelectionSphere" + std::to_string(fileNum)));
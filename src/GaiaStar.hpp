@@ -1,5 +1,8 @@
 #pragma once
 
+#include <unordered_map>
+#include <vector>
+
 #include <OpenFrames/DrawableTrajectory.hpp>
 
 #include "PCVR_Selection.hpp"
@@ -37,4 +40,8 @@ public:
 	void setPos(osg::Vec3 pos) override;
 	void setColor(osg::Vec4 color) override;
 	std::ostream& writeToStream(std::ostream& o) const override;
-};
\ No newline at end of file
+};
+
+// Known stars by Gaia source ID. A star listed in several known groups has
+// an entry for each, so one lookup reaches all of them.
+typedef std::unordered_map<long long, std::vector<GaiaStar*>> GaiaKnownStars;
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <osgDB/FileUtils>
+
+#include "LasFileReader.hpp"
+#include "LasLazReader.hpp"
+#include "PCVR_Parallel.hpp"
+
+#include "LasChangeDetector.hpp"
+
+namespace
+{
+	const unsigned int MAX_CYLINDER_POINTS = 64;
+}
+
+LasChangeDetector::LasChangeDetector(float cylinderRadius)
+	: _cylinderRadius(cylinderRadius)
+{
+}
+
+bool LasChangeDetector::loadReference(const std::string& path, const osg::Vec3d& origin)
+{
+	std::string fileName = osgDB::findDataFile(path);
+	if (fileName.empty())
+	{
+		std::cout << "Cannot find reference epoch " << path << std::endl;
+		return false;
+	}
+
+	std::cout << "Reading reference epoch " << fileName << "..." << std::endl;
+
+	_points.clear();
+	LasFileReader reader(fileName);
+	if (reader.isOpen() && !reader.getHeader().compressed)
+	{
+		if (!reader.readPositions(_points, origin)) return false;
+	}
+	else if (reader.isOpen() && LasLazReader::isSupported())
+	{
+		LasLazReader lazReader(fileName);
+		if (!lazReader.isOpen()) return false;
+		LasPointTable table;
+		table.resize(lazReader.getNumPoints());
+		if (!lazReader.readPoints(table, origin)) return false;
+		_points.assign(table.positions->begin(), table.positions->end());
+	}
+	else
+	{
+		std::cout << "Cannot read reference epoch " << fileName << std::endl;
+		return false;
+	}
+
+	_reference.build(_points.data(), _points.size());
+	std::cout << "Read " << _reference.size() << " reference points" << std::endl;
+	return true;
+}
+
+std::size_t LasChangeDetector::getNumReferencePoints() const
+{
+	return _reference.size();
+}
+
+bool LasChangeDetector::usesNormals() const
+{
+	return _cylinderRadius > 0.0f;
+}
+
+void LasChangeDetector::measure(const LasPointTable& table, const std::vector<osg::Vec3>& normals,
+	std::vector<float>& change) const
+{
+	const std::size_t n = table.size();
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	change.assign(n, nan);
+	if (n == 0 || _reference.size() == 0) return;
+
+	const osg::Vec3* points = &table.positions->front();
+	if (!usesNormals())
+	{
+		parallelFor(0, n, [&](std::size_t first, std::size_t last)
+		{
+			for (std::size_t i = first; i < last; i++)
+			{
+				uint32_t nearest;
+				float dist2;
+				if (_reference.findNearest(points[i], nearest, dist2)) change[i] = std::sqrt(dist2);
+			}
+		}, 4096);
+		return;
+	}
+
+	// The cylinder is centered where the normal meets the reference surface,
+	// estimated from the nearest reference point, and gathers the reference
+	// points near that spot whose distance from the normal line is within the
+	// radius. Searching a sphere of twice the radius around it keeps the
+	// query local while allowing for the surface being tilted in the cylinder.
+	const osg::Vec3* reference = _points.data();
+	const float radius2 = _cylinderRadius * _cylinderRadius;
+	const float searchRadius2 = 4.0f * radius2;
+	parallelFor(0, n, [&](std::size_t first, std::size_t last)
+	{
+		uint32_t neighbors[MAX_CYLINDER_POINTS];
+		float dist2[MAX_CYLINDER_POINTS];
+		for (std::size_t i = first; i < last; i++)
+		{
+			const osg::Vec3& p = points[i];
+			const osg::Vec3& normal = normals[i];
+
+			uint32_t nearest;
+			float nearestDist2;
+			if (!_reference.findNearest(p, nearest, nearestDist2)) continue;
+			const osg::Vec3 center = p + normal * ((reference[nearest] - p) * normal);
+			unsigned int found = _reference.findNearest(center, MAX_CYLINDER_POINTS, neighbors, dist2, searchRadius2);
+
+			double sum = 0.0;
+			unsigned int count = 0;
+			for (unsigned int j = 0; j < found; j++)
+			{
+				const osg::Vec3 d = reference[neighbors[j]] - p;
+				const float along = d * normal;
+				if ((d - normal * along).length2() > radius2) continue;
+				sum += along;
+				count++;
+			}
+			// Positive where the reference lies below, i.e. the surface rose.
+			if (count > 0) change[i] = static_cast<float>(-sum / count);
+		}
+	}, 1024);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <osg/Vec3>
+#include <osg/Vec3d>
+
+#include "LasPointTable.hpp"
+#include "PCVR_KdTree.hpp"
+
+//-----------------------------------------------------------------------------
+// LasChangeDetector
+//    Compares a LAS epoch against an earlier survey of the same area. Only the
+// positions of the earlier (reference) epoch are decoded and indexed by a
+// PCVR_KdTree, about 28 bytes per point (2.8 GB for a 100M-point reference).
+//
+//    Plain cloud-to-cloud (C2C) change is the distance from each point to the
+// nearest reference point. With a cylinder radius, change is measured
+// M3C2-style instead: along the point's normal, as the mean offset of the
+// reference points inside a cylinder of that radius around the normal, which
+// averages out roughness and gives the change a sign (positive where the
+// surface rose). Every point is measured independently, in parallel.
+//-----------------------------------------------------------------------------
+class LasChangeDetector
+{
+public:
+	// cylinderRadius 0 measures C2C distances.
+	LasChangeDetector(float cylinderRadius = 0.0f);
+
+	// Read the earlier epoch, recentered on the origin of the compared models.
+	bool loadReference(const std::string& path, const osg::Vec3d& origin);
+	std::size_t getNumReferencePoints() const;
+
+	// True if measure() needs the normals of the compared points.
+	bool usesNormals() const;
+
+	// Change of every point of the table. 'normals' (one per point) are only
+	// read in M3C2 mode; points with no reference points in their cylinder get NaN.
+	void measure(const LasPointTable& table, const std::vector<osg::Vec3>& normals,
+		std::vector<float>& change) const;
+
+private:
+	std::vector<osg::Vec3> _points;		// reference positions, indexed by the tree
+	PCVR_KdTree _reference;
+	float _cylinderRadius;
+};
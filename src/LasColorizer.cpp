@@ -0,0 +1,550 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include <osg/BufferObject>
+#include <osg/GLExtensions>
+#include <osg/State>
+
+#include "PCVR_Color.hpp"
+#include "PCVR_Parallel.hpp"
+
+#include "LasColorizer.hpp"
+
+namespace
+{
+	// Points per dirty-tracking block.
+	const std::size_t DIRTY_BLOCK = 4096;
+
+	// Gray for points whose features are not computed yet.
+	const osg::Vec4ub NO_FEATURE_COLOR(77, 77, 77, 255);
+
+	// Gray for points without a measured change.
+	const osg::Vec4ub NO_CHANGE_COLOR(77, 77, 77, 255);
+
+	// Send these ranges of one array to its buffer object in this context.
+	template <typename ArrayType>
+	void uploadRanges(osg::State& state, const ArrayType* array, const std::vector<std::pair<std::size_t, std::size_t>>& ranges)
+	{
+		if (!array || ranges.empty()) return;
+
+		// Without a clean buffer object the whole array gets uploaded anyway.
+		osg::BufferObject* bufferObject = array->getBufferObject();
+		osg::GLBufferObject* glBufferObject = bufferObject ? bufferObject->getGLBufferObject(state.getContextID()) : nullptr;
+		if (!glBufferObject || glBufferObject->isDirty()) return;
+
+		const osg::GLExtensions* extensions = state.get<osg::GLExtensions>();
+		const GLintptr base = glBufferObject->getOffset(array->getBufferIndex());
+		const std::size_t elementSize = sizeof(array->front());
+		state.bindVertexBufferObject(glBufferObject);
+		for (const auto& r : ranges)
+		{
+			extensions->glBufferSubData(GL_ARRAY_BUFFER_ARB, base + r.first * elementSize,
+				(r.second - r.first) * elementSize, &(*array)[r.first]);
+		}
+		state.unbindVertexBufferObject();
+	}
+
+	// Write colorOf(i) to each point whose color differs, with zero alpha for
+	// hidden points; true if any did.
+	template <typename ColorOf>
+	bool recolorBlock(osg::Vec4ub* colors, std::size_t first, std::size_t last, const std::vector<bool>* hidden,
+		ColorOf colorOf)
+	{
+		bool changed = false;
+		for (std::size_t i = first; i < last; i++)
+		{
+			osg::Vec4ub c = colorOf(i);
+			if (hidden && (*hidden)[i]) c.a() = 0;
+			if (colors[i] != c)
+			{
+				colors[i] = c;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	// Colors of the feature modes. Points without computed features are gray.
+	class FeatureColors
+	{
+	public:
+		FeatureColors(LasColorMode mode, const LasPointFeatures* features, std::size_t n)
+			: _mode(mode), _features(features && features->computed.size() == n ? features : nullptr)
+			, _ramp(LasPalette::Ramp())
+		{
+			if (_features) _densityScale = 1.0f / _features->getTypicalDensity();
+		}
+
+		osg::Vec4ub operator()(std::size_t i) const
+		{
+			if (!_features || !_features->computed[i]) return NO_FEATURE_COLOR;
+			switch (_mode)
+			{
+			case LAS_COLOR_NORMAL:
+			{
+				// Absolute components as RGB: ground and canopy tops blue, trunks red or green.
+				const osg::Vec3& v = _features->normal[i];
+				return quantizeColor(osg::Vec4(std::abs(v.x()), std::abs(v.y()), std::abs(v.z()), 1.0f));
+			}
+			case LAS_COLOR_CURVATURE: return ramp(3.0f * _features->curvature[i]);
+			case LAS_COLOR_PLANARITY: return ramp(_features->planarity[i]);
+			case LAS_COLOR_LINEARITY: return ramp(_features->linearity[i]);
+			case LAS_COLOR_DENSITY:
+				// Log scale, a decade either side of the typical density.
+				return ramp(0.5f + 0.5f * std::log10(std::max(_features->density[i] * _densityScale, 1e-6f)));
+			default: return NO_FEATURE_COLOR;
+			}
+		}
+
+	private:
+		LasColorMode _mode;
+		const LasPointFeatures* _features;
+		LasPalette _ramp;
+		float _densityScale = 1.0f;
+
+		const osg::Vec4ub& ramp(float v) const
+		{
+			return _ramp.colors[static_cast<int>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f)];
+		}
+	};
+}
+
+bool parseLasColorMode(const std::string& name, LasColorMode& mode)
+{
+	if (name == "source") mode = LAS_COLOR_SOURCE;
+	else if (name == "class") mode = LAS_COLOR_CLASSIFICATION;
+	else if (name == "return") mode = LAS_COLOR_RETURN_NUMBER;
+	else if (name == "intensity") mode = LAS_COLOR_INTENSITY;
+	else if (name == "change") mode = LAS_COLOR_CHANGE;
+	else if (name == "normal") mode = LAS_COLOR_NORMAL;
+	else if (name == "curvature") mode = LAS_COLOR_CURVATURE;
+	else if (name == "planarity") mode = LAS_COLOR_PLANARITY;
+	else if (name == "linearity") mode = LAS_COLOR_LINEARITY;
+	else if (name == "density") mode = LAS_COLOR_DENSITY;
+	else return false;
+	return true;
+}
+
+bool isFeatureColorMode(LasColorMode mode)
+{
+	return mode >= LAS_COLOR_NORMAL;
+}
+
+LasPalette::LasPalette(const osg::Vec4 colors[256])
+{
+	std::transform(colors, colors + 256, this->colors, quantizeColor);
+}
+
+LasPalette LasPalette::Classification()
+{
+	// Classes 1-4 keep the colors of the forest survey plots. The rest follow
+	// the usual ASPRS colors, and anything else gets a neutral dark gray so a
+	// class never keeps the color of a previous mode.
+	osg::Vec4 c[256];
+	std::fill(c, c + 256, osg::Vec4(0.25, 0.25, 0.25, 1));
+	c[0] = osg::Vec4(0.4, 0.4, 0.4, 1);		// Never classified
+	c[1] = osg::Vec4(0, 0, 0, 1);			// Unclassified
+	c[2] = osg::Vec4(0.5, 0.5, 0.5, 1);		// Ground
+	c[3] = osg::Vec4(1, 1, 1, 1);			// Unchanged
+	c[4] = osg::Vec4(1, 0, 0, 1);			// Destroyed by Hurricane Maria
+	c[5] = osg::Vec4(0.2, 0.6, 0.2, 1);		// High vegetation
+	c[6] = osg::Vec4(1, 0.6, 0.2, 1);		// Building
+	c[7] = osg::Vec4(1, 0, 1, 1);			// Low point (noise)
+	c[9] = osg::Vec4(0.2, 0.4, 1, 1);		// Water
+	c[10] = osg::Vec4(0.6, 0.4, 0.2, 1);	// Rail
+	c[11] = osg::Vec4(0.8, 0.8, 0.2, 1);	// Road surface
+	c[13] = osg::Vec4(0.9, 0.9, 0.5, 1);	// Wire guard
+	c[14] = osg::Vec4(0.9, 0.7, 0.1, 1);	// Wire conductor
+	c[15] = osg::Vec4(0.6, 0.2, 0.6, 1);	// Transmission tower
+	c[17] = osg::Vec4(0.4, 0.8, 0.8, 1);	// Bridge deck
+	c[18] = osg::Vec4(1, 0.4, 0.7, 1);		// High noise
+	return LasPalette(c);
+}
+
+LasPalette LasPalette::ReturnNumber()
+{
+	osg::Vec4 c[256];
+	std::fill(c, c + 256, osg::Vec4(0.5, 0.5, 0.5, 1));
+	c[1] = osg::Vec4(1, 0.2, 0.2, 1);
+	c[2] = osg::Vec4(1, 0.8, 0.2, 1);
+	c[3] = osg::Vec4(0.2, 0.9, 0.2, 1);
+	c[4] = osg::Vec4(0.2, 0.6, 1, 1);
+	c[5] = osg::Vec4(0.7, 0.3, 1, 1);
+	return LasPalette(c);
+}
+
+LasPalette LasPalette::Intensity()
+{
+	osg::Vec4 c[256];
+	for (int i = 0; i < 256; i++)
+	{
+		float v = i / 255.0f;
+		c[i] = osg::Vec4(v, v, v, 1);
+	}
+	return LasPalette(c);
+}
+
+LasPalette LasPalette::Ramp()
+{
+	// Piecewise linear through a few stops of a perceptually even map.
+	const osg::Vec4 stops[] = {
+		osg::Vec4(0.27, 0.00, 0.33, 1), osg::Vec4(0.23, 0.32, 0.55, 1), osg::Vec4(0.13, 0.57, 0.55, 1),
+		osg::Vec4(0.37, 0.79, 0.38, 1), osg::Vec4(0.99, 0.91, 0.15, 1)
+	};
+	const int numSegments = sizeof(stops) / sizeof(stops[0]) - 1;
+	osg::Vec4 c[256];
+	for (int i = 0; i < 256; i++)
+	{
+		float t = i / 255.0f * numSegments;
+		int s = std::min(static_cast<int>(t), numSegments - 1);
+		c[i] = stops[s] * (s + 1 - t) + stops[s + 1] * (t - s);
+	}
+	return LasPalette(c);
+}
+
+LasPalette LasPalette::Diverging()
+{
+	const osg::Vec4 blue(0.13, 0.30, 0.75, 1), white(0.97, 0.97, 0.97, 1), red(0.75, 0.10, 0.10, 1);
+	osg::Vec4 c[256];
+	for (int i = 0; i < 256; i++)
+	{
+		float t = i / 255.0f;
+		c[i] = t < 0.5f ? blue * (1.0f - 2.0f * t) + white * (2.0f * t)
+			: white * (2.0f - 2.0f * t) + red * (2.0f * t - 1.0f);
+	}
+	return LasPalette(c);
+}
+
+LasColorizer::LasColorizer(LasPointTable& table)
+	: _table(table)
+	, _drawn(false)
+{
+}
+
+LasColorMode LasColorizer::getMode() const
+{
+	return _mode;
+}
+
+const std::vector<osg::Vec4ub>* LasColorizer::getSourceColors() const
+{
+	return _mode != LAS_COLOR_SOURCE && _sourceColors.size() == _table.size() ? &_sourceColors : nullptr;
+}
+
+void LasColorizer::setFeatures(const LasPointFeatures* features)
+{
+	_features = features;
+}
+
+void LasColorizer::setChange(const std::vector<float>* change, float scale)
+{
+	_change = change;
+	_changeScale = scale > 0.0f ? scale : 1.0f;
+}
+
+void LasColorizer::setHidden(const std::vector<bool>* hidden)
+{
+	_hidden = hidden;
+}
+
+void LasColorizer::hidePoints(const std::vector<unsigned int>& indices)
+{
+	const std::size_t n = _table.size();
+	if (n == 0) return;
+
+	osg::Vec4ub* colors = &_table.colors->front();
+	std::vector<char> changed((n + DIRTY_BLOCK - 1) / DIRTY_BLOCK, 0);
+	for (unsigned int i : indices)
+	{
+		if (i >= n || colors[i].a() == 0) continue;
+		colors[i].a() = 0;
+		changed[i / DIRTY_BLOCK] = 1;
+	}
+	addChangedBlocks(changed);
+}
+
+void LasColorizer::recolor(LasColorMode mode)
+{
+	const std::size_t n = _table.size();
+	if (n == 0 || (mode == LAS_COLOR_SOURCE && _sourceColors.empty()))
+	{
+		_mode = mode;
+		return;
+	}
+
+	osg::Vec4ub* colors = &_table.colors->front();
+	const bool keepSource = _compacting && _compactSource;	// compact() is copying them
+	if (_mode == LAS_COLOR_SOURCE && mode != LAS_COLOR_SOURCE && !keepSource)
+	{
+		_sourceColors.assign(colors, colors + n);
+	}
+
+	LasPalette palette;
+	if (mode == LAS_COLOR_CLASSIFICATION) palette = LasPalette::Classification();
+	else if (mode == LAS_COLOR_RETURN_NUMBER) palette = LasPalette::ReturnNumber();
+	else if (mode == LAS_COLOR_INTENSITY) palette = LasPalette::Intensity();
+	else if (mode == LAS_COLOR_CHANGE) palette = LasPalette::Diverging();
+
+	// Intensity is spread over the palette by the largest value in the column.
+	const uint16_t* intensity = _table.intensity.data();
+	uint32_t intensityScale = 0;
+	if (mode == LAS_COLOR_INTENSITY)
+	{
+		std::atomic<uint16_t> maxIntensity(1);
+		parallelFor(0, n, [&](std::size_t first, std::size_t last)
+		{
+			uint16_t m = *std::max_element(intensity + first, intensity + last);
+			uint16_t current = maxIntensity;
+			while (m > current && !maxIntensity.compare_exchange_weak(current, m)) {}
+		});
+		intensityScale = (255u << 16) / maxIntensity;
+	}
+
+	const osg::Vec4ub* lut = palette.colors;
+	const FeatureColors featureColors(mode, _features, n);
+	const uint8_t* classification = _table.classification.data();
+	const uint8_t* returnNumber = _table.returnNumber.data();
+	const float* change = _change && _change->size() == n ? _change->data() : nullptr;
+	const float changeToIndex = 127.5f / _changeScale;
+	const std::vector<bool>* hidden = _hidden && _hidden->size() == n ? _hidden : nullptr;
+	std::vector<char> changed((n + DIRTY_BLOCK - 1) / DIRTY_BLOCK, 0);
+	parallelFor(0, changed.size(), [&](std::size_t firstBlock, std::size_t lastBlock)
+	{
+		for (std::size_t b = firstBlock; b < lastBlock; b++)
+		{
+			const std::size_t first = b * DIRTY_BLOCK;
+			const std::size_t last = std::min(first + DIRTY_BLOCK, n);
+			bool c = false;
+			switch (mode)
+			{
+			case LAS_COLOR_SOURCE:
+				c = recolorBlock(colors, first, last, hidden, [&](std::size_t i) { return _sourceColors[i]; });
+				break;
+
+			case LAS_COLOR_CLASSIFICATION:
+				c = recolorBlock(colors, first, last, hidden, [&](std::size_t i) { return lut[classification[i]]; });
+				break;
+
+			case LAS_COLOR_RETURN_NUMBER:
+				c = recolorBlock(colors, first, last, hidden, [&](std::size_t i) { return lut[returnNumber[i]]; });
+				break;
+
+			case LAS_COLOR_INTENSITY:
+				c = recolorBlock(colors, first, last, hidden, [&](std::size_t i) { return lut[(intensity[i] * intensityScale) >> 16]; });
+				break;
+
+			case LAS_COLOR_CHANGE:
+				c = recolorBlock(colors, first, last, hidden, [&](std::size_t i) -> osg::Vec4ub
+				{
+					if (!change || std::isnan(change[i])) return NO_CHANGE_COLOR;
+					float v = std::min(std::max(127.5f + change[i] * changeToIndex, 0.0f), 255.0f);
+					return lut[static_cast<int>(v)];
+				});
+				break;
+
+			default:
+				c = recolorBlock(colors, first, last, hidden, featureColors);
+				break;
+			}
+			changed[b] = c;
+		}
+	});
+
+	// The source colors are back in place; no need to keep a second copy.
+	if (mode == LAS_COLOR_SOURCE && !keepSource) std::vector<osg::Vec4ub>().swap(_sourceColors);
+	_mode = mode;
+
+	addChangedBlocks(changed);
+}
+
+void LasColorizer::recolorPoints(const std::vector<unsigned int>& indices)
+{
+	const std::size_t n = _table.size();
+	if (!isFeatureColorMode(_mode) || n == 0) return;
+
+	osg::Vec4ub* colors = &_table.colors->front();
+	const FeatureColors featureColors(_mode, _features, n);
+	const std::vector<bool>* hidden = _hidden && _hidden->size() == n ? _hidden : nullptr;
+	std::vector<char> changed((n + DIRTY_BLOCK - 1) / DIRTY_BLOCK, 0);
+	for (unsigned int i : indices)
+	{
+		osg::Vec4ub c = featureColors(i);
+		if (hidden && (*hidden)[i]) c.a() = 0;
+		if (colors[i] == c) continue;
+		colors[i] = c;
+		changed[i / DIRTY_BLOCK] = 1;
+	}
+	addChangedBlocks(changed);
+}
+
+void LasColorizer::addChangedBlocks(const std::vector<char>& changed)
+{
+	// Coalesce runs of changed blocks into ranges.
+	const std::size_t n = _table.size();
+	std::vector<Range> ranges;
+	for (std::size_t b = 0; b < changed.size(); b++)
+	{
+		if (!changed[b]) continue;
+		std::size_t first = b * DIRTY_BLOCK;
+		std::size_t last = std::min(first + DIRTY_BLOCK, n);
+		if (!ranges.empty() && ranges.back().second == first)
+		{
+			ranges.back().second = last;
+		}
+		else
+		{
+			ranges.push_back(Range(first, last));
+		}
+	}
+	addPending(ranges);
+}
+
+void LasColorizer::markDirty(std::size_t first, std::size_t last)
+{
+	if (first < last) addPending(std::vector<Range>(1, Range(first, last)));
+}
+
+void LasColorizer::markRowsDirty(std::size_t first, std::size_t last)
+{
+	if (first >= last) return;
+	addPending(std::vector<Range>(1, Range(first, last)), true);
+	addPending(std::vector<Range>(1, Range(first, last)));
+}
+
+bool LasColorizer::hasDrawn() const
+{
+	return _drawn;
+}
+
+void LasColorizer::beginCompaction()
+{
+	_compacting = true;
+	_compactSource = !_sourceColors.empty();
+}
+
+void LasColorizer::compact(const std::vector<uint32_t>& remap, std::size_t size)
+{
+	// A snapshot; rows recolored while it is taken are in the log.
+	_compactColors = new osg::Vec4ubArray(size);
+	if (_compactSource) _compactSourceColors.resize(size);
+	if (size == 0) return;
+
+	const osg::Vec4ub* colors = &_table.colors->front();
+	osg::Vec4ub* compacted = &_compactColors->front();
+	parallelFor(0, remap.size(), [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			const uint32_t j = remap[i];
+			if (j >= size) continue;
+			compacted[j] = colors[i];
+			if (_compactSource) _compactSourceColors[j] = _sourceColors[i];
+		}
+	});
+}
+
+void LasColorizer::applyCompaction(const std::vector<uint32_t>& remap)
+{
+	// The pending ranges refer to the old rows, and the new array is uploaded whole.
+	std::vector<Range> log;
+	{
+		std::lock_guard<std::mutex> lock(_pendingMutex);
+		log.swap(_compactLog);
+		for (std::vector<Range>& pending : _pending)
+		{
+			pending.clear();
+		}
+		for (std::vector<Range>& pending : _pendingPositions)
+		{
+			pending.clear();
+		}
+	}
+
+	// Bring the copy up to date with the rows recolored meanwhile, each once.
+	const osg::Vec4ub* colors = &_table.colors->front();
+	osg::Vec4ubArray& compacted = *_compactColors;
+	std::sort(log.begin(), log.end());
+	std::size_t replayed = 0;
+	for (const Range& range : log)
+	{
+		for (std::size_t i = std::max(range.first, replayed); i < range.second; i++)
+		{
+			if (remap[i] < compacted.size()) compacted[remap[i]] = colors[i];
+		}
+		replayed = std::max(replayed, range.second);
+	}
+	_table.colors = _compactColors;
+
+	if (_compactSource)
+	{
+		_sourceColors.swap(_compactSourceColors);
+	}
+	else if (!_sourceColors.empty())
+	{
+		// Saved after the compaction began, which is rare enough to compact them here.
+		std::vector<osg::Vec4ub> sourceColors(compacted.size());
+		for (std::size_t i = 0; i < remap.size(); i++)
+		{
+			if (remap[i] < sourceColors.size()) sourceColors[remap[i]] = _sourceColors[i];
+		}
+		_sourceColors.swap(sourceColors);
+	}
+	endCompaction();
+}
+
+void LasColorizer::cancelCompaction()
+{
+	{
+		std::lock_guard<std::mutex> lock(_pendingMutex);
+		_compactLog.clear();
+	}
+	endCompaction();
+}
+
+void LasColorizer::endCompaction()
+{
+	_compacting = false;
+	_compactColors = nullptr;
+	std::vector<osg::Vec4ub>().swap(_compactSourceColors);
+
+	// Back in source mode while the source colors were being copied.
+	if (_mode == LAS_COLOR_SOURCE) std::vector<osg::Vec4ub>().swap(_sourceColors);
+}
+
+void LasColorizer::addPending(const std::vector<Range>& ranges, bool positions)
+{
+	if (ranges.empty()) return;
+
+	std::lock_guard<std::mutex> lock(_pendingMutex);
+	if (_compacting && !positions) _compactLog.insert(_compactLog.end(), ranges.begin(), ranges.end());
+	for (std::vector<Range>& pending : positions ? _pendingPositions : _pending)
+	{
+		pending.insert(pending.end(), ranges.begin(), ranges.end());
+	}
+}
+
+void LasColorizer::drawImplementation(osg::RenderInfo& renderInfo, const osg::Drawable* drawable) const
+{
+	uploadPending(*renderInfo.getState());
+	drawable->drawImplementation(renderInfo);
+	_drawn = true;
+}
+
+void LasColorizer::uploadPending(osg::State& state) const
+{
+	const unsigned int contextID = state.getContextID();
+	std::vector<Range> ranges, positionRanges;
+	{
+		std::lock_guard<std::mutex> lock(_pendingMutex);
+		if (_pending.size() <= contextID)
+		{
+			_pending.resize(contextID + 1);
+			_pendingPositions.resize(contextID + 1);
+		}
+		ranges.swap(_pending[contextID]);
+		positionRanges.swap(_pendingPositions[contextID]);
+	}
+	uploadRanges(state, _table.positions.get(), positionRanges);
+	uploadRanges(state, _table.colors.get(), ranges);
+}
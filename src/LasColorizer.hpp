@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osg/Drawable>
+
+#include "LasPointFeatures.hpp"
+#include "LasPointTable.hpp"
+
+// Which point attribute drives the colors of a LasModel.
+enum LasColorMode
+{
+	LAS_COLOR_SOURCE,			// colors read from the file
+	LAS_COLOR_CLASSIFICATION,
+	LAS_COLOR_RETURN_NUMBER,
+	LAS_COLOR_INTENSITY,
+	LAS_COLOR_CHANGE,			// distance to an earlier epoch, from LasChangeDetector
+	LAS_COLOR_NORMAL,			// local geometry from LasPointFeatures
+	LAS_COLOR_CURVATURE,
+	LAS_COLOR_PLANARITY,
+	LAS_COLOR_LINEARITY,
+	LAS_COLOR_DENSITY
+};
+
+// Parse "source", "class", "return", "intensity", "change", "normal",
+// "curvature", "planarity", "linearity" or "density"; false if unknown.
+bool parseLasColorMode(const std::string& name, LasColorMode& mode);
+
+// True for the modes that color by LasPointFeatures.
+bool isFeatureColorMode(LasColorMode mode);
+
+// 256-entry color lookup table, indexed by an 8-bit attribute value. The
+// entries are in the 8-bit form of the point colors, so recoloring is a copy.
+struct LasPalette
+{
+	osg::Vec4ub colors[256];
+
+	LasPalette() {}
+	explicit LasPalette(const osg::Vec4 colors[256]);
+
+	static LasPalette Classification();
+	static LasPalette ReturnNumber();
+	static LasPalette Intensity();
+	static LasPalette Ramp();		// dark blue through green to yellow, for continuous values
+	static LasPalette Diverging();	// blue through white to red, for signed values
+};
+
+//-----------------------------------------------------------------------------
+// LasColorizer
+//    Recolors the points of a LasPointTable by mapping one attribute column
+// through a LasPalette, in one parallel pass over the contiguous columns.
+// Only the points whose color actually changes are written, and the changed
+// ranges are collected so that just those bytes of the color buffer are sent
+// to the GPU.
+//
+//    It is installed as the draw callback of the point geometry: before each
+// draw it uploads the pending ranges with glBufferSubData, instead of
+// dirtying the color array, which would re-upload all of it. A context that
+// has not built its color buffer yet simply uploads the whole current array.
+// Rows of the positions written after that first upload (by a streaming
+// decoder) go up the same way.
+//
+//    Points flagged in the hidden column (deleted points) get zero alpha in
+// every mode, which the point geometry's alpha test drops. Hiding a point is
+// then a 4-byte upload like any recolor, not a new index buffer.
+//
+//    The feature modes read the columns of a LasPointFeatures; points whose
+// features are not computed yet are drawn gray. Hold the features' mutex
+// while recoloring by a feature.
+//
+//    The change mode maps the distance of each point to an earlier epoch
+// through a diverging palette: white for no change, saturating to red (or,
+// for signed distances, blue) at the given scale. Unmeasured points are gray.
+//-----------------------------------------------------------------------------
+class LasColorizer : public osg::Drawable::DrawCallback
+{
+public:
+	LasColorizer(LasPointTable& table);
+
+	LasColorMode getMode() const;
+
+	// The colors the points were loaded with, one per point, while another
+	// mode is shown; null when the table's own colors are those.
+	const std::vector<osg::Vec4ub>* getSourceColors() const;
+
+	void setFeatures(const LasPointFeatures* features);
+
+	// Per-point change column (one value per point, NaN if unmeasured) and the
+	// distance that gets full color.
+	void setChange(const std::vector<float>* change, float scale);
+
+	// One flag per point (or empty for none); flagged points are not drawn.
+	void setHidden(const std::vector<bool>* hidden);
+
+	// These points were just flagged hidden; stop drawing them.
+	void hidePoints(const std::vector<unsigned int>& indices);
+
+	// Recolor every point for the given mode. Must not run concurrently with
+	// other writers of the color column.
+	void recolor(LasColorMode mode);
+
+	// Recolor just these points by the current feature mode, after their
+	// features were computed. Does nothing in the other modes.
+	void recolorPoints(const std::vector<unsigned int>& indices);
+
+	// Points [first, last) were recolored by someone else; upload them with
+	// the next draw.
+	void markDirty(std::size_t first, std::size_t last);
+
+	// Rows [first, last) of the positions and colors were written (e.g. by a
+	// streaming decoder); upload both with the next draw.
+	void markRowsDirty(std::size_t first, std::size_t last);
+
+	// Whether the points were drawn, and so have their buffers, in some context.
+	bool hasDrawn() const;
+
+	// Compaction of the table beside drawing and recoloring. From
+	// beginCompaction on, the rows recolored are logged. compact() copies the
+	// colors, and saved source colors, of the kept rows on the compacting
+	// thread; 'remap' takes each row to its compacted row, or past 'size' if
+	// it is removed. applyCompaction replays just the logged rows into the
+	// copy and makes it the table's color array, to be uploaded whole.
+	// cancelCompaction drops the copy instead.
+	void beginCompaction();
+	void compact(const std::vector<uint32_t>& remap, std::size_t size);
+	void applyCompaction(const std::vector<uint32_t>& remap);
+	void cancelCompaction();
+
+	virtual void drawImplementation(osg::RenderInfo& renderInfo, const osg::Drawable* drawable) const;
+
+private:
+	typedef std::pair<std::size_t, std::size_t> Range;
+
+	LasPointTable& _table;
+	const LasPointFeatures* _features = nullptr;
+	const std::vector<float>* _change = nullptr;
+	const std::vector<bool>* _hidden = nullptr;
+	float _changeScale = 1.0f;
+	LasColorMode _mode = LAS_COLOR_SOURCE;
+	std::vector<osg::Vec4ub> _sourceColors;	// saved on the first switch away from LAS_COLOR_SOURCE
+
+	// Ranges not yet uploaded, per graphics context that has drawn so far.
+	mutable std::mutex _pendingMutex;
+	mutable std::vector<std::vector<Range>> _pending;
+	mutable std::vector<std::vector<Range>> _pendingPositions;
+	mutable std::atomic<bool> _drawn;
+
+	// Compaction in progress: the rows recolored since it began (guarded by
+	// _pendingMutex) and the copies compact() makes. While compact() copies
+	// the saved source colors, recolor() leaves them in place.
+	bool _compacting = false;
+	bool _compactSource = false;
+	std::vector<Range> _compactLog;
+	osg::ref_ptr<osg::Vec4ubArray> _compactColors;
+	std::vector<osg::Vec4ub> _compactSourceColors;
+
+	void endCompaction();
+	void addChangedBlocks(const std::vector<char>& changed);
+	void addPending(const std::vector<Range>& ranges, bool positions = false);
+	void uploadPending(osg::State& state) const;
+};
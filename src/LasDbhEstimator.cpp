@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+#include <osg/BoundingBox>
+
+#include "PCVR_Math.hpp"
+#include "PCVR_Parallel.hpp"
+
+#include "LasDbhEstimator.hpp"
+
+namespace
+{
+	const std::size_t BLOCK_POINTS = 65536;
+	const std::size_t MAX_GROUND_CELLS = 1 << 22;
+	const uint8_t GROUND_CLASS = 2;				// ASPRS ground
+	const std::size_t CELL_BLOCK = 1024;			// slice cells per linking block
+	const int REFINE_STEPS = 2;
+
+	void atomicMin(std::atomic<float>& a, float value)
+	{
+		float current = a.load(std::memory_order_relaxed);
+		while (value < current && !a.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	uint32_t findRoot(std::vector<uint32_t>& parent, uint32_t i)
+	{
+		while (parent[i] != i)
+		{
+			parent[i] = parent[parent[i]];	// path halving
+			i = parent[i];
+		}
+		return i;
+	}
+
+	struct Circle
+	{
+		double x = 0.0, y = 0.0, r = 0.0;
+	};
+
+	bool circleThrough(double ax, double ay, double bx, double by, double cx, double cy, Circle& circle)
+	{
+		double d = 2.0 * (ax * (by - cy) + bx * (cy - ay) + cx * (ay - by));
+		if (std::abs(d) < 1e-12) return false;	// collinear
+
+		double a2 = ax * ax + ay * ay, b2 = bx * bx + by * by, c2 = cx * cx + cy * cy;
+		circle.x = (a2 * (by - cy) + b2 * (cy - ay) + c2 * (ay - by)) / d;
+		circle.y = (a2 * (cx - bx) + b2 * (ax - cx) + c2 * (bx - ax)) / d;
+		circle.r = std::sqrt((ax - circle.x) * (ax - circle.x) + (ay - circle.y) * (ay - circle.y));
+		return true;
+	}
+
+	// Algebraic (Kasa) least squares circle: x^2 + y^2 + Dx + Ey + F = 0.
+	bool fitCircle(const std::vector<double>& xs, const std::vector<double>& ys, const std::vector<uint32_t>& use,
+		Circle& circle)
+	{
+		double sxx = 0, sxy = 0, syy = 0, sx = 0, sy = 0, sxz = 0, syz = 0, sz = 0;
+		for (uint32_t j : use)
+		{
+			double x = xs[j], y = ys[j], z = x * x + y * y;
+			sxx += x * x; sxy += x * y; syy += y * y;
+			sx += x; sy += y;
+			sxz += x * z; syz += y * z; sz += z;
+		}
+		const double n = static_cast<double>(use.size());
+
+		// Normal equations [sxx sxy sx; sxy syy sy; sx sy n] * [D E F] = -[sxz syz sz], by Cramer's rule.
+		double det = sxx * (syy * n - sy * sy) - sxy * (sxy * n - sy * sx) + sx * (sxy * sy - syy * sx);
+		if (std::abs(det) < 1e-12) return false;
+		double D = (-sxz * (syy * n - sy * sy) + sxy * (syz * n - sy * sz) - sx * (syz * sy - syy * sz)) / det;
+		double E = (-sxx * (syz * n - sz * sy) + sxz * (sxy * n - sy * sx) - sx * (sxy * sz - syz * sx)) / det;
+		double F = (-sxx * (syy * sz - sy * syz) + sxy * (sxy * sz - syz * sx) - sxz * (sxy * sy - syy * sx)) / det;
+
+		circle.x = -D / 2.0;
+		circle.y = -E / 2.0;
+		double r2 = circle.x * circle.x + circle.y * circle.y - F;
+		if (!(r2 > 0.0)) return false;
+		circle.r = std::sqrt(r2);
+		return true;
+	}
+}
+
+LasDbhEstimator::LasDbhEstimator(const LasDbhOptions& options)
+	: _options(options)
+{
+}
+
+std::size_t LasDbhEstimator::estimate(const LasPointTable& table, const osg::Vec3d& origin,
+	std::vector<LasStem>& stems) const
+{
+	std::vector<uint32_t> slice;
+	std::vector<float> ground;
+	extractSlice(table, slice, ground);
+	if (slice.size() < _options.minStemPoints) return 0;
+
+	std::vector<osg::Vec3> points(slice.size());
+	for (std::size_t j = 0; j < slice.size(); j++)
+	{
+		points[j] = (*table.positions)[slice[j]];
+	}
+
+	std::vector<std::vector<uint32_t>> clusters;
+	clusterSlice(points, clusters);
+
+	std::vector<LasStem> fitted(clusters.size());
+	std::vector<char> ok(clusters.size(), 0);
+	parallelFor(0, clusters.size(), [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t c = first; c < last; c++)
+		{
+			if (!fitStem(points, clusters[c], static_cast<uint32_t>(c), fitted[c])) continue;
+
+			double groundSum = 0.0;
+			for (uint32_t j : clusters[c])
+			{
+				groundSum += ground[j];
+			}
+			fitted[c].position.z() = groundSum / clusters[c].size();
+			fitted[c].position += origin;
+			ok[c] = 1;
+		}
+	}, 1);
+
+	std::size_t numStems = 0;
+	for (std::size_t c = 0; c < clusters.size(); c++)
+	{
+		if (!ok[c]) continue;
+		stems.push_back(fitted[c]);
+		numStems++;
+	}
+	return numStems;
+}
+
+void LasDbhEstimator::extractSlice(const LasPointTable& table, std::vector<uint32_t>& slice,
+	std::vector<float>& ground) const
+{
+	slice.clear();
+	ground.clear();
+	const std::size_t n = table.size();
+	if (n == 0) return;
+
+	const osg::Vec3* verts = &table.positions->front();
+	osg::BoundingBox bounds = computeBounds(verts, n);
+	float cellSize = std::max(_options.groundCellSize, 1e-3f);
+	osg::Vec3 extent = bounds._max - bounds._min;
+	while ((std::size_t(extent.x() / cellSize) + 1) * (std::size_t(extent.y() / cellSize) + 1) > MAX_GROUND_CELLS)
+	{
+		cellSize *= 2.0f;
+	}
+	const int nx = static_cast<int>(extent.x() / cellSize) + 1;
+	const int ny = static_cast<int>(extent.y() / cellSize) + 1;
+	auto cellOf = [&](const osg::Vec3& v)
+	{
+		int x = std::min(static_cast<int>((v.x() - bounds._min.x()) / cellSize), nx - 1);
+		int y = std::min(static_cast<int>((v.y() - bounds._min.y()) / cellSize), ny - 1);
+		return std::size_t(y) * nx + x;
+	};
+
+	// Lowest point per cell, from the classified ground points if there are any.
+	const bool classified = std::find(table.classification.begin(), table.classification.end(), GROUND_CLASS)
+		!= table.classification.end();
+	const std::size_t numCells = std::size_t(nx) * ny;
+	std::unique_ptr<std::atomic<float>[]> lowest(new std::atomic<float>[numCells]);
+	for (std::size_t c = 0; c < numCells; c++)
+	{
+		lowest[c].store(FLT_MAX, std::memory_order_relaxed);
+	}
+	parallelFor(0, n, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			if (classified && table.classification[i] != GROUND_CLASS) continue;
+			atomicMin(lowest[cellOf(verts[i])], verts[i].z());
+		}
+	});
+
+	// The median of the 3x3 neighborhood ignores cells whose lowest point is a
+	// trunk or shrub rather than the ground.
+	std::vector<float> cellGround(numCells, FLT_MAX);
+	parallelFor(0, ny, [&](std::size_t firstRow, std::size_t lastRow)
+	{
+		float around[9];
+		for (int y = static_cast<int>(firstRow); y < static_cast<int>(lastRow); y++)
+		{
+			for (int x = 0; x < nx; x++)
+			{
+				int count = 0;
+				for (int dy = std::max(y - 1, 0); dy <= std::min(y + 1, ny - 1); dy++)
+				{
+					for (int dx = std::max(x - 1, 0); dx <= std::min(x + 1, nx - 1); dx++)
+					{
+						float z = lowest[std::size_t(dy) * nx + dx].load(std::memory_order_relaxed);
+						if (z != FLT_MAX) around[count++] = z;
+					}
+				}
+				if (count == 0) continue;
+				std::nth_element(around, around + count / 2, around + count);
+				cellGround[std::size_t(y) * nx + x] = around[count / 2];
+			}
+		}
+	}, 16);
+
+	const float low = _options.breastHeight - _options.sliceThickness / 2.0f;
+	const float high = _options.breastHeight + _options.sliceThickness / 2.0f;
+	const std::size_t numBlocks = (n + BLOCK_POINTS - 1) / BLOCK_POINTS;
+	std::vector<std::vector<uint32_t>> blockSlice(numBlocks);
+	parallelFor(0, numBlocks, [&](std::size_t firstBlock, std::size_t lastBlock)
+	{
+		for (std::size_t b = firstBlock; b < lastBlock; b++)
+		{
+			for (std::size_t i = b * BLOCK_POINTS; i < std::min((b + 1) * BLOCK_POINTS, n); i++)
+			{
+				float g = cellGround[cellOf(verts[i])];
+				if (g == FLT_MAX) continue;
+				float height = verts[i].z() - g;
+				if (height >= low && height <= high) blockSlice[b].push_back(static_cast<uint32_t>(i));
+			}
+		}
+	}, 1);
+
+	for (const std::vector<uint32_t>& block : blockSlice)
+	{
+		slice.insert(slice.end(), block.begin(), block.end());
+	}
+	ground.resize(slice.size());
+	for (std::size_t j = 0; j < slice.size(); j++)
+	{
+		ground[j] = cellGround[cellOf(verts[slice[j]])];
+	}
+}
+
+void LasDbhEstimator::clusterSlice(const std::vector<osg::Vec3>& points,
+	std::vector<std::vector<uint32_t>>& clusters) const
+{
+	clusters.clear();
+	const std::size_t n = points.size();
+	if (n == 0) return;
+
+	// Bin the points in the horizontal plane into cells whose diagonal is the
+	// cluster distance, so the points of one cell are always linked and only
+	// cells up to two apart need their points compared.
+	const float eps = std::max(_options.clusterDistance, 1e-4f);
+	const float cellSize = eps / std::sqrt(2.0f);
+	osg::BoundingBox bounds = computeBounds(&points.front(), n);
+	std::vector<std::pair<uint64_t, uint32_t>> binned(n);
+	parallelFor(0, n, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t j = first; j < last; j++)
+		{
+			uint64_t x = static_cast<uint64_t>((points[j].x() - bounds._min.x()) / cellSize) + 2;
+			uint64_t y = static_cast<uint64_t>((points[j].y() - bounds._min.y()) / cellSize) + 2;
+			binned[j] = std::make_pair((y << 32) | x, static_cast<uint32_t>(j));
+		}
+	});
+	std::sort(binned.begin(), binned.end());
+
+	std::vector<uint32_t> cellStart;
+	for (std::size_t k = 0; k < n; k++)
+	{
+		if (k == 0 || binned[k].first != binned[k - 1].first) cellStart.push_back(static_cast<uint32_t>(k));
+	}
+	const std::size_t numCells = cellStart.size();
+	cellStart.push_back(static_cast<uint32_t>(n));
+
+	// Find linked pairs of cells in parallel; each pair is tested from its lower cell.
+	const float eps2 = eps * eps;
+	std::vector<std::vector<std::pair<uint32_t, uint32_t>>> blockLinks((numCells + CELL_BLOCK - 1) / CELL_BLOCK);
+	parallelFor(0, blockLinks.size(), [&](std::size_t firstBlock, std::size_t lastBlock)
+	{
+		for (std::size_t b = firstBlock; b < lastBlock; b++)
+		{
+			for (std::size_t c = b * CELL_BLOCK; c < std::min((b + 1) * CELL_BLOCK, numCells); c++)
+			{
+				const uint64_t key = binned[cellStart[c]].first;
+				for (int dy = 0; dy <= 2; dy++)
+				{
+					for (int dx = -2; dx <= 2; dx++)
+					{
+						if (dy == 0 && dx <= 0) continue;
+						const uint64_t other = key + (uint64_t(dy) << 32) + dx;
+						auto found = std::lower_bound(binned.begin(), binned.end(), std::make_pair(other, uint32_t(0)));
+						if (found == binned.end() || found->first != other) continue;
+
+						bool linked = false;
+						for (uint32_t i = cellStart[c]; i < cellStart[c + 1] && !linked; i++)
+						{
+							for (auto j = found; j != binned.end() && j->first == other && !linked; ++j)
+							{
+								osg::Vec3 d = points[binned[i].second] - points[j->second];
+								linked = d.x() * d.x() + d.y() * d.y() <= eps2;
+							}
+						}
+						if (linked)
+						{
+							uint32_t otherCell = static_cast<uint32_t>(std::upper_bound(cellStart.begin(), cellStart.end(),
+								static_cast<uint32_t>(found - binned.begin())) - cellStart.begin() - 1);
+							blockLinks[b].push_back(std::make_pair(static_cast<uint32_t>(c), otherCell));
+						}
+					}
+				}
+			}
+		}
+	}, 1);
+
+	std::vector<uint32_t> parent(numCells);
+	for (std::size_t c = 0; c < numCells; c++) parent[c] = static_cast<uint32_t>(c);
+	for (const auto& links : blockLinks)
+	{
+		for (const auto& link : links)
+		{
+			uint32_t a = findRoot(parent, link.first), b = findRoot(parent, link.second);
+			if (a != b) parent[std::max(a, b)] = std::min(a, b);
+		}
+	}
+
+	// Roots are the lowest cell of their cluster, so clusters come out in cell order.
+	std::vector<uint32_t> clusterOf(numCells, UINT32_MAX);
+	for (std::size_t c = 0; c < numCells; c++)
+	{
+		uint32_t root = findRoot(parent, static_cast<uint32_t>(c));
+		if (clusterOf[root] == UINT32_MAX)
+		{
+			clusterOf[root] = static_cast<uint32_t>(clusters.size());
+			clusters.push_back(std::vector<uint32_t>());
+		}
+		std::vector<uint32_t>& cluster = clusters[clusterOf[root]];
+		for (uint32_t k = cellStart[c]; k < cellStart[c + 1]; k++)
+		{
+			cluster.push_back(binned[k].second);
+		}
+	}
+	clusters.erase(std::remove_if(clusters.begin(), clusters.end(),
+		[this](const std::vector<uint32_t>& c) { return c.size() < _options.minStemPoints; }), clusters.end());
+}
+
+bool LasDbhEstimator::fitStem(const std::vector<osg::Vec3>& points, const std::vector<uint32_t>& cluster,
+	uint32_t seed, LasStem& stem) const
+{
+	const std::size_t n = cluster.size();
+	if (n < 3) return false;
+
+	// Work relative to the cluster's mean, so the circle math stays well conditioned.
+	double meanX = 0.0, meanY = 0.0;
+	float zMin = FLT_MAX, zMax = -FLT_MAX;
+	for (uint32_t j : cluster)
+	{
+		meanX += points[j].x();
+		meanY += points[j].y();
+		zMin = std::min(zMin, points[j].z());
+		zMax = std::max(zMax, points[j].z());
+	}
+	meanX /= n;
+	meanY /= n;
+	std::vector<double> xs(n), ys(n);
+	for (std::size_t k = 0; k < n; k++)
+	{
+		xs[k] = points[cluster[k]].x() - meanX;
+		ys[k] = points[cluster[k]].y() - meanY;
+	}
+
+	const double tol = _options.fitTolerance;
+	const double maxRadius = _options.maxDiameter / 2.0;
+	auto inliersOf = [&](const Circle& circle, std::vector<uint32_t>* inliers)
+	{
+		uint32_t count = 0;
+		for (std::size_t k = 0; k < n; k++)
+		{
+			double d = std::sqrt((xs[k] - circle.x) * (xs[k] - circle.x) + (ys[k] - circle.y) * (ys[k] - circle.y));
+			if (std::abs(d - circle.r) > tol) continue;
+			count++;
+			if (inliers) inliers->push_back(static_cast<uint32_t>(k));
+		}
+		return count;
+	};
+
+	// RANSAC over three-point circles; a fixed seed per cluster keeps runs repeatable.
+	uint32_t state = seed * 2654435761u + 0x9e3779b9u;
+	auto random = [&state](std::size_t range)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return static_cast<std::size_t>(state % range);
+	};
+	Circle best;
+	uint32_t bestCount = 0;
+	for (unsigned int it = 0; it < _options.ransacIterations; it++)
+	{
+		std::size_t a = random(n), b = random(n), c = random(n);
+		if (a == b || b == c || a == c) continue;
+
+		Circle circle;
+		if (!circleThrough(xs[a], ys[a], xs[b], ys[b], xs[c], ys[c], circle) || circle.r > maxRadius) continue;
+		uint32_t count = inliersOf(circle, nullptr);
+		if (count > bestCount)
+		{
+			best = circle;
+			bestCount = count;
+		}
+	}
+	if (bestCount < 3) return false;
+
+	// Refine with least squares over the inliers of the current circle.
+	for (int step = 0; step < REFINE_STEPS; step++)
+	{
+		std::vector<uint32_t> inliers;
+		inliersOf(best, &inliers);
+		Circle refined;
+		if (inliers.size() < 3 || !fitCircle(xs, ys, inliers, refined) || refined.r > maxRadius) break;
+		best = refined;
+	}
+
+	// Score the fit with the disk tool's cylinder test: a vertical cylinder
+	// through the slice, slightly wider than the trunk.
+	const osg::Vec3 pt1(static_cast<float>(best.x + meanX), static_cast<float>(best.y + meanY), zMin - 1.0f);
+	const osg::Vec3 pt2(pt1.x(), pt1.y(), zMax + 1.0f);
+	const double lengthsq = (pt2 - pt1).length2();
+	const double outer = best.r + tol;
+	uint32_t numInliers = 0;
+	double sumSq = 0.0;
+	for (uint32_t j : cluster)
+	{
+		float dsq = CylTest_CapsFirst(pt1, pt2, lengthsq, outer * outer, points[j]);
+		if (dsq < 0.0f) continue;
+		double residual = std::sqrt(dsq) - best.r;
+		if (residual < -tol) continue;
+		numInliers++;
+		sumSq += residual * residual;
+	}
+	if (numInliers < 3 || numInliers < _options.minInlierRatio * n) return false;
+
+	stem.position.set(pt1.x(), pt1.y(), 0.0);
+	stem.diameter = static_cast<float>(2.0 * best.r);
+	stem.rmse = static_cast<float>(std::sqrt(sumSq / numInliers));
+	stem.numPoints = static_cast<uint32_t>(n);
+	stem.numInliers = numInliers;
+	return true;
+}
+
+bool LasDbhEstimator::WriteCsv(const std::string& path, const std::vector<LasStem>& stems)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cout << "Could not write " << path << std::endl;
+		return false;
+	}
+
+	file << "x,y,ground_z,dbh,rmse,points,inliers" << std::endl;
+	file << std::fixed;
+	for (const LasStem& stem : stems)
+	{
+		file << std::setprecision(3) << stem.position.x() << "," << stem.position.y() << "," << stem.position.z() << ","
+			<< std::setprecision(4) << stem.diameter << "," << stem.rmse << ","
+			<< stem.numPoints << "," << stem.numInliers << std::endl;
+	}
+	return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <osg/Vec3>
+#include <osg/Vec3d>
+
+#include "LasPointTable.hpp"
+
+// Settings of the headless DBH (trunk diameter at breast height) batch.
+// Lengths are in the units of the LAS file, normally meters, with z up.
+struct LasDbhOptions
+{
+	float breastHeight = 1.3f;			// slice center above the ground
+	float sliceThickness = 0.1f;		// slice spans breastHeight +/- half of this
+	float groundCellSize = 1.0f;		// ground model resolution
+	float clusterDistance = 0.1f;		// slice points closer than this belong to one stem
+	unsigned int minStemPoints = 20;	// smaller clusters are not fitted
+	float maxDiameter = 2.0f;			// larger circles are rejected
+	float fitTolerance = 0.02f;			// a point within this of the circle is an inlier
+	float minInlierRatio = 0.5f;		// fits explaining fewer of their points are rejected
+	unsigned int ransacIterations = 256;
+};
+
+// One fitted stem.
+struct LasStem
+{
+	osg::Vec3d position;		// stem center at ground level, source coordinates
+	float diameter = 0.0f;
+	float rmse = 0.0f;			// radial RMS error of the inliers
+	uint32_t numPoints = 0;		// slice points in the stem's cluster
+	uint32_t numInliers = 0;
+};
+
+//-----------------------------------------------------------------------------
+// LasDbhEstimator
+//    Measures every trunk of a forest plot without the disk tool. A coarse
+// ground model (the median of the lowest points around each grid cell) gives
+// each point its height above ground, and the points near breast height form
+// a thin slice. Slice points are linked to their neighbors within
+// clusterDistance in the horizontal plane, and each connected cluster is one
+// stem candidate.
+//    Stems are fitted in parallel: RANSAC over three-point circles finds the
+// trunk outline among branches and understory, a least squares fit of its
+// inliers refines it, and the same cylinder test the disk tool uses
+// (CylTest_CapsFirst) scores the result.
+//-----------------------------------------------------------------------------
+class LasDbhEstimator
+{
+public:
+	LasDbhEstimator(const LasDbhOptions& options = LasDbhOptions());
+
+	// Fit the stems of a table whose positions are relative to 'origin' and
+	// append them to 'stems'. Returns the number of stems found.
+	std::size_t estimate(const LasPointTable& table, const osg::Vec3d& origin, std::vector<LasStem>& stems) const;
+
+	static bool WriteCsv(const std::string& path, const std::vector<LasStem>& stems);
+
+private:
+	LasDbhOptions _options;
+
+	// Ground height under each slice point, and the indices of the points in the slice.
+	void extractSlice(const LasPointTable& table, std::vector<uint32_t>& slice, std::vector<float>& ground) const;
+	// Groups of slice positions (indices into 'slice') that form one stem candidate each.
+	void clusterSlice(const std::vector<osg::Vec3>& points, std::vector<std::vector<uint32_t>>& clusters) const;
+	bool fitStem(const std::vector<osg::Vec3>& points, const std::vector<uint32_t>& cluster, uint32_t seed,
+		LasStem& stem) const;
+};
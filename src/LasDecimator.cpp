@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <osg/BoundingBox>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasDecimator.hpp"
+
+namespace
+{
+	const int KEY_BITS = 21;						// per axis, so a key fits 63 bits
+	const uint32_t MAX_VOXELS_PER_AXIS = (1u << KEY_BITS) - 1;
+	const unsigned int NUM_SHARDS = 64;				// fixed, so results do not depend on the thread count
+	const std::size_t BLOCK_POINTS = 65536;
+	const int MAX_SIZE_SEARCH_STEPS = 24;
+	const float SIZE_TOLERANCE = 1.05f;
+
+	uint64_t hashKey(uint64_t k)
+	{
+		// splitmix64 finalizer
+		k ^= k >> 30;
+		k *= 0xbf58476d1ce4e5b9ULL;
+		k ^= k >> 27;
+		k *= 0x94d049bb133111ebULL;
+		return k ^ (k >> 31);
+	}
+
+	// Voxel keys of the points, and the point indices grouped by key shard.
+	// Within a shard, indices stay in increasing order.
+	class VoxelShards
+	{
+	public:
+		VoxelShards(const LasPointTable& table, const osg::BoundingBox& bounds, float voxelSize)
+		{
+			const std::size_t n = table.size();
+			const osg::Vec3* verts = &table.positions->front();
+			const osg::Vec3 origin = bounds._min;
+			const float invSize = 1.0f / voxelSize;
+
+			keys.resize(n);
+			const std::size_t numBlocks = (n + BLOCK_POINTS - 1) / BLOCK_POINTS;
+			std::vector<uint32_t> counts(numBlocks * NUM_SHARDS, 0);
+			parallelFor(0, numBlocks, [&](std::size_t firstBlock, std::size_t lastBlock)
+			{
+				for (std::size_t b = firstBlock; b < lastBlock; b++)
+				{
+					uint32_t* blockCounts = &counts[b * NUM_SHARDS];
+					for (std::size_t i = b * BLOCK_POINTS; i < std::min((b + 1) * BLOCK_POINTS, n); i++)
+					{
+						osg::Vec3 v = (verts[i] - origin) * invSize;
+						uint64_t x = std::min(static_cast<uint32_t>(std::max(v.x(), 0.0f)), MAX_VOXELS_PER_AXIS);
+						uint64_t y = std::min(static_cast<uint32_t>(std::max(v.y(), 0.0f)), MAX_VOXELS_PER_AXIS);
+						uint64_t z = std::min(static_cast<uint32_t>(std::max(v.z(), 0.0f)), MAX_VOXELS_PER_AXIS);
+						keys[i] = x | (y << KEY_BITS) | (z << (2 * KEY_BITS));
+						blockCounts[shardOf(keys[i])]++;
+					}
+				}
+			}, 1);
+
+			// Shard-major prefix sum turns the counts into scatter offsets.
+			shardStart.assign(NUM_SHARDS + 1, 0);
+			uint32_t offset = 0;
+			for (unsigned int s = 0; s < NUM_SHARDS; s++)
+			{
+				shardStart[s] = offset;
+				for (std::size_t b = 0; b < numBlocks; b++)
+				{
+					uint32_t count = counts[b * NUM_SHARDS + s];
+					counts[b * NUM_SHARDS + s] = offset;
+					offset += count;
+				}
+			}
+			shardStart[NUM_SHARDS] = offset;
+
+			indices.resize(n);
+			parallelFor(0, numBlocks, [&](std::size_t firstBlock, std::size_t lastBlock)
+			{
+				for (std::size_t b = firstBlock; b < lastBlock; b++)
+				{
+					uint32_t* next = &counts[b * NUM_SHARDS];
+					for (std::size_t i = b * BLOCK_POINTS; i < std::min((b + 1) * BLOCK_POINTS, n); i++)
+					{
+						indices[next[shardOf(keys[i])]++] = static_cast<uint32_t>(i);
+					}
+				}
+			}, 1);
+		}
+
+		std::vector<uint64_t> keys;
+		std::vector<uint32_t> shardStart;
+		std::vector<uint32_t> indices;
+
+	private:
+		static unsigned int shardOf(uint64_t key)
+		{
+			return static_cast<unsigned int>(hashKey(key) >> 58);	// top 6 bits: 64 shards
+		}
+	};
+
+	// Voxel size no smaller than the key range allows for these bounds.
+	float clampVoxelSize(const osg::BoundingBox& bounds, float voxelSize)
+	{
+		osg::Vec3 extent = bounds._max - bounds._min;
+		float largest = std::max(extent.x(), std::max(extent.y(), extent.z()));
+		return std::max(voxelSize, largest / (MAX_VOXELS_PER_AXIS - 1));
+	}
+
+	std::size_t countVoxels(const LasPointTable& table, const osg::BoundingBox& bounds, float voxelSize)
+	{
+		VoxelShards shards(table, bounds, voxelSize);
+		std::vector<std::size_t> counts(NUM_SHARDS, 0);
+		parallelFor(0, NUM_SHARDS, [&](std::size_t first, std::size_t last)
+		{
+			for (std::size_t s = first; s < last; s++)
+			{
+				std::unordered_set<uint64_t> voxels;
+				voxels.reserve(shards.shardStart[s + 1] - shards.shardStart[s]);
+				for (uint32_t k = shards.shardStart[s]; k < shards.shardStart[s + 1]; k++)
+				{
+					voxels.insert(shards.keys[shards.indices[k]]);
+				}
+				counts[s] = voxels.size();
+			}
+		}, 1);
+
+		std::size_t total = 0;
+		for (std::size_t c : counts) total += c;
+		return total;
+	}
+
+	struct Voxel
+	{
+		osg::Vec3d positionSum;
+		uint64_t colorSum[4] = {};
+		uint32_t count = 0;
+		uint32_t kept = 0;
+		float keptDistance2 = 0.0f;
+	};
+}
+
+std::size_t voxelDownsample(LasPointTable& table, float voxelSize)
+{
+	const std::size_t n = table.size();
+	if (n == 0 || !(voxelSize > 0.0f)) return n;
+
+	const osg::Vec3* verts = &table.positions->front();
+	const osg::Vec4ub* colors = &table.colors->front();
+	osg::BoundingBox bounds = computeBounds(verts, n);
+	VoxelShards shards(table, bounds, clampVoxelSize(bounds, voxelSize));
+
+	// Each shard owns its voxels outright, so shards aggregate in parallel.
+	typedef std::pair<uint32_t, osg::Vec4ub> Kept;	// (point index, averaged color)
+	std::vector<std::vector<Kept>> kept(NUM_SHARDS);
+	parallelFor(0, NUM_SHARDS, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t s = first; s < last; s++)
+		{
+			const uint32_t begin = shards.shardStart[s], end = shards.shardStart[s + 1];
+			std::unordered_map<uint64_t, uint32_t> voxelOf;
+			voxelOf.reserve(end - begin);
+			std::vector<Voxel> voxels;
+			std::vector<uint32_t> pointVoxel(end - begin);
+
+			for (uint32_t k = begin; k < end; k++)
+			{
+				uint32_t i = shards.indices[k];
+				auto found = voxelOf.emplace(shards.keys[i], static_cast<uint32_t>(voxels.size()));
+				if (found.second) voxels.push_back(Voxel());
+				Voxel& voxel = voxels[found.first->second];
+				voxel.positionSum += osg::Vec3d(verts[i]);
+				for (int c = 0; c < 4; c++) voxel.colorSum[c] += colors[i][c];
+				voxel.count++;
+				pointVoxel[k - begin] = found.first->second;
+			}
+
+			// Keep the point nearest each centroid; indices ascend, so ties go
+			// to the earliest point.
+			std::vector<osg::Vec3> centroids(voxels.size());
+			for (std::size_t v = 0; v < voxels.size(); v++)
+			{
+				centroids[v] = osg::Vec3(voxels[v].positionSum / voxels[v].count);
+				voxels[v].count = 0;
+			}
+			for (uint32_t k = begin; k < end; k++)
+			{
+				uint32_t i = shards.indices[k];
+				Voxel& voxel = voxels[pointVoxel[k - begin]];
+				float d2 = (verts[i] - centroids[pointVoxel[k - begin]]).length2();
+				if (voxel.count++ == 0 || d2 < voxel.keptDistance2)
+				{
+					voxel.kept = i;
+					voxel.keptDistance2 = d2;
+				}
+			}
+
+			kept[s].reserve(voxels.size());
+			for (const Voxel& voxel : voxels)
+			{
+				// Rounded mean color.
+				osg::Vec4ub color;
+				for (int c = 0; c < 4; c++)
+				{
+					color[c] = static_cast<uint8_t>((voxel.colorSum[c] + voxel.count / 2) / voxel.count);
+				}
+				kept[s].push_back(Kept(voxel.kept, color));
+			}
+		}
+	}, 1);
+
+	std::vector<Kept> all;
+	for (std::vector<Kept>& shard : kept)
+	{
+		all.insert(all.end(), shard.begin(), shard.end());
+		std::vector<Kept>().swap(shard);
+	}
+	std::sort(all.begin(), all.end(), [](const Kept& a, const Kept& b) { return a.first < b.first; });
+
+	LasPointTable out;
+	out.resize(all.size());
+	parallelFor(0, all.size(), [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t j = first; j < last; j++)
+		{
+			uint32_t i = all[j].first;
+			(*out.positions)[j] = verts[i];
+			(*out.colors)[j] = all[j].second;
+			out.classification[j] = table.classification[i];
+			out.intensity[j] = table.intensity[i];
+			out.returnNumber[j] = table.returnNumber[i];
+			out.numberOfReturns[j] = table.numberOfReturns[i];
+		}
+	});
+
+	table = std::move(out);
+	return table.size();
+}
+
+float voxelDownsampleToCount(LasPointTable& table, std::size_t maxPoints)
+{
+	const std::size_t n = table.size();
+	if (n <= maxPoints || maxPoints == 0) return 0.0f;
+
+	osg::BoundingBox bounds = computeBounds(&table.positions->front(), n);
+	osg::Vec3 extent = bounds._max - bounds._min;
+	float volume = std::max(extent.x(), 1e-3f) * std::max(extent.y(), 1e-3f) * std::max(extent.z(), 1e-3f);
+
+	// Start from a voxel size that would fit if the points filled their box,
+	// then bracket and bisect. Scans are mostly surfaces, so the voxel count
+	// is assumed to scale with the inverse square of the size.
+	float size = clampVoxelSize(bounds, std::cbrt(volume / maxPoints));
+	float tooSmall = 0.0f, bigEnough = 0.0f;
+	for (int step = 0; step < MAX_SIZE_SEARCH_STEPS; step++)
+	{
+		std::size_t count = countVoxels(table, bounds, size);
+		if (count <= maxPoints) bigEnough = size;
+		else tooSmall = size;
+
+		if (tooSmall > 0.0f && bigEnough > 0.0f)
+		{
+			if (bigEnough < tooSmall * SIZE_TOLERANCE) break;
+			size = std::sqrt(tooSmall * bigEnough);
+		}
+		else if (bigEnough > 0.0f)
+		{
+			size *= std::min(1.0f / SIZE_TOLERANCE, std::sqrt(static_cast<float>(count) / maxPoints));
+			if (size <= clampVoxelSize(bounds, 0.0f)) break;
+		}
+		else
+		{
+			size *= std::max(SIZE_TOLERANCE, std::sqrt(static_cast<float>(count) / maxPoints));
+		}
+	}
+
+	// The search can run out of steps before any size fits; keep growing it.
+	for (int step = 0; bigEnough == 0.0f && step < MAX_SIZE_SEARCH_STEPS; step++)
+	{
+		size *= 2.0f;
+		if (countVoxels(table, bounds, size) <= maxPoints) bigEnough = size;
+	}
+	if (bigEnough == 0.0f)
+	{
+		std::cout << "Could not downsample " << n << " points to " << maxPoints << "; using voxel size " << size
+			<< std::endl;
+		bigEnough = size;
+	}
+
+	voxelDownsample(table, bigEnough);
+	return bigEnough;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+#include "LasPointTable.hpp"
+
+//-----------------------------------------------------------------------------
+// Voxel-grid downsampling
+//    Thin a LasPointTable to one point per occupied cube of a voxel grid. The
+// kept point is the real point nearest the centroid of its voxel, so its
+// position and LAS attributes stay genuine; its color is the average color
+// of the voxel. Kept points stay in their original order.
+//
+//    Voxels are found with a hash of the voxel coordinates, sharded by hash so
+// that every shard is aggregated by one thread without locking. The result
+// does not depend on the number of threads.
+//-----------------------------------------------------------------------------
+
+// Downsample with the given voxel edge length. Returns the new point count.
+std::size_t voxelDownsample(LasPointTable& table, float voxelSize);
+
+// Downsample with the smallest voxel size (within a few percent) that leaves
+// at most maxPoints. Returns the voxel size used, or 0 if the table was
+// already small enough.
+float voxelDownsampleToCount(LasPointTable& table, std::size_t maxPoints);
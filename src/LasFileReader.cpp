@@ -0,0 +1,418 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasFileReader.hpp"
+
+namespace
+{
+	// LAS is little-endian; records are packed, so read through memcpy.
+	template <typename T>
+	T readLE(const char* p)
+	{
+		T value;
+		std::memcpy(&value, p, sizeof(T));
+		return value;
+	}
+
+	// Where the attributes we keep live inside one point record.
+	struct RecordLayout
+	{
+		bool extended;			// formats 6-10: 4-bit return fields, full classification byte
+		int rgbOffset;			// -1 if the format carries no color
+		uint16_t minLength;		// smallest legal record length for the format
+	};
+
+	bool getRecordLayout(uint8_t format, RecordLayout& layout)
+	{
+		static const RecordLayout layouts[] =
+		{
+			{ false, -1, 20 },	// 0
+			{ false, -1, 28 },	// 1: + GPS time
+			{ false, 20, 26 },	// 2: + RGB
+			{ false, 28, 34 },	// 3: + GPS time, RGB
+			{ false, -1, 57 },	// 4: + GPS time, wave packet
+			{ false, 28, 63 },	// 5: + GPS time, RGB, wave packet
+			{ true,  -1, 30 },	// 6
+			{ true,  30, 36 },	// 7: + RGB
+			{ true,  30, 38 },	// 8: + RGB, NIR
+			{ true,  -1, 59 },	// 9: + wave packet
+			{ true,  30, 67 }	// 10: + RGB, NIR, wave packet
+		};
+		if (format >= sizeof(layouts) / sizeof(layouts[0])) return false;
+		layout = layouts[format];
+		return true;
+	}
+
+	// The point records must be uncompressed and in a known format.
+	bool checkRecords(const LasHeader& header, RecordLayout& layout)
+	{
+		if (header.compressed)
+		{
+			std::cout << "Compressed point records are not supported by the LAS decoder." << std::endl;
+			return false;
+		}
+		if (!getRecordLayout(header.pointFormat, layout) || header.pointRecordLength < layout.minLength)
+		{
+			std::cout << "Unsupported LAS point format " << (int)header.pointFormat
+				<< " with record length " << header.pointRecordLength << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Decodes one record into row i of a table, recentered on 'center'.
+	class RecordDecoder
+	{
+	public:
+		RecordDecoder(const LasHeader& header, const RecordLayout& layout, const osg::Vec3d& center, LasPointTable& table)
+			: _layout(layout)
+			, _verts(&table.positions->front())
+			, _colors(&table.colors->front())
+			, _classification(table.classification.data())
+			, _intensity(table.intensity.data())
+			, _returnNumber(table.returnNumber.data())
+			, _numberOfReturns(table.numberOfReturns.data())
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				_scale[k] = header.scale[k];
+				_bias[k] = header.offset[k] - center[k];
+			}
+		}
+
+		void decode(const char* rec, std::size_t i) const
+		{
+			_verts[i].set(readLE<int32_t>(rec) * _scale[0] + _bias[0],
+				readLE<int32_t>(rec + 4) * _scale[1] + _bias[1],
+				readLE<int32_t>(rec + 8) * _scale[2] + _bias[2]);
+
+			_intensity[i] = readLE<uint16_t>(rec + 12);
+
+			uint8_t returns = readLE<uint8_t>(rec + 14);
+			if (_layout.extended)
+			{
+				_returnNumber[i] = returns & 0x0f;
+				_numberOfReturns[i] = returns >> 4;
+				_classification[i] = readLE<uint8_t>(rec + 16);
+			}
+			else
+			{
+				_returnNumber[i] = returns & 0x07;
+				_numberOfReturns[i] = (returns >> 3) & 0x07;
+				_classification[i] = readLE<uint8_t>(rec + 15) & 0x1f;
+			}
+
+			// Colors are kept as 8 bits per channel: the high byte of each
+			// 16-bit LAS channel.
+			if (_layout.rgbOffset >= 0)
+			{
+				const char* rgb = rec + _layout.rgbOffset;
+				_colors[i].set(readLE<uint16_t>(rgb) >> 8,
+					readLE<uint16_t>(rgb + 2) >> 8,
+					readLE<uint16_t>(rgb + 4) >> 8,
+					255);
+			}
+			else
+			{
+				_colors[i].set(0, 0, 0, 255);
+			}
+		}
+
+	private:
+		RecordLayout _layout;
+		double _scale[3];
+		double _bias[3];
+		osg::Vec3* _verts;
+		osg::Vec4ub* _colors;
+		uint8_t* _classification;
+		uint16_t* _intensity;
+		uint8_t* _returnNumber;
+		uint8_t* _numberOfReturns;
+	};
+
+	const std::size_t MIN_HEADER_SIZE = 227;	// LAS 1.0-1.2 public header block
+	const std::size_t MAX_HEADER_SIZE = 375;	// LAS 1.4 public header block
+	const std::size_t FILTER_BLOCK = 65536;		// records per block of a filtered read
+}
+
+osg::Vec3d LasHeader::getCenter() const
+{
+	return osg::Vec3d(max[0] + min[0], max[1] + min[1], max[2] + min[2]) * 0.5;
+}
+
+LasFileReader::LasFileReader(const std::string& path, bool mapRecords)
+	: _path(path)
+{
+	if (!mapRecords)
+	{
+		std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+		if (ifs) _fileSize = static_cast<uint64_t>(ifs.tellg());
+		_open = ReadHeader(path, _header);
+	}
+	else
+	{
+		try
+		{
+			_file.open(path);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "Could not map " << path << ": " << e.what() << std::endl;
+			return;
+		}
+		_fileSize = _file.size();
+		_open = ParseHeader(_file.data(), _file.size(), _header);
+	}
+
+	if (!_open)
+	{
+		std::cout << path << " is not a readable LAS file." << std::endl;
+	}
+}
+
+bool LasFileReader::isOpen() const
+{
+	return _open;
+}
+
+const LasHeader& LasFileReader::getHeader() const
+{
+	return _header;
+}
+
+bool LasFileReader::ReadHeader(const std::string& path, LasHeader& header)
+{
+	std::ifstream ifs(path, std::ios::binary);
+	if (!ifs) return false;
+
+	char buffer[MAX_HEADER_SIZE];
+	ifs.read(buffer, MAX_HEADER_SIZE);
+	return ParseHeader(buffer, static_cast<std::size_t>(ifs.gcount()), header);
+}
+
+bool LasFileReader::ParseHeader(const char* data, std::size_t size, LasHeader& header)
+{
+	if (size < MIN_HEADER_SIZE || std::memcmp(data, "LASF", 4) != 0) return false;
+
+	header.versionMajor = readLE<uint8_t>(data + 24);
+	header.versionMinor = readLE<uint8_t>(data + 25);
+	header.headerSize = readLE<uint16_t>(data + 94);
+	header.pointDataOffset = readLE<uint32_t>(data + 96);
+
+	uint8_t format = readLE<uint8_t>(data + 104);
+	header.compressed = (format & 0x80) != 0;
+	header.pointFormat = format & 0x3f;
+	header.pointRecordLength = readLE<uint16_t>(data + 105);
+	header.pointCount = readLE<uint32_t>(data + 107);
+
+	for (int i = 0; i < 3; i++)
+	{
+		header.scale[i] = readLE<double>(data + 131 + 8 * i);
+		header.offset[i] = readLE<double>(data + 155 + 8 * i);
+		header.max[i] = readLE<double>(data + 179 + 16 * i);
+		header.min[i] = readLE<double>(data + 187 + 16 * i);
+	}
+
+	// LAS 1.4 moved the point count to a 64-bit field; the legacy one may be 0.
+	if (header.versionMajor == 1 && header.versionMinor >= 4 && header.headerSize >= 255 && size >= 255)
+	{
+		uint64_t count = readLE<uint64_t>(data + 247);
+		if (count != 0) header.pointCount = count;
+	}
+
+	return header.versionMajor == 1;
+}
+
+std::size_t LasFileReader::getNumPoints() const
+{
+	if (!_open || _header.pointRecordLength == 0 || _header.pointDataOffset > _fileSize) return 0;
+
+	// Never trust the count further than the file reaches.
+	uint64_t available = (_fileSize - _header.pointDataOffset) / _header.pointRecordLength;
+	return static_cast<std::size_t>(std::min(_header.pointCount, available));
+}
+
+bool LasFileReader::readPoints(LasPointTable& table, const osg::Vec3d& center)
+{
+	std::size_t count = getNumPoints();
+	if (_open && count < _header.pointCount)
+	{
+		std::cout << "LAS header lists " << _header.pointCount << " points but the file holds "
+			<< count << std::endl;
+	}
+	return readPoints(table, center, 0, count);
+}
+
+bool LasFileReader::readPositions(std::vector<osg::Vec3>& positions, const osg::Vec3d& center)
+{
+	RecordLayout layout;
+	if (!_open || !checkRecords(_header, layout)) return false;
+
+	const std::size_t count = getNumPoints();
+	boost::iostreams::mapped_file_source window;
+	const char* records = mapRecords(0, count, window);
+	if (count > 0 && records == nullptr) return false;
+
+	positions.resize(count);
+	const std::size_t stride = _header.pointRecordLength;
+	const double scale[3] = { _header.scale[0], _header.scale[1], _header.scale[2] };
+	const double bias[3] = { _header.offset[0] - center.x(), _header.offset[1] - center.y(), _header.offset[2] - center.z() };
+	parallelFor(0, count, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			const char* rec = records + i * stride;
+			positions[i].set(readLE<int32_t>(rec) * scale[0] + bias[0],
+				readLE<int32_t>(rec + 4) * scale[1] + bias[1],
+				readLE<int32_t>(rec + 8) * scale[2] + bias[2]);
+		}
+	});
+	return true;
+}
+
+bool LasFileReader::readPoints(LasPointTable& table, const osg::Vec3d& center, std::size_t first, std::size_t count)
+{
+	RecordLayout layout;
+	if (!_open || !checkRecords(_header, layout)) return false;
+
+	std::size_t numPoints = getNumPoints();
+	first = std::min(first, numPoints);
+	count = std::min(count, numPoints - first);
+
+	table.resize(count);
+	if (count == 0) return true;
+
+	boost::iostreams::mapped_file_source window;
+	const char* records = mapRecords(first, count, window);
+	if (records == nullptr) return false;
+
+	const std::size_t stride = _header.pointRecordLength;
+	const RecordDecoder decoder(_header, layout, center, table);
+	parallelFor(0, count, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			decoder.decode(records + i * stride, i);
+		}
+	});
+
+	return true;
+}
+
+bool LasFileReader::readPoints(LasPointTable& table, const osg::Vec3d& center, const LasPointFilter& filter)
+{
+	if (!filter.isActive()) return readPoints(table, center);
+	return readPoints(table, center, filter, 0, getNumPoints());
+}
+
+bool LasFileReader::readPoints(LasPointTable& table, const osg::Vec3d& center, const LasPointFilter& filter,
+	std::size_t first, std::size_t count)
+{
+	if (!filter.isActive()) return readPoints(table, center, first, count);
+
+	RecordLayout layout;
+	if (!_open || !checkRecords(_header, layout)) return false;
+
+	table.clear();
+	int64_t rawMin[3], rawMax[3];
+	if (!filter.getRawBounds(_header.scale, _header.offset, rawMin, rawMax)) return true;
+
+	const std::size_t numPoints = std::min(count, getNumPoints() - std::min(first, getNumPoints()));
+	if (numPoints == 0) return true;
+	boost::iostreams::mapped_file_source window;
+	const char* records = mapRecords(first, numPoints, window);
+	if (records == nullptr) return false;
+
+	// Only the raw fields are looked at to accept a record.
+	const std::size_t stride = _header.pointRecordLength;
+	auto accepts = [&](const char* rec)
+	{
+		uint8_t returns = readLE<uint8_t>(rec + 14);
+		uint8_t classification, returnNumber, numberOfReturns;
+		if (layout.extended)
+		{
+			returnNumber = returns & 0x0f;
+			numberOfReturns = returns >> 4;
+			classification = readLE<uint8_t>(rec + 16);
+		}
+		else
+		{
+			returnNumber = returns & 0x07;
+			numberOfReturns = (returns >> 3) & 0x07;
+			classification = readLE<uint8_t>(rec + 15) & 0x1f;
+		}
+		if (!filter.acceptsClass(classification) || !filter.acceptsReturn(returnNumber, numberOfReturns)) return false;
+
+		for (int k = 0; k < 3; k++)
+		{
+			int64_t v = readLE<int32_t>(rec + 4 * k);
+			if (v < rawMin[k] || v > rawMax[k]) return false;
+		}
+		return true;
+	};
+
+	// Count the accepted records of each block first, so the table is
+	// allocated once at its final size and each block knows where its rows go.
+	const std::size_t numBlocks = (numPoints + FILTER_BLOCK - 1) / FILTER_BLOCK;
+	std::vector<std::size_t> blockStart(numBlocks + 1, 0);
+	parallelFor(0, numBlocks, [&](std::size_t firstBlock, std::size_t lastBlock)
+	{
+		for (std::size_t b = firstBlock; b < lastBlock; b++)
+		{
+			const std::size_t last = std::min(numPoints, (b + 1) * FILTER_BLOCK);
+			std::size_t count = 0;
+			for (std::size_t i = b * FILTER_BLOCK; i < last; i++)
+			{
+				if (accepts(records + i * stride)) count++;
+			}
+			blockStart[b + 1] = count;
+		}
+	}, 1);
+	for (std::size_t b = 0; b < numBlocks; b++)
+	{
+		blockStart[b + 1] += blockStart[b];
+	}
+
+	table.resize(blockStart[numBlocks]);
+	if (table.empty()) return true;
+
+	const RecordDecoder decoder(_header, layout, center, table);
+	parallelFor(0, numBlocks, [&](std::size_t firstBlock, std::size_t lastBlock)
+	{
+		for (std::size_t b = firstBlock; b < lastBlock; b++)
+		{
+			const std::size_t last = std::min(numPoints, (b + 1) * FILTER_BLOCK);
+			std::size_t row = blockStart[b];
+			for (std::size_t i = b * FILTER_BLOCK; i < last; i++)
+			{
+				const char* rec = records + i * stride;
+				if (accepts(rec)) decoder.decode(rec, row++);
+			}
+		}
+	}, 1);
+
+	return true;
+}
+
+const char* LasFileReader::mapRecords(std::size_t first, std::size_t count, boost::iostreams::mapped_file_source& window) const
+{
+	const uint64_t begin = _header.pointDataOffset + static_cast<uint64_t>(first) * _header.pointRecordLength;
+	if (_file.is_open()) return _file.data() + begin;
+
+	// Windows start on an allocation boundary.
+	const uint64_t aligned = begin - begin % boost::iostreams::mapped_file_source::alignment();
+	const uint64_t length = begin - aligned + static_cast<uint64_t>(count) * _header.pointRecordLength;
+	try
+	{
+		window.open(_path, static_cast<std::size_t>(length), static_cast<boost::iostreams::stream_offset>(aligned));
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Could not map records of " << _path << ": " << e.what() << std::endl;
+		return nullptr;
+	}
+	return window.data() + (begin - aligned);
+}
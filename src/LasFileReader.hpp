@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <osg/Vec3d>
+
+#include "LasPointFilter.hpp"
+#include "LasPointTable.hpp"
+
+// Fields of the LAS public header block that the point decoder needs.
+struct LasHeader
+{
+	uint8_t versionMajor = 0;
+	uint8_t versionMinor = 0;
+	uint16_t headerSize = 0;
+	uint32_t pointDataOffset = 0;
+	uint8_t pointFormat = 0;		// with the LASzip compression bits masked off
+	bool compressed = false;		// LASzip sets bit 7 of the point format byte
+	uint16_t pointRecordLength = 0;
+	uint64_t pointCount = 0;
+
+	double scale[3] = { 1.0, 1.0, 1.0 };
+	double offset[3] = { 0.0, 0.0, 0.0 };
+	double min[3] = { 0.0, 0.0, 0.0 };
+	double max[3] = { 0.0, 0.0, 0.0 };
+
+	// Midpoint of the header bounds, used to recenter the cloud.
+	osg::Vec3d getCenter() const;
+};
+
+//-----------------------------------------------------------------------------
+// LasFileReader
+//    Memory-maps a LAS 1.0-1.4 file and decodes its fixed-stride point
+// records (formats 0-10) straight into a LasPointTable. Records are split into
+// chunks that are decoded in parallel, and each position is recentered on the
+// given center in the same pass. Compressed (LAZ) files are not handled here.
+//
+//    Opened without mapping the records, the reader maps only the records of
+// each read for the duration of that read, so files larger than memory can
+// be decoded a window at a time.
+//-----------------------------------------------------------------------------
+class LasFileReader
+{
+public:
+	LasFileReader(const std::string& path, bool mapRecords = true);
+
+	bool isOpen() const;
+	const LasHeader& getHeader() const;
+
+	// Number of point records actually present in the file.
+	std::size_t getNumPoints() const;
+
+	// Resize the table to the file's point count and fill every column.
+	// Returns false if the file could not be decoded.
+	bool readPoints(LasPointTable& table, const osg::Vec3d& center);
+
+	// Same, for the 'count' records starting at record 'first'.
+	bool readPoints(LasPointTable& table, const osg::Vec3d& center, std::size_t first, std::size_t count);
+
+	// Decode only the records that pass the filter, in file order. Records
+	// are accepted on their raw fields, in parallel, before anything is
+	// converted; the table is sized once to the accepted count.
+	bool readPoints(LasPointTable& table, const osg::Vec3d& center, const LasPointFilter& filter);
+
+	// Same, for the records passing the filter among the 'count' records
+	// starting at record 'first'.
+	bool readPoints(LasPointTable& table, const osg::Vec3d& center, const LasPointFilter& filter,
+		std::size_t first, std::size_t count);
+
+	// Decode only the positions of every record, recentered on 'center'.
+	bool readPositions(std::vector<osg::Vec3>& positions, const osg::Vec3d& center);
+
+	// Parse only the header block, without mapping the point records.
+	static bool ReadHeader(const std::string& path, LasHeader& header);
+
+private:
+	std::string _path;
+	boost::iostreams::mapped_file_source _file;		// the whole file, unless opened without the records
+	uint64_t _fileSize = 0;
+	LasHeader _header;
+	bool _open = false;
+
+	static bool ParseHeader(const char* data, std::size_t size, LasHeader& header);
+
+	// The first of 'count' records starting at record 'first': inside the
+	// whole-file mapping, or else in 'window', mapped here. Null on failure.
+	const char* mapRecords(std::size_t first, std::size_t count, boost::iostreams::mapped_file_source& window) const;
+};
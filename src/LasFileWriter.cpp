@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+#include "LasFileReader.hpp"
+#include "PCVR_Parallel.hpp"
+
+#include "LasFileWriter.hpp"
+
+namespace
+{
+	const std::size_t WRITE_BLOCK = 65536;		// records encoded per write
+	const uint16_t LEGACY_HEADER_SIZE = 227;		// LAS 1.2
+	const uint16_t EXTENDED_HEADER_SIZE = 375;		// LAS 1.4
+	const std::size_t VLR_HEADER_SIZE = 54;
+	const double DEFAULT_SCALE = 0.001;
+
+	template <typename T>
+	T readLE(const char* p)
+	{
+		T value;
+		std::memcpy(&value, p, sizeof(T));
+		return value;
+	}
+
+	template <typename T>
+	void writeLE(char* p, T value)
+	{
+		std::memcpy(p, &value, sizeof(T));
+	}
+
+	// What is carried over from the file the points came from.
+	struct SourceFile
+	{
+		LasHeader header;
+		bool valid = false;
+		uint16_t globalEncoding = 0;
+		std::vector<char> records;		// variable length records, headers included
+		uint32_t numRecords = 0;
+	};
+
+	void readSourceFile(const std::string& path, SourceFile& source)
+	{
+		if (path.empty() || !LasFileReader::ReadHeader(path, source.header)) return;
+		source.valid = true;
+
+		const LasHeader& header = source.header;
+		std::vector<char> prefix(header.pointDataOffset);
+		std::ifstream ifs(path, std::ios::binary);
+		ifs.read(prefix.data(), prefix.size());
+		if (!ifs || prefix.size() < header.headerSize) return;
+
+		// Only the WKT bit (the coordinate system VLR type) and the GPS time type still apply.
+		source.globalEncoding = readLE<uint16_t>(prefix.data() + 6) & 0x11;
+
+		// The LASzip record describes compressed point data, so it stays behind.
+		const uint32_t count = readLE<uint32_t>(prefix.data() + 100);
+		std::size_t offset = header.headerSize;
+		for (uint32_t r = 0; r < count && offset + VLR_HEADER_SIZE <= prefix.size(); r++)
+		{
+			const char* vlr = prefix.data() + offset;
+			const std::size_t length = VLR_HEADER_SIZE + readLE<uint16_t>(vlr + 20);
+			if (offset + length > prefix.size()) break;
+			if (std::strncmp(vlr + 2, "laszip encoded", 16) != 0)
+			{
+				source.records.insert(source.records.end(), vlr, vlr + length);
+				source.numRecords++;
+			}
+			offset += length;
+		}
+	}
+
+	int32_t toRecord(double v, double scale, double offset)
+	{
+		double raw = std::floor((v - offset) / scale + 0.5);
+		return static_cast<int32_t>(std::min(std::max(raw, static_cast<double>(INT32_MIN)), static_cast<double>(INT32_MAX)));
+	}
+}
+
+bool LasFileWriter::Write(const std::string& path, const LasPointTable& table, const osg::Vec3d& origin,
+	const std::string& sourcePath, const std::vector<bool>* removed, const std::vector<osg::Vec4ub>* colors)
+{
+	SourceFile source;
+	readSourceFile(sourcePath, source);
+	double scale[3], offset[3];
+	for (int k = 0; k < 3; k++)
+	{
+		scale[k] = source.valid && source.header.scale[k] > 0.0 ? source.header.scale[k] : DEFAULT_SCALE;
+		offset[k] = source.valid ? source.header.offset[k] : origin[k];
+	}
+	const uint8_t sourceFormat = source.header.pointFormat;
+	const bool hasColor = !source.valid || sourceFormat == 2 || sourceFormat == 3 || sourceFormat == 5 ||
+		sourceFormat == 7 || sourceFormat == 8 || sourceFormat == 10;
+
+	// The rows to write, their bounds, and whether they need the LAS 1.4 fields.
+	std::vector<uint32_t> rows;
+	rows.reserve(table.size());
+	osg::Vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	uint64_t pointsByReturn[15] = {};
+	bool extended = source.valid && sourceFormat >= 6;
+	for (std::size_t i = 0; i < table.size(); i++)
+	{
+		if (removed && (*removed)[i]) continue;
+		rows.push_back(static_cast<uint32_t>(i));
+
+		const osg::Vec3& p = (*table.positions)[i];
+		for (int k = 0; k < 3; k++)
+		{
+			lo[k] = std::min(lo[k], p[k]);
+			hi[k] = std::max(hi[k], p[k]);
+		}
+		const uint8_t r = table.returnNumber[i];
+		if (r >= 1 && r <= 15) pointsByReturn[r - 1]++;
+		if (table.classification[i] > 31 || r > 7 || table.numberOfReturns[i] > 7) extended = true;
+	}
+	if (rows.size() > UINT32_MAX) extended = true;
+	if (rows.empty()) lo = hi = osg::Vec3();
+
+	const uint8_t format = extended ? (hasColor ? 7 : 6) : (hasColor ? 2 : 0);
+	const uint16_t recordLength = extended ? (hasColor ? 36 : 30) : (hasColor ? 26 : 20);
+	const int rgbOffset = extended ? 30 : 20;
+	const uint16_t headerSize = extended ? EXTENDED_HEADER_SIZE : LEGACY_HEADER_SIZE;
+
+	std::ofstream ofs(path, std::ios::binary);
+	if (!ofs)
+	{
+		std::cout << "Could not write " << path << std::endl;
+		return false;
+	}
+
+	// Public header block.
+	std::vector<char> header(headerSize, 0);
+	char* h = header.data();
+	std::memcpy(h, "LASF", 4);
+	writeLE<uint16_t>(h + 6, source.globalEncoding);
+	h[24] = 1;
+	h[25] = extended ? 4 : 2;
+	std::strncpy(h + 26, "EDIT", 32);
+	std::strncpy(h + 58, "PointCloudsVR", 32);
+	std::time_t now = std::time(nullptr);
+	std::tm* date = std::localtime(&now);
+	writeLE<uint16_t>(h + 90, static_cast<uint16_t>(date->tm_yday + 1));
+	writeLE<uint16_t>(h + 92, static_cast<uint16_t>(date->tm_year + 1900));
+	writeLE<uint16_t>(h + 94, headerSize);
+	writeLE<uint32_t>(h + 96, static_cast<uint32_t>(headerSize + source.records.size()));
+	writeLE<uint32_t>(h + 100, source.numRecords);
+	h[104] = format;
+	writeLE<uint16_t>(h + 105, recordLength);
+	if (!extended)
+	{
+		writeLE<uint32_t>(h + 107, static_cast<uint32_t>(rows.size()));
+		for (int r = 0; r < 5; r++)
+		{
+			writeLE<uint32_t>(h + 111 + 4 * r, static_cast<uint32_t>(pointsByReturn[r]));
+		}
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		writeLE<double>(h + 131 + 8 * k, scale[k]);
+		writeLE<double>(h + 155 + 8 * k, offset[k]);
+		writeLE<double>(h + 179 + 16 * k, toRecord(origin[k] + hi[k], scale[k], offset[k]) * scale[k] + offset[k]);
+		writeLE<double>(h + 187 + 16 * k, toRecord(origin[k] + lo[k], scale[k], offset[k]) * scale[k] + offset[k]);
+	}
+	if (extended)
+	{
+		writeLE<uint64_t>(h + 247, rows.size());
+		for (int r = 0; r < 15; r++)
+		{
+			writeLE<uint64_t>(h + 255 + 8 * r, pointsByReturn[r]);
+		}
+	}
+	ofs.write(header.data(), header.size());
+	ofs.write(source.records.data(), source.records.size());
+
+	// Point records.
+	std::vector<char> buffer(WRITE_BLOCK * recordLength);
+	for (std::size_t first = 0; first < rows.size(); first += WRITE_BLOCK)
+	{
+		const std::size_t count = std::min(WRITE_BLOCK, rows.size() - first);
+		std::fill(buffer.begin(), buffer.begin() + count * recordLength, 0);
+		parallelFor(0, count, [&](std::size_t begin, std::size_t end)
+		{
+			for (std::size_t j = begin; j < end; j++)
+			{
+				const uint32_t i = rows[first + j];
+				char* rec = buffer.data() + j * recordLength;
+				const osg::Vec3& p = (*table.positions)[i];
+				for (int k = 0; k < 3; k++)
+				{
+					writeLE<int32_t>(rec + 4 * k, toRecord(origin[k] + p[k], scale[k], offset[k]));
+				}
+				writeLE<uint16_t>(rec + 12, table.intensity[i]);
+				if (extended)
+				{
+					rec[14] = static_cast<char>((table.returnNumber[i] & 0x0f) | (table.numberOfReturns[i] << 4));
+					rec[16] = static_cast<char>(table.classification[i]);
+				}
+				else
+				{
+					rec[14] = static_cast<char>((table.returnNumber[i] & 0x07) | ((table.numberOfReturns[i] & 0x07) << 3));
+					rec[15] = static_cast<char>(table.classification[i] & 0x1f);
+				}
+				if (hasColor)
+				{
+					// 255 widens to 65535.
+					const osg::Vec4ub& c = colors ? (*colors)[i] : (*table.colors)[i];
+					for (int k = 0; k < 3; k++)
+					{
+						writeLE<uint16_t>(rec + rgbOffset + 2 * k, static_cast<uint16_t>(c[k] * 257));
+					}
+				}
+			}
+		}, 4096);
+		ofs.write(buffer.data(), count * recordLength);
+	}
+
+	if (!ofs)
+	{
+		std::cout << "Could not write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
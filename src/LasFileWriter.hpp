@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <osg/Vec3d>
+
+#include "LasPointTable.hpp"
+
+//-----------------------------------------------------------------------------
+// LasFileWriter
+//    Writes the rows of a LasPointTable as an uncompressed LAS file, e.g. a
+// cloud after points were deleted from it. Positions are stored with the
+// scale and offset of the file the points came from, so unedited points
+// keep their exact coordinates, and that file's variable length records
+// (the coordinate system among them) are copied over.
+//
+//    Points go out as LAS 1.2 format 2, or 1.4 format 7 when a classification
+// or return number does not fit the legacy fields; formats 0 and 6 if the
+// source carried no color. Colors are widened from 8 to 16 bits per channel.
+// Records are encoded in parallel, a block at a time.
+//
+//    Only the table's columns are written: position, intensity, return
+// number and count, classification and color. The table keeps no link from
+// its rows to the source records (loading may filter, decimate or decompress
+// them), so every other field of the source records (GPS time, scan angle,
+// user data, point source ID, scan direction and edge flags, extra bytes) is
+// lost and written as zero.
+//-----------------------------------------------------------------------------
+class LasFileWriter
+{
+public:
+	// 'origin' is the source position of the table's local origin and
+	// 'sourcePath' the LAS or LAZ file the table was read from; without a
+	// readable source the positions are stored in millimeters around the
+	// origin. Rows flagged in 'removed', if given, are left out. 'colors', if
+	// given, are written instead of the table's color column, e.g. the source
+	// colors while the table shows a palette.
+	static bool Write(const std::string& path, const LasPointTable& table, const osg::Vec3d& origin,
+		const std::string& sourcePath, const std::vector<bool>* removed = nullptr,
+		const std::vector<osg::Vec4ub>* colors = nullptr);
+};
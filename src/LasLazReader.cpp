@@ -0,0 +1,285 @@
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#ifdef PCVR_USE_LASZIP
+#include <laszip/laszip_api.h>
+#endif
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasLazReader.hpp"
+
+namespace
+{
+	template <typename T>
+	T readLE(const char* p)
+	{
+		T value;
+		std::memcpy(&value, p, sizeof(T));
+		return value;
+	}
+
+	const std::size_t VLR_HEADER_SIZE = 54;
+	const uint16_t LASZIP_RECORD_ID = 22204;
+	const uint32_t VARIABLE_CHUNK_SIZE = 0xffffffff;
+	const std::size_t SEQUENTIAL_PROGRESS_STEP = 50000;	// points between progress reports without a chunk table
+
+#ifdef PCVR_USE_LASZIP
+	// One LASzip reader per decoding thread; they are reused across chunks.
+	struct LazHandle
+	{
+		laszip_POINTER reader = nullptr;
+		laszip_point* point = nullptr;
+	};
+
+	class LazHandlePool
+	{
+	public:
+		LazHandlePool(const std::string& path) : _path(path) {}
+
+		~LazHandlePool()
+		{
+			for (LazHandle& h : _free)
+			{
+				laszip_close_reader(h.reader);
+				laszip_destroy(h.reader);
+			}
+		}
+
+		bool acquire(LazHandle& handle)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_free.empty())
+				{
+					handle = _free.back();
+					_free.pop_back();
+					return true;
+				}
+			}
+
+			laszip_BOOL compressed = 0;
+			if (laszip_create(&handle.reader)) return false;
+			if (laszip_open_reader(handle.reader, _path.c_str(), &compressed) ||
+				laszip_get_point_pointer(handle.reader, &handle.point))
+			{
+				laszip_CHAR* error = nullptr;
+				laszip_get_error(handle.reader, &error);
+				std::cout << "LASzip could not open " << _path << ": " << (error ? error : "unknown error") << std::endl;
+				laszip_destroy(handle.reader);
+				return false;
+			}
+			return true;
+		}
+
+		void release(const LazHandle& handle)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_free.push_back(handle);
+		}
+
+	private:
+		std::string _path;
+		std::mutex _mutex;
+		std::vector<LazHandle> _free;
+	};
+
+	// Decode points [first, last) with one reader, which must be positioned at 'first'.
+	bool decodeRange(const LazHandle& handle, const LasHeader& header, const osg::Vec3d& center,
+		LasPointTable& table, std::size_t first, std::size_t last)
+	{
+		const bool extended = header.pointFormat >= 6;
+		const bool hasColor = header.pointFormat == 2 || header.pointFormat == 3 || header.pointFormat == 5 ||
+			header.pointFormat == 7 || header.pointFormat == 8 || header.pointFormat == 10;
+		const double bias[3] = { header.offset[0] - center.x(), header.offset[1] - center.y(), header.offset[2] - center.z() };
+
+		osg::Vec3* verts = &table.positions->front();
+		osg::Vec4ub* colors = &table.colors->front();
+		const laszip_point* p = handle.point;
+
+		for (std::size_t i = first; i < last; i++)
+		{
+			if (laszip_read_point(handle.reader)) return false;
+
+			verts[i].set(p->X * header.scale[0] + bias[0],
+				p->Y * header.scale[1] + bias[1],
+				p->Z * header.scale[2] + bias[2]);
+
+			table.intensity[i] = p->intensity;
+			if (extended)
+			{
+				table.returnNumber[i] = p->extended_return_number;
+				table.numberOfReturns[i] = p->extended_number_of_returns;
+				table.classification[i] = p->extended_classification;
+			}
+			else
+			{
+				table.returnNumber[i] = p->return_number;
+				table.numberOfReturns[i] = p->number_of_returns;
+				table.classification[i] = p->classification;
+			}
+
+			if (hasColor)
+			{
+				colors[i].set(p->rgb[0] >> 8, p->rgb[1] >> 8, p->rgb[2] >> 8, 255);
+			}
+			else
+			{
+				colors[i].set(0, 0, 0, 255);
+			}
+		}
+		return true;
+	}
+#endif
+}
+
+LasLazReader::LasLazReader(const std::string& path)
+	: _path(path)
+{
+	if (!LasFileReader::ReadHeader(path, _header) || !_header.compressed)
+	{
+		std::cout << path << " is not a readable LAZ file." << std::endl;
+		return;
+	}
+
+	_open = readChunkSize();
+	if (!_open)
+	{
+		std::cout << path << " has no LASzip record." << std::endl;
+	}
+}
+
+bool LasLazReader::isSupported()
+{
+#ifdef PCVR_USE_LASZIP
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool LasLazReader::isOpen() const
+{
+	return _open;
+}
+
+const LasHeader& LasLazReader::getHeader() const
+{
+	return _header;
+}
+
+std::size_t LasLazReader::getNumPoints() const
+{
+	return _open ? static_cast<std::size_t>(_header.pointCount) : 0;
+}
+
+uint32_t LasLazReader::getChunkSize() const
+{
+	return _chunkSize;
+}
+
+bool LasLazReader::readChunkSize()
+{
+	// The chunk size lives in the LASzip VLR, among the VLRs that follow the
+	// public header block.
+	std::ifstream ifs(_path, std::ios::binary);
+	if (!ifs) return false;
+
+	char count[4];
+	ifs.seekg(100);
+	if (!ifs.read(count, sizeof(count))) return false;
+	uint32_t numVlrs = readLE<uint32_t>(count);
+
+	ifs.seekg(_header.headerSize);
+	for (uint32_t v = 0; v < numVlrs; v++)
+	{
+		char vlr[VLR_HEADER_SIZE];
+		if (!ifs.read(vlr, VLR_HEADER_SIZE)) return false;
+		uint16_t recordId = readLE<uint16_t>(vlr + 18);
+		uint16_t length = readLE<uint16_t>(vlr + 20);
+
+		if (std::strncmp(vlr + 2, "laszip encoded", 16) == 0 && recordId == LASZIP_RECORD_ID && length >= 16)
+		{
+			char record[16];
+			if (!ifs.read(record, sizeof(record))) return false;
+			uint32_t chunkSize = readLE<uint32_t>(record + 12);
+			_chunkSize = chunkSize == VARIABLE_CHUNK_SIZE ? 0 : chunkSize;
+			return true;
+		}
+		ifs.seekg(length, std::ios::cur);
+	}
+	return false;
+}
+
+bool LasLazReader::readPoints(LasPointTable& table, const osg::Vec3d& center, ProgressCallback progress)
+{
+	const std::size_t numPoints = getNumPoints();
+	if (table.size() != numPoints) return false;
+	if (numPoints == 0) return true;
+
+#ifdef PCVR_USE_LASZIP
+	LazHandlePool pool(_path);
+
+	if (_chunkSize == 0)
+	{
+		LazHandle handle;
+		if (!pool.acquire(handle)) return false;
+
+		bool ok = true;
+		for (std::size_t first = 0; ok && first < numPoints; first += SEQUENTIAL_PROGRESS_STEP)
+		{
+			std::size_t last = std::min(first + SEQUENTIAL_PROGRESS_STEP, numPoints);
+			ok = decodeRange(handle, _header, center, table, first, last);
+			if (ok && progress) progress(last);
+		}
+		pool.release(handle);
+		if (!ok) std::cout << "LASzip failed to decode " << _path << std::endl;
+		return ok;
+	}
+
+	// Chunks finish out of order; report only the prefix that is complete.
+	const std::size_t numChunks = (numPoints + _chunkSize - 1) / _chunkSize;
+	std::vector<char> chunkDone(numChunks, 0);
+	std::size_t donePrefix = 0;
+	std::mutex progressMutex;
+	std::atomic<bool> failed(false);
+
+	parallelFor(0, numChunks, [&](std::size_t firstChunk, std::size_t lastChunk)
+	{
+		LazHandle handle;
+		if (failed || !pool.acquire(handle))
+		{
+			failed = true;
+			return;
+		}
+
+		for (std::size_t c = firstChunk; c < lastChunk && !failed; c++)
+		{
+			std::size_t first = c * _chunkSize;
+			std::size_t last = std::min(first + _chunkSize, numPoints);
+			if (laszip_seek_point(handle.reader, first) || !decodeRange(handle, _header, center, table, first, last))
+			{
+				failed = true;
+				break;
+			}
+
+			std::lock_guard<std::mutex> lock(progressMutex);
+			chunkDone[c] = 1;
+			std::size_t prefix = donePrefix;
+			while (donePrefix < numChunks && chunkDone[donePrefix]) donePrefix++;
+			if (progress && donePrefix != prefix) progress(std::min(donePrefix * _chunkSize, numPoints));
+		}
+		pool.release(handle);
+	}, 1);
+
+	if (failed) std::cout << "LASzip failed to decode " << _path << std::endl;
+	return !failed;
+#else
+	std::cout << "Built without LASzip; cannot decode " << _path << std::endl;
+	return false;
+#endif
+}
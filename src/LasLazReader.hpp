@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <osg/Vec3d>
+
+#include "LasFileReader.hpp"
+#include "LasPointTable.hpp"
+
+//-----------------------------------------------------------------------------
+// LasLazReader
+//    Decodes LASzip-compressed (LAZ) files through the LASzip DLL API. LASzip
+// compresses the points in independent chunks (50000 points by default) and
+// stores a chunk table, so a reader can seek to any chunk start without
+// decoding what comes before it. Chunks are decoded in parallel, each thread
+// with its own LASzip reader, straight into their rows of the LasPointTable.
+//
+//    Files written with variable-size chunks have no fixed chunk start to seek
+// to and are decoded by one thread.
+//
+//    Only available when built with LASzip (PCVR_USE_LASZIP); otherwise
+// isSupported() is false and LAZ files go through liblas.
+//-----------------------------------------------------------------------------
+class LasLazReader
+{
+public:
+	// Called with the number of leading points that are fully decoded, each
+	// time that number grows. Runs on the decoding threads.
+	typedef std::function<void(std::size_t)> ProgressCallback;
+
+	LasLazReader(const std::string& path);
+
+	static bool isSupported();
+
+	bool isOpen() const;
+	const LasHeader& getHeader() const;
+	std::size_t getNumPoints() const;
+
+	// Points per chunk, or 0 if the file uses variable-size chunks.
+	uint32_t getChunkSize() const;
+
+	// Decode every point into the table, which must already hold
+	// getNumPoints() rows. Positions are recentered on 'center'.
+	bool readPoints(LasPointTable& table, const osg::Vec3d& center, ProgressCallback progress = nullptr);
+
+private:
+	std::string _path;
+	LasHeader _header;
+	uint32_t _chunkSize = 0;
+	bool _open = false;
+
+	bool readChunkSize();
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "LasPointFilter.hpp"
+
+class LasOctreeBudget;
+
+// Command line settings that control how LasModelScene loads its LAS data.
+struct LasLoadOptions
+{
+	// Octree LOD (used when --data names an octree.json written by --buildOctree)
+	std::size_t pointBudget = 5000000;		// most points drawn per frame
+	std::size_t cacheBudget = 20000000;		// most points kept paged in
+	float screenSpaceError = 2.0f;			// refine nodes whose point spacing projects larger (pixels)
+	std::shared_ptr<LasOctreeBudget> octreeBudget;	// the two budgets, shared by every octree loaded with these options
+
+	// Statistical outlier removal of each LAS file as it loads (0 neighbors = off)
+	unsigned int outlierNeighbors = 0;		// k nearest neighbors per point
+	float outlierSigma = 2.0f;				// drop points whose mean neighbor distance is this many std devs above the mean
+
+	// Voxel-grid downsampling of each LAS file as it loads (0 = off)
+	float voxelSize = 0.0f;					// keep one point per voxel of this size
+	std::size_t maxPoints = 0;				// pick the voxel size that keeps at most this many points
+
+	// Out-of-core loading: an uncompressed LAS file whose points would take more
+	// memory than this is streamed a window at a time and decimated as it goes (0 = off)
+	std::size_t memoryBudget = 0;			// bytes
+
+	// Points rejected while decoding, before they are stored (--lasClasses, --lasReturns, --lasBounds)
+	LasPointFilter filter;
+};
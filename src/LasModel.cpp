@@ -1,134 +1,1056 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+#include <osg/AlphaFunc>
+#include <osg/CullStack>
+#include <osg/Depth>
 #include <osg/MatrixTransform>
+#include <osg/Point>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 
+#include "LasDecimator.hpp"
+#include "LasFileReader.hpp"
+#include "LasFileWriter.hpp"
+#include "LasLazReader.hpp"
+#include "LasOctreeGroup.hpp"
+#include "LasOutlierFilter.hpp"
+#include "LasPointCache.hpp"
+#include "PCVR_Parallel.hpp"
 #include "PCVR_OvrDevice.hpp"
 
 #include "LasModel.hpp"
 
-ModelPoint::ModelPoint(liblas::Point const& p, int index, LasModel* parent)
-	: liblas::Point(p)
-	, _index(index)
-	, _parent(parent)
+namespace
 {
+	const float FEATURE_START_RADIUS = 5.0f;		// first region around the eye, in model units
+	const float FEATURE_MAX_RADIUS = 1e7f;
+	const std::size_t FEATURE_BATCH = 65536;		// points per published batch
+	const std::size_t CHANGE_NORMAL_BATCH = 1 << 20;	// points per normal batch before measuring change
+	const std::chrono::seconds COMPACT_DELAY(3);		// quiet time after a deletion before compacting
+
+	// Memory of one point table row, and a rough allowance for the working
+	// memory voxelDownsample needs per input point (keys, voxels, the output).
+	const std::size_t TABLE_ROW_BYTES = sizeof(osg::Vec3) + sizeof(osg::Vec4ub) + sizeof(uint16_t) + 3;
+	const std::size_t DECIMATE_BYTES_PER_POINT = 96;
+	const std::size_t MIN_STREAM_POINTS = 100000;		// smallest useful chunk
+
+	// Draws the decoded prefix of a table that is still being filled in. Only
+	// the rows decoded since the last frame are uploaded; the rest of the
+	// arrays is still being written.
+	class StreamedPointsCallback : public osg::Drawable::UpdateCallback
+	{
+	public:
+		StreamedPointsCallback(std::shared_ptr<std::atomic<std::size_t>> streamed, osg::DrawArrays* points,
+			LasColorizer* colorizer, std::size_t numPoints)
+			: _streamed(streamed), _points(points), _colorizer(colorizer), _numPoints(numPoints)
+		{
+		}
+
+		virtual void update(osg::NodeVisitor* nv, osg::Drawable* drawable)
+		{
+			std::size_t count = _streamed->load();
+			std::size_t drawn = static_cast<std::size_t>(_points->getCount());
+			if (count == drawn) return;
+
+			_colorizer->markRowsDirty(drawn, count);
+			_points->setCount(static_cast<GLsizei>(count));
+			_points->dirty();
+			if (count == _numPoints) drawable->setCullingActive(true);
+		}
+
+	private:
+		std::shared_ptr<std::atomic<std::size_t>> _streamed;
+		osg::ref_ptr<osg::DrawArrays> _points;
+		osg::ref_ptr<LasColorizer> _colorizer;
+		std::size_t _numPoints;
+	};
+
+	// Records where the points are seen from, for the background feature thread.
+	class EyePointCallback : public osg::Drawable::CullCallback
+	{
+	public:
+		EyePointCallback(std::shared_ptr<LasEyePoint> eye) : _eye(eye) {}
+
+		virtual bool cull(osg::NodeVisitor* nv, osg::Drawable* drawable, osg::RenderInfo* renderInfo) const
+		{
+			osg::CullStack* cullStack = dynamic_cast<osg::CullStack*>(nv);
+			if (cullStack)
+			{
+				std::lock_guard<std::mutex> lock(_eye->mutex);
+				_eye->position = cullStack->getEyeLocal();
+				_eye->valid = true;
+			}
+			return false;
+		}
+
+	private:
+		std::shared_ptr<LasEyePoint> _eye;
+	};
+
+	// Bounds known up front (from the LAS header or the point cache), so the
+	// geometry never scans its vertices for them.
+	class FixedBoundsCallback : public osg::Drawable::ComputeBoundingBoxCallback
+	{
+	public:
+		FixedBoundsCallback(const osg::BoundingBox& bounds) : _bounds(bounds) {}
+
+		virtual osg::BoundingBox computeBound(const osg::Drawable&) const
+		{
+			return _bounds;
+		}
+
+	private:
+		osg::BoundingBox _bounds;
+	};
 }
 
-osg::Vec3 ModelPoint::getPos() const
+LasModel::LasModel(const std::string& path, const LasLoadOptions& options)
+	: OpenFrames::Model(osgDB::getSimpleFileName(path), 0.5, 0.5, 0.5, 0.9)
+	, _options(options)
+	, _path(path)
+	, _streamedPoints(std::make_shared<std::atomic<std::size_t>>(0))
+	, _releaseStream(false)
+	, _eye(std::make_shared<LasEyePoint>())
+	, _stopFeatures(false)
+	, _compactDone(false)
 {
-	return _parent->_verts->at(_index);
+	_colorizer = new LasColorizer(_table);
+	_colorizer->setFeatures(&_features);
+	_colorizer->setHidden(&_deleted);
 }
 
-osg::Vec4 ModelPoint::getColor() const
+LasModel::~LasModel()
 {
-	return _parent->_colors->at(_index);
+	if (_compactThread.joinable()) _compactThread.join();
+	stopFeatureThread();
+	finishStreaming();
 }
 
-void ModelPoint::setPos(osg::Vec3 pos)
+void LasModel::setOrigin(const osg::Vec3d& origin)
 {
-	_parent->_verts->at(_index).set(pos);
+	_origin = origin;
+	_hasOrigin = true;
 }
 
-void ModelPoint::setColor(osg::Vec4 color)
+const osg::Vec3d& LasModel::getOrigin() const
 {
-	_parent->_colors->at(_index) = color;
+	return _origin;
 }
 
-LasModel::LasModel(const std::string& path)
-	: OpenFrames::Model(osgDB::getSimpleFileName(path), 0.5, 0.5, 0.5, 0.9)
+bool LasModel::load()
+{
+	if (LasOctree::IsOctreeIndex(_path))
+	{
+		return loadOctree(_path);
+	}
+	return loadLasFile(_path);
+}
+
+const std::string& LasModel::getPath() const
+{
+	return _path;
+}
+
+bool LasModel::ReadSourceBounds(const std::string& path, osg::BoundingBoxd& bounds)
+{
+	std::string fileName = osgDB::findDataFile(path);
+	if (fileName.empty()) return false;
+
+	if (LasOctree::IsOctreeIndex(fileName))
+	{
+		LasOctree octree(fileName);
+		if (!octree.isOpen()) return false;
+		const osg::BoundingBox& cube = octree.getNodes()[0].bounds;
+		bounds.expandBy(octree.getCenter() + osg::Vec3d(cube._min));
+		bounds.expandBy(octree.getCenter() + osg::Vec3d(cube._max));
+		return true;
+	}
+
+	LasHeader header;
+	if (!LasFileReader::ReadHeader(fileName, header)) return false;
+	bounds.expandBy(osg::Vec3d(header.min[0], header.min[1], header.min[2]));
+	bounds.expandBy(osg::Vec3d(header.max[0], header.max[1], header.max[2]));
+	return true;
+}
+
+bool LasModel::isOctree() const
+{
+	return _isOctree;
+}
+
+bool LasModel::isLoaded() const
 {
-	loadLasFile(path);
+	return _streamedPoints->load() == _table.size();
 }
 
-std::vector<ModelPoint*>& LasModel::getPoints()
+void LasModel::finishStreaming() const
 {
-	return _points;
+	_releaseStream = true;
+	if (_streamThread.joinable()) _streamThread.join();
 }
 
-osg::Vec4Array& LasModel::getColors()
+LasPointTable& LasModel::getPointTable()
 {
-	return *_colors;
+	finishStreaming();
+	return _table;
 }
 
-void LasModel::loadLasFile(const std::string& path)
+const LasPointTable& LasModel::getPointTable() const
+{
+	finishStreaming();
+	return _table;
+}
+
+osg::Vec4ubArray& LasModel::getColors()
+{
+	finishStreaming();
+	return *_table.colors;
+}
+
+void LasModel::recolor(LasColorMode mode)
+{
+	finishStreaming();
+	if (_compactThread.joinable())
+	{
+		// The compaction stopped the feature thread; it restarts by the new mode.
+		_resumeFeatures = isFeatureColorMode(mode);
+	}
+	else if (isFeatureColorMode(mode))
+	{
+		startFeatureThread();
+	}
+	else
+	{
+		stopFeatureThread();
+	}
+
+	// A full recolor covers every point computed so far.
+	_features.takeNewlyComputed();
+	std::lock_guard<std::mutex> lock(_features.getMutex());
+	_colorizer->recolor(mode);
+}
+
+LasColorizer& LasModel::getColorizer()
+{
+	return *_colorizer;
+}
+
+const PCVR_PointGrid& LasModel::getPointGrid()
+{
+	finishStreaming();
+	if (!_grid.isBuilt()) _grid.build(_table.positions.get());
+	return _grid;
+}
+
+const LasPointFeatures& LasModel::getFeatures() const
+{
+	return _features;
+}
+
+void LasModel::computeFeatures(const std::vector<unsigned int>& indices)
+{
+	std::lock_guard<std::mutex> lock(_featureRequestMutex);
+	_featureRequests.insert(_featureRequests.end(), indices.begin(), indices.end());
+}
+
+void LasModel::updateFeatureColors()
+{
+	if (!isFeatureColorMode(_colorizer->getMode())) return;
+
+	// A running compaction has the feature thread stopped; it resumes afterwards.
+	bool requested;
+	{
+		std::lock_guard<std::mutex> lock(_featureRequestMutex);
+		requested = !_featureRequests.empty();
+	}
+	if (requested && !_compactThread.joinable()) startFeatureThread();
+
+	std::vector<unsigned int> indices = _features.takeNewlyComputed();
+	if (indices.empty()) return;
+	std::lock_guard<std::mutex> lock(_features.getMutex());
+	_colorizer->recolorPoints(indices);
+}
+
+bool LasModel::measureChange(const LasChangeDetector& detector)
+{
+	finishStreaming();
+	cancelCompaction();
+	if (_table.empty()) return false;
+
+	const std::size_t n = _table.size();
+	if (detector.usesNormals())
+	{
+		// In batches, so the index lists stay small next to the table.
+		std::cout << "Computing normals of " << n << " points..." << std::endl;
+		std::vector<unsigned int> batch;
+		for (std::size_t first = 0; first < n; first += CHANGE_NORMAL_BATCH)
+		{
+			batch.resize(std::min(CHANGE_NORMAL_BATCH, n - first));
+			std::iota(batch.begin(), batch.end(), static_cast<unsigned int>(first));
+			_features.compute(_table, batch);
+			_features.takeNewlyComputed();
+		}
+	}
+
+	detector.measure(_table, _features.normal, _change);
+
+	// Full color at the 95th percentile, so a few gross outliers do not wash out the rest.
+	std::vector<float> magnitude;
+	magnitude.reserve(n);
+	for (float d : _change)
+	{
+		if (!std::isnan(d)) magnitude.push_back(std::abs(d));
+	}
+	float scale = 0.0f;
+	if (!magnitude.empty())
+	{
+		std::size_t k = magnitude.size() * 95 / 100;
+		std::nth_element(magnitude.begin(), magnitude.begin() + k, magnitude.end());
+		scale = magnitude[k];
+	}
+	std::cout << "Measured change of " << magnitude.size() << " of " << n << " points, 95th percentile "
+		<< scale << std::endl;
+
+	_colorizer->setChange(&_change, scale);
+	return true;
+}
+
+const std::vector<float>& LasModel::getChange() const
+{
+	return _change;
+}
+
+osg::Matrixd LasModel::getModelMatrix() const
+{
+	osg::Matrix matrix;
+	_modelXform->computeLocalToWorldMatrix(matrix, nullptr);
+	return matrix;
+}
+
+void LasModel::setModelMatrix(const osg::Matrixd& matrix)
+{
+	// The model transform draws a point p at position + attitude * (p - pivot).
+	const osg::Quat attitude = matrix.getRotate();
+	osg::Vec3d pivot;
+	getModelPivot(pivot[0], pivot[1], pivot[2]);
+	const osg::Vec3d position = matrix.getTrans() + attitude * pivot;
+	setModelAttitude(attitude);
+	setModelPositionOffset(position[0], position[1], position[2]);
+}
+
+bool LasModel::registerTo(LasModel& target, const LasRegistrationOptions& options, osg::Matrixd& matrix,
+	LasRegistrationResult& result)
+{
+	finishStreaming();
+	target.finishStreaming();
+	cancelCompaction();
+	target.cancelCompaction();
+	if (_table.empty() || target._table.empty()) return false;
+
+	// Register in the target's model coordinates, where its kd-tree lives.
+	const osg::Matrixd targetMatrix = target.getModelMatrix();
+	osg::Matrixd transform = getModelMatrix() * osg::Matrixd::inverse(targetMatrix);
+	LasRegistration registration(options);
+	if (!registration.align(_table, target._table, target._features, transform, result)) return false;
+
+	matrix = transform * targetMatrix;
+	return true;
+}
+
+void LasModel::startFeatureThread()
+{
+	if (_featureThread.joinable() || _table.empty()) return;
+
+	// The grid is built here, not on the worker, since tools share it.
+	getPointGrid();
+	_stopFeatures = false;
+	unsigned int budget = std::max(1u, threadBudget() - 1);	// leave a core for drawing
+	_featureThread = std::thread([this, budget]()
+	{
+		threadBudget() = budget;
+		computeFeaturesNearEye();
+	});
+}
+
+void LasModel::stopFeatureThread()
+{
+	if (!_featureThread.joinable()) return;
+	_stopFeatures = true;
+	_featureThread.join();
+}
+
+void LasModel::computeFeaturesNearEye()
+{
+	const std::size_t n = _table.size();
+	const osg::Vec3* verts = &_table.positions->front();
+	osg::Vec3 center;
+	float radius = 0.0f;
+	std::vector<unsigned int> region;	// points of the current sphere still to compute, nearest first
+	std::size_t next = 0;
+	while (!_stopFeatures && _features.getNumComputed() < n && radius < FEATURE_MAX_RADIUS)
+	{
+		// Points asked for (e.g. a selection) come before the region around the viewer.
+		std::vector<unsigned int> requested;
+		{
+			std::lock_guard<std::mutex> lock(_featureRequestMutex);
+			requested.swap(_featureRequests);
+		}
+		if (!requested.empty())
+		{
+			_features.compute(_table, requested);
+			continue;
+		}
+
+		osg::Vec3 eye;
+		bool seen;
+		{
+			std::lock_guard<std::mutex> lock(_eye->mutex);
+			eye = _eye->position;
+			seen = _eye->valid;
+		}
+		if (!seen)
+		{
+			// Not drawn yet; wait for the first frame to know where the viewer is.
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			continue;
+		}
+
+		// Start over around the viewer once it leaves the middle of the region;
+		// otherwise grow the region when it is done.
+		bool moved = radius == 0.0f || (eye - center).length() > radius * 0.5f;
+		if (moved || next == region.size())
+		{
+			if (moved)
+			{
+				center = eye;
+				radius = FEATURE_START_RADIUS;
+			}
+			else
+			{
+				radius *= 2.0f;
+			}
+			_grid.querySphere(center, radius, region);
+			{
+				std::lock_guard<std::mutex> lock(_features.getMutex());
+				region.erase(std::remove_if(region.begin(), region.end(),
+					[this](unsigned int i) { return _features.computed[i] != 0; }), region.end());
+			}
+			std::sort(region.begin(), region.end(), [&](unsigned int a, unsigned int b)
+			{
+				return (verts[a] - center).length2() < (verts[b] - center).length2();
+			});
+			next = 0;
+			continue;
+		}
+
+		std::size_t last = std::min(next + FEATURE_BATCH, region.size());
+		_features.compute(_table, std::vector<unsigned int>(region.begin() + next, region.begin() + last));
+		next = last;
+	}
+}
+
+bool LasModel::loadLasFile(const std::string& path)
 {
 	// Open file and create reader
 	std::string fileName = osgDB::findDataFile(path);
-	if (fileName.empty()) return;
+	if (fileName.empty()) return false;
 
 	std::cout << "Reading file " << fileName << "..." << std::endl;
 
+	// A cache from an earlier launch skips decoding entirely.
+	LasHeader header;
+	const bool hasHeader = LasFileReader::ReadHeader(fileName, header);
+	if (hasHeader)
+	{
+		if (!_hasOrigin) _origin = header.getCenter();
+
+		osg::BoundingBoxd sourceBounds(osg::Vec3d(header.min[0], header.min[1], header.min[2]),
+			osg::Vec3d(header.max[0], header.max[1], header.max[2]));
+		if (!_options.filter.overlaps(sourceBounds))
+		{
+			std::cout << fileName << " lies outside --lasBounds" << std::endl;
+			return false;
+		}
+
+		// The cache holds every point too, so a file over the budget skips it.
+		if (_options.memoryBudget > 0 && header.pointCount * TABLE_ROW_BYTES > _options.memoryBudget)
+		{
+			if (!header.compressed) return loadLasFileStreaming(fileName);
+			std::cout << "Only uncompressed LAS can be streamed; reading all of " << fileName << std::endl;
+		}
+
+		osg::BoundingBox bounds;
+		if (LasPointCache::Read(fileName, _origin, _table, bounds))
+		{
+			std::cout << "Read " << _table.size() << " points from " << LasPointCache::GetCachePath(fileName) << std::endl;
+			// Filtering may drop the points that set the cached bounds.
+			bool filtered = _options.filter.apply(_table, _origin) > 0;
+			filtered = applyLoadFilters() || filtered;
+			*_streamedPoints = _table.size();
+			setupGeometry(filtered ? nullptr : &bounds);
+			return true;
+		}
+	}
+
+	// Uncompressed LAS goes through the memory-mapped parallel decoder and LAZ
+	// through the chunk-parallel LASzip decoder; anything they cannot handle
+	// falls back to liblas. Only the LAS decoder applies the point filter as
+	// it decodes; the others read every point and filter afterwards.
+	std::size_t numRecords = 0;
+	bool complete = true;		// the table holds every point of the file
+	LasFileReader reader(fileName);
+	if (reader.isOpen() && !reader.getHeader().compressed)
+	{
+		if (!_hasOrigin) _origin = reader.getHeader().getCenter();
+		numRecords = reader.getNumPoints();
+		if (!reader.readPoints(_table, _origin, _options.filter)) return false;
+		complete = !_options.filter.isActive();
+	}
+	else if (reader.isOpen() && LasLazReader::isSupported())
+	{
+		// Filters need every point first, so only an unfiltered LAZ streams.
+		if (!hasLoadFilters() && !_options.filter.isActive()) return loadLazFile(fileName);
+
+		LasLazReader lazReader(fileName);
+		if (!lazReader.isOpen()) return false;
+		if (!_hasOrigin) _origin = lazReader.getHeader().getCenter();
+		_table.resize(lazReader.getNumPoints());
+		if (!lazReader.readPoints(_table, _origin)) return false;
+		numRecords = _table.size();
+	}
+	else if (!loadWithLibLas(fileName))
+	{
+		return false;
+	}
+	else
+	{
+		numRecords = _table.size();
+	}
+
+	// The cache keeps every point, so a later launch can filter differently.
+	if (complete)
+	{
+		if (hasHeader) LasPointCache::Write(fileName, header.getCenter(), _origin, _table);
+		_options.filter.apply(_table, _origin);
+	}
+	if (_table.size() == numRecords)
+	{
+		std::cout << "Read " << _table.size() << " points from " << fileName << std::endl;
+	}
+	else
+	{
+		std::cout << "Read " << _table.size() << " of " << numRecords << " points from " << fileName << std::endl;
+	}
+
+	applyLoadFilters();
+	*_streamedPoints = _table.size();
+	setupGeometry();
+	return true;
+}
+
+bool LasModel::loadLasFileStreaming(const std::string& fileName)
+{
+	LasFileReader reader(fileName, false);
+	if (!reader.isOpen()) return false;
+
+	// The kept points have room for two chunks' worth, next to the chunk being
+	// read; decimating the kept points may take the working memory of both.
+	const std::size_t budget = _options.memoryBudget;
+	const std::size_t keep = budget / (3 * TABLE_ROW_BYTES + 2 * DECIMATE_BYTES_PER_POINT);
+	if (keep < MIN_STREAM_POINTS)
+	{
+		std::cout << "--memoryBudget is too small to stream " << fileName << std::endl;
+		return false;
+	}
+
+	const std::size_t numRecords = reader.getNumPoints();
+	const std::size_t stride = reader.getHeader().pointRecordLength;
+	std::cout << "Streaming " << numRecords << " points from " << fileName << " in chunks of " << keep
+		<< " points" << std::endl;
+
+	LasPointTable chunk;
+	float voxelSize = _options.voxelSize;
+	std::size_t peak = 0;
+	int reported = 0;
+	_table.reserve(2 * keep);
+	for (std::size_t first = 0; first < numRecords; first += keep)
+	{
+		const std::size_t count = std::min(keep, numRecords - first);
+		if (!reader.readPoints(chunk, _origin, _options.filter, first, count)) return false;
+		peak = std::max(peak, _table.capacityBytes() + chunk.capacityBytes() + count * stride);
+
+		// Thin each chunk at the voxel size reached so far, and everything kept
+		// once it outgrows its share, leaving room for the chunks still to come.
+		if (voxelSize > 0.0f)
+		{
+			peak = std::max(peak, _table.capacityBytes() + chunk.capacityBytes() + chunk.size() * DECIMATE_BYTES_PER_POINT);
+			voxelDownsample(chunk, voxelSize);
+		}
+		_table.append(chunk);
+		if (_table.size() > keep)
+		{
+			peak = std::max(peak, _table.capacityBytes() + chunk.capacityBytes() + _table.size() * DECIMATE_BYTES_PER_POINT);
+			voxelSize = std::max(voxelSize, voxelDownsampleToCount(_table, keep / 2));
+			_table.reserve(2 * keep);
+		}
+
+		int percent = static_cast<int>((first + count) * 100 / numRecords);
+		if (percent >= reported + 10 || first + count == numRecords)
+		{
+			reported = percent;
+			std::cout << "  " << percent << "%: " << _table.size() << " points kept" << std::endl;
+		}
+	}
+
+	// Give back the room reserved for further chunks.
+	LasPointTable kept;
+	kept.reserve(_table.size());
+	kept.append(_table);
+	_table = std::move(kept);
+
+	std::cout << "Read " << _table.size() << " of " << numRecords << " points from " << fileName;
+	if (voxelSize > 0.0f) std::cout << " at voxel size " << voxelSize;
+	std::cout << ", peak memory " << (peak >> 20) << " MB of a " << (budget >> 20) << " MB budget" << std::endl;
+
+	applyLoadFilters();
+	*_streamedPoints = _table.size();
+	setupGeometry();
+	return true;
+}
+
+bool LasModel::hasLoadFilters() const
+{
+	return _options.outlierNeighbors > 0 || _options.voxelSize > 0.0f || _options.maxPoints > 0;
+}
+
+bool LasModel::applyLoadFilters()
+{
+	std::size_t numPoints = _table.size();
+	if (_options.outlierNeighbors > 0)
+	{
+		std::size_t removed = removeStatisticalOutliers(_table, _options.outlierNeighbors, _options.outlierSigma);
+		std::cout << "Removed " << removed << " outliers" << std::endl;
+	}
+
+	// Noise goes first, so it cannot pull voxel averages around.
+	if (_options.voxelSize > 0.0f)
+	{
+		voxelDownsample(_table, _options.voxelSize);
+	}
+	if (_options.maxPoints > 0)
+	{
+		float voxelSize = voxelDownsampleToCount(_table, _options.maxPoints);
+		if (voxelSize > 0.0f) std::cout << "Using voxel size " << voxelSize << " for --maxPoints" << std::endl;
+	}
+	if (_table.size() != numPoints)
+	{
+		std::cout << "Filtered " << numPoints << " points to " << _table.size() << std::endl;
+	}
+	return _table.size() != numPoints;
+}
+
+bool LasModel::loadLazFile(const std::string& fileName)
+{
+	std::shared_ptr<LasLazReader> reader = std::make_shared<LasLazReader>(fileName);
+	if (!reader->isOpen()) return false;
+
+	const LasHeader& header = reader->getHeader();
+	if (!_hasOrigin) _origin = header.getCenter();
+	_table.resize(reader->getNumPoints());
+
+	// Draw nothing yet; the update callback extends the draw range as the
+	// decoder finishes chunks at the front of the file. Until then the
+	// geometry takes its bounds from the header.
+	osg::Vec3d origin = _origin;
+	osg::BoundingBox bounds(osg::Vec3d(header.min[0], header.min[1], header.min[2]) - origin,
+		osg::Vec3d(header.max[0], header.max[1], header.max[2]) - origin);
+	osg::Geometry* geometry = setupGeometry(&bounds);
+	osg::DrawArrays* points = static_cast<osg::DrawArrays*>(geometry->getPrimitiveSet(0));
+	points->setCount(0);
+	geometry->setUseDisplayList(false);
+	geometry->setDataVariance(osg::Object::DYNAMIC);
+	geometry->setUpdateCallback(new StreamedPointsCallback(_streamedPoints, points, _colorizer.get(), _table.size()));
+	// Drawn even out of view until every point is in, since decoding waits for the first draw.
+	geometry->setCullingActive(false);
+
+	// Keep this thread's share of the workers for the decoder.
+	unsigned int budget = threadBudget();
+	std::shared_ptr<std::atomic<std::size_t>> streamed = _streamedPoints;
+	const osg::Vec3d center = header.getCenter();
+	_streamThread = std::thread([this, reader, budget, streamed, fileName, center]()
+	{
+		// The first draw uploads the whole arrays, which are not decoded yet.
+		// Write no row until it is done, so no upload reads a row while it is
+		// written; later draws upload just the decoded rows. Anyone who needs
+		// the points (finishStreaming) lets the decoder start at once.
+		while (!_colorizer->hasDrawn() && !_releaseStream)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		threadBudget() = budget;
+		bool ok = reader->readPoints(_table, _origin, [streamed](std::size_t n) { *streamed = n; });
+		if (ok)
+		{
+			std::cout << "Read " << _table.size() << " points from " << fileName << std::endl;
+			LasPointCache::Write(fileName, center, _origin, _table);
+		}
+		else
+		{
+			std::cout << "Stopped reading " << fileName << " after " << streamed->load() << " points" << std::endl;
+		}
+	});
+	return true;
+}
+
+bool LasModel::loadOctree(const std::string& path)
+{
+	std::string fileName = osgDB::findDataFile(path);
+	if (fileName.empty()) return false;
+
+	std::unique_ptr<LasOctree> octree(new LasOctree(fileName));
+	if (!octree->isOpen())
+	{
+		std::cout << "Could not open octree " << fileName << std::endl;
+		return false;
+	}
+
+	std::cout << "Paging " << octree->getNumPoints() << " points in " << octree->getNodes().size()
+		<< " octree nodes from " << fileName << std::endl;
+
+	// The octree is stored around its own center; shift it into the shared frame.
+	osg::Vec3d offset;
+	if (_hasOrigin)
+	{
+		offset = octree->getCenter() - _origin;
+	}
+	else
+	{
+		_origin = octree->getCenter();
+	}
+
+	osg::ref_ptr<LasOctreeGroup> group = new LasOctreeGroup(std::move(octree), _options);
+	setupPointState(group->getOrCreateStateSet());
+	_isOctree = true;
+
+	osg::ref_ptr<osg::MatrixTransform> xform = new osg::MatrixTransform(osg::Matrix::translate(offset));
+	xform->addChild(group);
+	attachModel(xform);
+	return true;
+}
+
+bool LasModel::loadWithLibLas(const std::string& path)
+{
 	std::ifstream ifs;
-	if (!liblas::Open(ifs, path)) return;
+	if (!liblas::Open(ifs, path)) return false;
 
 	liblas::Reader reader = liblas::ReaderFactory().CreateWithStream(ifs);
 	liblas::Header const& h = reader.GetHeader();
 
-	// Setup Geometry
-	osg::ref_ptr<osg::Geode> geode = new osg::Geode();
-	osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+	osg::Vec3Array& verts = *_table.positions;
+	osg::Vec4ubArray& colors = *_table.colors;
+	_table.reserve(h.GetPointRecordsCount());
 
-	typedef std::pair<double, double> minmax_t;
-	minmax_t mx(DBL_MAX, -DBL_MAX);
-	minmax_t my(DBL_MAX, -DBL_MAX);
-	minmax_t mz(DBL_MAX, -DBL_MAX);
+	if (!_hasOrigin)
+	{
+		_origin.set((h.GetMinX() + h.GetMaxX()) * 0.5, (h.GetMinY() + h.GetMaxY()) * 0.5, (h.GetMinZ() + h.GetMaxZ()) * 0.5);
+	}
 
 	// Read Points
 	while (reader.ReadNextPoint())
 	{
 		liblas::Point const& p = reader.GetPoint();
 
-		double x = p.GetRawX() * h.GetScaleX();
-		double y = p.GetRawY() * h.GetScaleY();
-		double z = p.GetRawZ() * h.GetScaleZ();
-		_verts->push_back(osg::Vec3(x, y, z));
-
-		mx.first = std::min<double>(mx.first, x);
-		mx.second = std::max<double>(mx.second, x);
-		my.first = std::min<double>(my.first, y);
-		my.second = std::max<double>(my.second, y);
-		mz.first = std::min<double>(mz.first, z);
-		mz.second = std::max<double>(mz.second, z);
+		verts.push_back(osg::Vec3(p.GetX() - _origin.x(), p.GetY() - _origin.y(), p.GetZ() - _origin.z()));
 
 		liblas::Color c = p.GetColor();
-		float r = ((float)c.GetRed()) / USHRT_MAX;
-		float g = ((float)c.GetGreen()) / USHRT_MAX;
-		float b = ((float)c.GetBlue()) / USHRT_MAX;
-		float a = 255;    // default value, since LAS point has no alpha information
-		_colors->push_back(osg::Vec4(r, g, b, a));
+		colors.push_back(osg::Vec4ub(c.GetRed() >> 8, c.GetGreen() >> 8, c.GetBlue() >> 8, 255));
 
-		_points.push_back(new ModelPoint(p, _verts->size() - 1, this));
+		_table.classification.push_back(p.GetClassification().GetClass());
+		_table.intensity.push_back(p.GetIntensity());
+		_table.returnNumber.push_back(p.GetReturnNumber());
+		_table.numberOfReturns.push_back(p.GetNumberOfReturns());
 	}
+	return true;
+}
 
-	for (ModelPoint* p : _points)
-	{
-		osg::Vec3 mids = osg::Vec3(mx.second + mx.first, my.second + my.first, mz.second + mz.first) * 0.5;
-		p->setPos(p->getPos() - mids);
-	}
+osg::Geometry* LasModel::setupGeometry(const osg::BoundingBox* bounds)
+{
+	osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+	osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
 
 	// Setup Geometry
 	geometry->setUseDisplayList(true);
 	geometry->setUseVertexBufferObjects(true);
-	geometry->setVertexArray(_verts);
-	geometry->setColorArray(_colors, osg::Array::BIND_PER_VERTEX);
-	geometry->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, _verts->size()));
+	geometry->setVertexArray(_table.positions);
+	geometry->setColorArray(_table.colors, osg::Array::BIND_PER_VERTEX);
+	geometry->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, _table.size()));
+	setupPointState(geometry->getOrCreateStateSet());
+	// Deleted points have zero alpha until compaction removes them.
+	geometry->getOrCreateStateSet()->setAttributeAndModes(new osg::AlphaFunc(osg::AlphaFunc::GREATER, 0.0f),
+		osg::StateAttribute::ON);
+	geometry->setDrawCallback(_colorizer);
+	geometry->setCullCallback(new EyePointCallback(_eye));
+	if (bounds) geometry->setComputeBoundingBoxCallback(new FixedBoundsCallback(*bounds));
+
+	// Set new model
+	geode->setDataVariance(osg::Object::STATIC);
+	geode->addDrawable(geometry);
+	attachModel(geode);
+	_geometry = geometry;
+	return geometry.get();
+}
+
+osg::Node* LasModel::addHighlight(const std::vector<unsigned int>& indices, const osg::Vec4& color)
+{
+	if (indices.empty() || !_model.valid()) return nullptr;
+
+	osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+	geometry->setUseDisplayList(false);
+	geometry->setUseVertexBufferObjects(true);
+	geometry->setVertexArray(_table.positions.get());
+	osg::ref_ptr<osg::Vec4Array> colors = new osg::Vec4Array(1, &color);
+	geometry->setColorArray(colors.get(), osg::Array::BIND_OVERALL);
+	geometry->addPrimitiveSet(new osg::DrawElementsUInt(GL_POINTS, indices.size(), &indices.front()));
+	osg::BoundingBox bounds;
+	for (unsigned int i : indices) bounds.expandBy((*_table.positions)[i]);
+	geometry->setComputeBoundingBoxCallback(new FixedBoundsCallback(bounds));
 
+	// Slightly larger points, drawn after the model and winning depth ties,
+	// so the highlight covers the same points underneath.
+	osg::StateSet* state = geometry->getOrCreateStateSet();
+	setupPointState(state);
+	state->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+	state->setAttributeAndModes(new osg::Point(3.0f), osg::StateAttribute::ON);
+	state->setAttributeAndModes(new osg::Depth(osg::Depth::LEQUAL), osg::StateAttribute::ON);
+	state->setRenderBinDetails(1, "RenderBin");
+
+	osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+	geode->addDrawable(geometry);
+	_modelXform->addChild(geode.get());
+	return geode.get();
+}
+
+void LasModel::removeHighlight(osg::Node* highlight)
+{
+	if (highlight != nullptr) _modelXform->removeChild(highlight);
+}
+
+std::size_t LasModel::deletePoints(const std::vector<unsigned int>& indices)
+{
+	finishStreaming();
+	if (_isOctree || indices.empty()) return 0;
+
+	if (_deleted.empty()) _deleted.assign(_table.size(), false);
+	std::vector<unsigned int> deleted;
+	for (unsigned int i : indices)
+	{
+		if (i >= _deleted.size() || _deleted[i]) continue;
+		_deleted[i] = true;
+		deleted.push_back(i);
+	}
+	if (deleted.empty()) return 0;
+	if (_compactThread.joinable()) _deletedMeanwhile.insert(_deletedMeanwhile.end(), deleted.begin(), deleted.end());
+
+	_numDeleted += deleted.size();
+	_lastDeletion = std::chrono::steady_clock::now();
+	_colorizer->hidePoints(deleted);
+	return deleted.size();
+}
+
+std::size_t LasModel::getNumDeleted() const
+{
+	return _numDeleted;
+}
+
+void LasModel::removeDeleted(std::vector<unsigned int>& indices) const
+{
+	if (_numDeleted == 0) return;
+	indices.erase(std::remove_if(indices.begin(), indices.end(),
+		[this](unsigned int i) { return _deleted[i]; }), indices.end());
+}
+
+bool LasModel::updateCompaction(std::vector<uint32_t>& remap)
+{
+	if (_compactThread.joinable())
+	{
+		if (!_compactDone) return false;
+		_compactThread.join();
+		applyCompaction();
+		remap.swap(_compactRemap);
+		_compactRemap.clear();
+		return true;
+	}
+
+	if (_numDeleted > 0 && std::chrono::steady_clock::now() - _lastDeletion > COMPACT_DELAY) startCompaction();
+	return false;
+}
+
+void LasModel::startCompaction()
+{
+	_compactRemoved = _deleted;
+	_compactDone = false;
+	_colorizer->beginCompaction();
+
+	// The thread waits for the feature thread, so this one does not.
+	_resumeFeatures = _featureThread.joinable();
+	_stopFeatures = true;
+	unsigned int budget = std::max(1u, threadBudget() - 1);	// leave a core for drawing
+	_compactThread = std::thread([this, budget]()
+	{
+		threadBudget() = budget;
+		if (_featureThread.joinable()) _featureThread.join();
+
+		const std::size_t n = _table.size();
+		_compactRemap.resize(n);
+		uint32_t kept = 0;
+		for (std::size_t i = 0; i < n; i++)
+		{
+			_compactRemap[i] = _compactRemoved[i] ? NO_ROW : kept++;
+		}
+
+		_compacted.positions = new osg::Vec3Array(kept);
+		_compacted.classification.resize(kept);
+		_compacted.intensity.resize(kept);
+		_compacted.returnNumber.resize(kept);
+		_compacted.numberOfReturns.resize(kept);
+		_compactChange.resize(_change.size() == n ? kept : 0);
+		parallelFor(0, n, [&](std::size_t first, std::size_t last)
+		{
+			for (std::size_t i = first; i < last; i++)
+			{
+				const uint32_t j = _compactRemap[i];
+				if (j == NO_ROW) continue;
+				(*_compacted.positions)[j] = (*_table.positions)[i];
+				_compacted.classification[j] = _table.classification[i];
+				_compacted.intensity[j] = _table.intensity[i];
+				_compacted.returnNumber[j] = _table.returnNumber[i];
+				_compacted.numberOfReturns[j] = _table.numberOfReturns[i];
+				if (!_compactChange.empty()) _compactChange[j] = _change[i];
+			}
+		});
+		_colorizer->compact(_compactRemap, kept);
+		_features.compact(_compactRemap, _compacted, _compactFeatures);
+		_compactDeleted.assign(kept, false);
+		_compactGrid.build(_compacted.positions.get());
+		_compactDone = true;
+	});
+}
+
+void LasModel::applyCompaction()
+{
+	_colorizer->applyCompaction(_compactRemap);
+	_table.positions = _compacted.positions;
+	_table.classification.swap(_compacted.classification);
+	_table.intensity.swap(_compacted.intensity);
+	_table.returnNumber.swap(_compacted.returnNumber);
+	_table.numberOfReturns.swap(_compacted.numberOfReturns);
+	_compacted = LasPointTable();
+
+	_features.applyCompaction(_compactFeatures, _compactRemap);
+	_change.swap(_compactChange);
+	std::vector<float>().swap(_compactChange);
+	_grid = std::move(_compactGrid);
+	_compactGrid = PCVR_PointGrid();
+
+	// Points asked for meanwhile follow their rows.
+	{
+		std::lock_guard<std::mutex> lock(_featureRequestMutex);
+		std::size_t kept = 0;
+		for (unsigned int i : _featureRequests)
+		{
+			if (_compactRemap[i] != NO_ROW) _featureRequests[kept++] = _compactRemap[i];
+		}
+		_featureRequests.resize(kept);
+	}
+
+	// Rows deleted while the thread ran carry over to the new rows; their
+	// zero alpha came along with the replayed colors.
+	for (unsigned int i : _deletedMeanwhile)
+	{
+		_compactDeleted[_compactRemap[i]] = true;
+	}
+	_numDeleted = _deletedMeanwhile.size();
+	if (_numDeleted > 0) _deleted.swap(_compactDeleted);
+	else std::vector<bool>().swap(_deleted);
+	std::vector<bool>().swap(_compactDeleted);
+	_deletedMeanwhile.clear();
+	_compactRemoved.clear();
+
+	if (_geometry.valid())
+	{
+		// Streaming finished before the first deletion; nothing is left to extend.
+		_geometry->setUpdateCallback(nullptr);
+		_geometry->setVertexArray(_table.positions.get());
+		_geometry->setColorArray(_table.colors.get(), osg::Array::BIND_PER_VERTEX);
+		osg::DrawArrays* points = static_cast<osg::DrawArrays*>(_geometry->getPrimitiveSet(0));
+		points->setCount(static_cast<GLsizei>(_table.size()));
+		points->dirty();
+	}
+	*_streamedPoints = _table.size();
+	std::cout << "Compacted " << getName() << " to " << _table.size() << " points" << std::endl;
+
+	if (_resumeFeatures) startFeatureThread();
+}
+
+void LasModel::cancelCompaction()
+{
+	if (!_compactThread.joinable()) return;
+	_compactThread.join();
+
+	_colorizer->cancelCompaction();
+	_compacted = LasPointTable();
+	_compactFeatures.clear();
+	std::vector<float>().swap(_compactChange);
+	std::vector<bool>().swap(_compactDeleted);
+	_compactGrid = PCVR_PointGrid();
+	_compactRemap.clear();
+	_compactRemoved.clear();
+	_deletedMeanwhile.clear();
+
+	if (_resumeFeatures) startFeatureThread();
+}
+
+bool LasModel::saveLas(const std::string& path) const
+{
+	finishStreaming();
+	if (_isOctree)
+	{
+		std::cout << "Cannot save the points of octree " << _path << std::endl;
+		return false;
+	}
+
+	// Palette and feature colors are only for display; the file keeps the scan's own.
+	if (!LasFileWriter::Write(path, _table, _origin, osgDB::findDataFile(_path), _numDeleted > 0 ? &_deleted : nullptr,
+		_colorizer->getSourceColors()))
+	{
+		return false;
+	}
+	std::cout << "Wrote " << _table.size() - _numDeleted << " points to " << path << std::endl;
+	return true;
+}
+
+void LasModel::setupPointState(osg::StateSet* state)
+{
 	osg::ref_ptr<osg::Program> program = new osg::Program();
 	//program->addShader(osg::Shader::readShaderFile(osg::Shader::VERTEX, "../../shaders/SurfacePoint.vert"));
 	//program->addShader(osg::Shader::readShaderFile(osg::Shader::FRAGMENT, "../../shaders/SurfacePoint.frag"));
 
-	osg::ref_ptr<osg::StateSet> state = geometry->getOrCreateStateSet();
 	state->setMode(GL_VERTEX_PROGRAM_POINT_SIZE, osg::StateAttribute::ON);
 	state->setAttributeAndModes(program, osg::StateAttribute::ON);
 
 	osg::ref_ptr<osg::Uniform> viewMatrix = new osg::Uniform(osg::Uniform::FLOAT_MAT4, "viewMatrix");
 	viewMatrix->setUpdateCallback(new ViewMatrixCallback());
 	state->addUniform(viewMatrix);
+}
 
-	// Set new model
-	geode->setDataVariance(osg::Object::STATIC);
-	geode->addDrawable(geometry);
-	_model = geode;
+void LasModel::attachModel(osg::Node* node)
+{
+	_model = node;
 
 	// Add the new model to this frame
 	_modelXform->addChild(_model.get());
@@ -137,7 +1059,16 @@ void LasModel::loadLasFile(const std::string& path)
 	// Rescale normals in case we want to scale the model
 	_model->getOrCreateStateSet()->setMode(GL_RESCALE_NORMAL, osg::StateAttribute::ON);
 
-	// Set the model pivot at its geometric center, so that scales/rotations will make sense.
-	osg::Vec3d center = _model->getBound()._center;
-	setModelPivot(center[0], center[1], center[2]);
+	// Models sharing a frame keep the frame origin as their pivot, so tiles stay
+	// where they belong relative to each other. A lone model pivots about its
+	// geometric center, so that scales/rotations will make sense.
+	if (_hasOrigin)
+	{
+		setModelPivot(0.0, 0.0, 0.0);
+	}
+	else
+	{
+		osg::Vec3d center = _model->getBound()._center;
+		setModelPivot(center[0], center[1], center[2]);
+	}
 }
\ No newline at end of file
@@ -1,43 +1,214 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include <liblas/liblas.hpp>
 
+#include <osg/BoundingBox>
+#include <osg/Geometry>
+#include <osg/Matrixd>
+
 #include <OpenFrames/Model.hpp>
 
-#include "PCVR_Selection.hpp"
+#include "LasChangeDetector.hpp"
+#include "LasColorizer.hpp"
+#include "LasLoadOptions.hpp"
+#include "LasPointFeatures.hpp"
+#include "LasPointTable.hpp"
+#include "LasRegistration.hpp"
+#include "PCVR_PointGrid.hpp"
 
-class LasModel;
+// Where a LasModel was last seen from, in model coordinates; written by the
+// cull traversal of its points.
+struct LasEyePoint
+{
+	std::mutex mutex;
+	osg::Vec3 position;
+	bool valid = false;
+};
 
-class ModelPoint : public liblas::Point, public PCVR_Selectable
+class LasModel : public OpenFrames::Model
 {
 public:
-	ModelPoint(liblas::Point const& p, int index, LasModel* parent);
+	LasModel(const std::string& path, const LasLoadOptions& options = LasLoadOptions());
 
-	osg::Vec3 getPos() const override;
-	osg::Vec4 getColor() const;
+	// Source coordinates that map to the model's local origin. Set it before
+	// load() to place several models in one common frame; otherwise the model
+	// is centered on its own header bounds.
+	void setOrigin(const osg::Vec3d& origin);
+	const osg::Vec3d& getOrigin() const;
 
-	void setPos(osg::Vec3 pos) override;
-	void setColor(osg::Vec4 color) override;
+	// Read the file given to the constructor and build the point geometry.
+	// May run off the main thread as long as the model is not in the scene yet.
+	// LAZ files keep decoding in the background after load() returns, and the
+	// geometry grows as chunks finish.
+	bool load();
 
-private:
-	int _index;
-	LasModel* _parent;
-};
+	// False while a LAZ file is still streaming in.
+	bool isLoaded() const;
 
-class LasModel : public OpenFrames::Model
-{
-	friend class ModelPoint;
+	// The file given to the constructor.
+	const std::string& getPath() const;
 
-public:
-	LasModel(const std::string& path);
+	// Bounds of a LAS file or octree in source coordinates, from its header only.
+	static bool ReadSourceBounds(const std::string& path, osg::BoundingBoxd& bounds);
+
+	// True when the model pages an octree instead of holding every point.
+	// The point table is empty in that case.
+	bool isOctree() const;
+
+	// The point table accessors wait for a streaming load to finish first.
+	LasPointTable& getPointTable();
+	const LasPointTable& getPointTable() const;
+	osg::Vec4ubArray& getColors();
+
+	// Recolor the points by an attribute column; only changed colors are uploaded.
+	void recolor(LasColorMode mode);
+	LasColorizer& getColorizer();
 
-	std::vector<ModelPoint*>& getPoints();
-	osg::Vec4Array& getColors();
+	// Spatial index over the point table, built on first use.
+	const PCVR_PointGrid& getPointGrid();
+
+	// Local geometry of the points (normals, curvature, ...), computed on
+	// demand. While the model is colored by a feature, a background thread
+	// computes the points nearest the viewer first and widens out from there.
+	const LasPointFeatures& getFeatures() const;
+	// Have the feature thread compute these points (e.g. a selection) before
+	// the ones around the viewer. Returns at once; the colors follow through
+	// updateFeatureColors.
+	void computeFeatures(const std::vector<unsigned int>& indices);
+	// Show the points whose features arrived since the last call, and start
+	// the feature thread for points asked for; call once per frame.
+	void updateFeatureColors();
+
+	// Measure how far each point moved since the detector's reference epoch,
+	// for LAS_COLOR_CHANGE. In M3C2 mode the normals of every point are
+	// computed first. The detector must use the same origin as the model.
+	bool measureChange(const LasChangeDetector& detector);
+	// Per-point change, NaN where unmeasured; empty before measureChange.
+	const std::vector<float>& getChange() const;
+
+	// Model coordinates to the coordinates of the frame the model sits in,
+	// i.e. the model's pivot, attitude and position offset. Setting it keeps
+	// the pivot and changes the attitude and position offset; the matrix must
+	// be rigid.
+	osg::Matrixd getModelMatrix() const;
+	void setModelMatrix(const osg::Matrixd& matrix);
+
+	// Register this scan onto an overlapping one with point-to-plane ICP,
+	// starting from where both are drawn now. 'matrix' receives the model
+	// matrix that lines this model up with the target; nothing is moved yet.
+	// The target's normals are computed where needed.
+	bool registerTo(LasModel& target, const LasRegistrationOptions& options, osg::Matrixd& matrix,
+		LasRegistrationResult& result);
+
+	// Draw the given rows of the point table on top of the model in a flat
+	// color. The overlay shares the model's vertex array, so only the index
+	// list is uploaded and the model's own colors are left untouched. Pass
+	// the returned node to removeHighlight to clear it.
+	osg::Node* addHighlight(const std::vector<unsigned int>& indices, const osg::Vec4& color);
+	void removeHighlight(osg::Node* highlight);
+
+	// Delete rows of the point table. They are only flagged and hidden at
+	// first; the table, the colorizer, the features and the point grid are
+	// compacted on a background thread once no deletion has come in for a
+	// few seconds. Returns the number of rows newly deleted; octree models
+	// cannot delete points. Call with the frame manager locked.
+	std::size_t deletePoints(const std::vector<unsigned int>& indices);
+	std::size_t getNumDeleted() const;
+	// Drop the rows that are deleted but not compacted away yet, e.g. from a
+	// query of the point grid.
+	void removeDeleted(std::vector<unsigned int>& indices) const;
+	// Start or finish the background compaction; call once per frame with the
+	// frame manager locked. True when a compaction was just applied, with
+	// 'remap' taking each old row to its new row, or NO_ROW if it was deleted.
+	static const uint32_t NO_ROW = 0xffffffff;
+	bool updateCompaction(std::vector<uint32_t>& remap);
+
+	// Write the points that are not deleted to a LAS file, in the coordinates
+	// and with the variable length records of the file they were loaded from.
+	// Only the fields the point table holds are kept (see LasFileWriter): GPS
+	// time, scan angle, user data, point source ID and the scan and edge flags
+	// of the loaded records are written as zero.
+	bool saveLas(const std::string& path) const;
+
+protected:
+	virtual ~LasModel();
 
 private:
-	osg::ref_ptr<osg::Vec3Array> _verts = new osg::Vec3Array();
-	osg::ref_ptr<osg::Vec4Array> _colors = new osg::Vec4Array();
-	std::vector<ModelPoint*> _points;
+	LasPointTable _table;
+	PCVR_PointGrid _grid;
+	osg::ref_ptr<LasColorizer> _colorizer;
+	LasPointFeatures _features;
+	std::vector<float> _change;
+	LasLoadOptions _options;
+	std::string _path;
+	osg::Vec3d _origin;
+	bool _hasOrigin = false;
+	bool _isOctree = false;
+
+	// Background LAZ decoding; _streamedPoints is the decoded prefix of the table.
+	// Decoding waits for the first draw, or until _releaseStream is set.
+	mutable std::thread _streamThread;
+	std::shared_ptr<std::atomic<std::size_t>> _streamedPoints;
+	mutable std::atomic<bool> _releaseStream;
+
+	// Background feature computation around the latest eye point.
+	std::shared_ptr<LasEyePoint> _eye;
+	std::thread _featureThread;
+	std::atomic<bool> _stopFeatures;
+	std::mutex _featureRequestMutex;
+	std::vector<unsigned int> _featureRequests;	// rows asked for by computeFeatures
 
-	void loadLasFile(const std::string& path);
-};
\ No newline at end of file
+	// Deleted rows not compacted away yet, one bit per row; empty if none.
+	// The colorizer draws them with zero alpha.
+	osg::ref_ptr<osg::Geometry> _geometry;
+	std::vector<bool> _deleted;
+	std::size_t _numDeleted = 0;
+	std::chrono::steady_clock::time_point _lastDeletion;
+
+	// Background compaction of the rows deleted as of _compactRemoved. The
+	// thread waits for the feature thread to stop, then copies every per-point
+	// column into the _compact* members. Applying the result swaps them in,
+	// replays the colors written meanwhile and carries over the rows deleted
+	// meanwhile; the main thread touches no other row.
+	std::thread _compactThread;
+	std::atomic<bool> _compactDone;
+	bool _resumeFeatures = false;	// restart the feature thread once applied
+	std::vector<bool> _compactRemoved;
+	std::vector<uint32_t> _compactRemap;
+	std::vector<unsigned int> _deletedMeanwhile;
+	LasPointTable _compacted;
+	LasPointFeatures _compactFeatures;
+	std::vector<float> _compactChange;
+	std::vector<bool> _compactDeleted;
+	PCVR_PointGrid _compactGrid;
+
+	bool loadLasFile(const std::string& path);
+	// Read a file larger than the memory budget a window at a time, decimating as it goes.
+	bool loadLasFileStreaming(const std::string& fileName);
+	bool loadLazFile(const std::string& fileName);
+	void finishStreaming() const;
+	void startFeatureThread();
+	void stopFeatureThread();
+	void computeFeaturesNearEye();
+	void startCompaction();
+	void applyCompaction();
+	// Wait for a running compaction and drop its result, before rewriting
+	// per-point state it copies. The next updateCompaction starts over.
+	void cancelCompaction();
+	bool loadOctree(const std::string& path);
+	bool loadWithLibLas(const std::string& path);
+	// Outlier removal and downsampling from the load options; true if any
+	// points were dropped.
+	bool hasLoadFilters() const;
+	bool applyLoadFilters();
+	// 'bounds', if given, is used instead of computing the bounds from the points.
+	osg::Geometry* setupGeometry(const osg::BoundingBox* bounds = nullptr);
+	void setupPointState(osg::StateSet* state);
+	void attachModel(osg::Node* node);
+};
@@ -1,6 +1,9 @@
+#include <chrono>
+
 #include <osgDB/FileNameUtils>
 
 #include <QCheckBox>
+#include <QPushButton>
 #include <QRadioButton>
 #include <QWidget>
 #include <QFile>
@@ -8,6 +11,8 @@
 
 #include "DiskDrawer.hpp"
 #include "LasModel.hpp"
+#include "LasOctreeGroup.hpp"
+#include "PCVR_Parallel.hpp"
 
 #include "LasModelScene.hpp"
 
@@ -16,20 +21,187 @@ LasModelScene::LasModelScene()
 {
 }
 
+void LasModelScene::parseArgs(osg::ArgumentParser& args)
+{
+	PCVR_Scene::parseArgs(args);
+
+	unsigned int pointBudget, cacheBudget;
+	if (args.read("--pointBudget", pointBudget)) _lasOptions.pointBudget = pointBudget;
+	if (args.read("--cacheBudget", cacheBudget)) _lasOptions.cacheBudget = cacheBudget;
+	args.read("--screenSpaceError", _lasOptions.screenSpaceError);
+
+	args.read("--removeOutliers", _lasOptions.outlierNeighbors, _lasOptions.outlierSigma);
+
+	unsigned int maxPoints;
+	args.read("--voxel", _lasOptions.voxelSize);
+	if (args.read("--maxPoints", maxPoints)) _lasOptions.maxPoints = maxPoints;
+
+	unsigned int memoryBudget;
+	if (args.read("--memoryBudget", memoryBudget)) _lasOptions.memoryBudget = static_cast<std::size_t>(memoryBudget) << 20;
+	readLasPointFilter(args, _lasOptions.filter);
+
+	_alignOnLoad = args.read("--align");
+	args.read("--alignDistance", _registrationOptions.maxDistance);
+
+	args.read("--changeFrom", _changeFrom);
+	args.read("--m3c2", _m3c2Radius);
+
+	std::string colorBy;
+	if (args.read("--colorBy", colorBy))
+	{
+		if (!parseLasColorMode(colorBy, _colorMode))
+		{
+			std::cout << "Unknown --colorBy " << colorBy << ", coloring by classification." << std::endl;
+		}
+	}
+	else if (!_changeFrom.empty())
+	{
+		_colorMode = LAS_COLOR_CHANGE;
+	}
+}
+
 void LasModelScene::buildScene()
 {
 	PCVR_Scene::buildScene();
 
+	// All tiles share one frame, centered on the union of their header bounds,
+	// so neighboring tiles of a survey line up.
+	osg::BoundingBoxd bounds;
 	for (auto& path : _dataPaths)
 	{
-		osg::ref_ptr<LasModel> model = new LasModel(path);
-		_models.push_back(model);
-		_rootFrame->addChild(model);
+		if (!LasModel::ReadSourceBounds(path, bounds))
+		{
+			std::cout << "Could not read the bounds of " << path << std::endl;
+		}
+	}
+	if (!_changeFrom.empty() && !LasModel::ReadSourceBounds(_changeFrom, bounds))
+	{
+		std::cout << "Could not read the bounds of " << _changeFrom << std::endl;
+	}
+	// With a bounds filter only part of the tiles is kept; center the frame on that part.
+	if (_lasOptions.filter.hasBounds() && bounds.valid())
+	{
+		bounds = bounds.intersect(_lasOptions.filter.getBounds());
+	}
+
+	// Octree tiles draw from one point budget and one cache budget between them.
+	_lasOptions.octreeBudget = std::make_shared<LasOctreeBudget>(_lasOptions.pointBudget, _lasOptions.cacheBudget);
+	std::vector<osg::ref_ptr<LasModel>> models;
+	for (auto& path : _dataPaths)
+	{
+		osg::ref_ptr<LasModel> model = new LasModel(path, _lasOptions);
+		if (bounds.valid()) model->setOrigin(bounds.center());
+		models.push_back(model);
+	}
+
+	// Load the tiles concurrently; each one gets a share of the threads for its own decoding.
+	std::vector<char> loaded(models.size(), 0);
+	parallelFor(0, models.size(), [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			loaded[i] = models[i]->load();
+		}
+	}, 1);
+
+	for (std::size_t i = 0; i < models.size(); i++)
+	{
+		if (!loaded[i]) continue;
+		_models.push_back(models[i]);
+		_rootFrame->addChild(models[i]);
+	}
+
+	if (_alignOnLoad) alignScans();
+	if (!_changeFrom.empty()) measureChange();
+}
+
+void LasModelScene::alignScans()
+{
+	std::vector<LasModel*> models;
+	for (LasModel* model : getLasModels())
+	{
+		if (!model->isOctree()) models.push_back(model);
+	}
+	if (models.size() < 2)
+	{
+		std::cout << "Aligning scans needs at least two LAS files loaded without an octree" << std::endl;
+		return;
+	}
+
+	// The first scan stays put. Each registration runs while the scene keeps
+	// drawing; only the transform update waits for the frame manager.
+	for (std::size_t i = 1; i < models.size(); i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		osg::Matrixd matrix;
+		LasRegistrationResult result;
+		if (!models[i]->registerTo(*models[0], _registrationOptions, matrix, result))
+		{
+			std::cout << "Could not align " << models[i]->getName() << " to " << models[0]->getName()
+				<< "; the scans may not overlap within " << _registrationOptions.maxDistance << std::endl;
+			continue;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		_FM->lock();
+		models[i]->setModelMatrix(matrix);
+		_FM->unlock();
+
+		std::cout << "Aligned " << models[i]->getName() << " to " << models[0]->getName() << " in "
+			<< result.iterations << " iterations (" << seconds << " s): RMS " << result.rms << " over "
+			<< result.numPairs << " pairs" << (result.converged ? "" : ", not converged") << std::endl;
+	}
+}
+
+void LasModelScene::deleteSelectedPoints()
+{
+	std::size_t count = 0;
+	_FM->lock();
+	for (PCVR_Selection* selection : PCVR_Selection::GetSelections())
+	{
+		SelectionDisk* disk = dynamic_cast<SelectionDisk*>(selection);
+		if (disk != nullptr) count += disk->deleteSelectedPoints();
+	}
+	_FM->unlock();
+	std::cout << "Deleted " << count << " points" << std::endl;
+}
 
-		for (ModelPoint* p : model->getPoints())
+void LasModelScene::saveEditedPoints()
+{
+	for (LasModel* model : getLasModels())
+	{
+		if (model->isOctree()) continue;
+		model->saveLas(osgDB::getNameLessExtension(model->getPath()) + "_edited.las");
+	}
+}
+
+void LasModelScene::measureChange()
+{
+	// The reference is read into the frame of the first model, which all
+	// models share when their bounds could be read.
+	std::vector<LasModel*> models;
+	for (LasModel* model : getLasModels())
+	{
+		if (!model->isOctree()) models.push_back(model);
+	}
+	if (models.empty())
+	{
+		std::cout << "--changeFrom needs at least one LAS file loaded without an octree" << std::endl;
+		return;
+	}
+
+	LasChangeDetector detector(_m3c2Radius);
+	const osg::Vec3d origin = models[0]->getOrigin();
+	if (!detector.loadReference(_changeFrom, origin)) return;
+
+	for (LasModel* model : models)
+	{
+		if (model->getOrigin() != origin)
 		{
-			_selectables.push_back(p);
+			std::cout << "Skipping change of a model in a different frame than " << _changeFrom << std::endl;
+			continue;
 		}
+		model->measureChange(detector);
 	}
 }
 
@@ -38,6 +210,16 @@ std::vector<OpenFrames::Model*>& LasModelScene::getModels()
 	return _models;
 }
 
+std::vector<LasModel*> LasModelScene::getLasModels()
+{
+	std::vector<LasModel*> models;
+	for (OpenFrames::Model* m : _models)
+	{
+		models.push_back(static_cast<LasModel*>(m));
+	}
+	return models;
+}
+
 void LasModelScene::setupMenuEventListeners(PCVR_Controller* controller)
 {
 	ModelScene::setupMenuEventListeners(controller);
@@ -48,48 +230,51 @@ void LasModelScene::setupMenuEventListeners(PCVR_Controller* controller)
 
 	QRadioButton* diskAction = controllerWidget->findChild<QRadioButton*>("diskButton");
 	QObject::connect(diskAction, &QRadioButton::clicked, this,
-		[=]() { switchToolTo(new DiskDrawer<SelectionDisk>(_FM, _selectables, controller)); });
+		[=]() { switchToolTo(new DiskDrawer<SelectionDisk>(_FM, getLasModels(), controller)); });
+
+	QPushButton* alignButton = controllerWidget->findChild<QPushButton*>("alignScansButton");
+	QObject::connect(alignButton, &QPushButton::clicked, this,
+		[=]() { alignScans(); });
+
+	QPushButton* deleteButton = controllerWidget->findChild<QPushButton*>("deletePointsButton");
+	QObject::connect(deleteButton, &QPushButton::clicked, this,
+		[=]() { deleteSelectedPoints(); });
+
+	QPushButton* saveButton = controllerWidget->findChild<QPushButton*>("saveEditsButton");
+	QObject::connect(saveButton, &QPushButton::clicked, this,
+		[=]() { saveEditedPoints(); });
 
 	QCheckBox* colorCheckBox = controllerWidget->findChild<QCheckBox*>("colorByClassificationCheckBox");
 	QObject::connect(colorCheckBox, &QCheckBox::stateChanged, this,
 		[=](int state) { colorForest(state == Qt::CheckState::Checked); });
 }
 
-void LasModelScene::colorForest(bool b)
+void LasModelScene::step(OpenFrames::FramerateLimiter& waitLimiter)
 {
-	osg::Vec4 BLACK = osg::Vec4(0, 0, 0, 1);
-	osg::Vec4 WHITE = osg::Vec4(1, 1, 1, 1);
-	osg::Vec4 RED = osg::Vec4(1, 0, 0, 1);
-	osg::Vec4 GRAY = osg::Vec4(0.5, 0.5, 0.5, 1);
+	PCVR_Scene::step(waitLimiter);
 
-	for (PCVR_Selectable* sel : _selectables)
+	// Show the features the background threads computed since the last frame,
+	// and swap in point tables compacted after deletions.
+	_FM->lock();
+	for (LasModel* model : getLasModels())
 	{
-		ModelPoint* p = static_cast<ModelPoint*>(sel);
-		if (b)
+		model->updateFeatureColors();
+
+		std::vector<uint32_t> remap;
+		if (!model->updateCompaction(remap)) continue;
+		for (PCVR_Selection* selection : PCVR_Selection::GetSelections())
 		{
-			uint8_t c = p->GetClassification().GetClass();
-			switch (c)
-			{
-			case 1: // Unclassified
-				p->setColor(BLACK);
-				break;
-
-			case 2: // Ground
-				p->setColor(GRAY);
-				break;
-
-			case 3: // Unchanged
-				p->setColor(WHITE);
-				break;
-
-			case 4: // Destroyed by Hurricane Maria
-				p->setColor(RED);
-				break;
-			}
-		}
-		else {
-			p->setColor(BLACK);
+			SelectionDisk* disk = dynamic_cast<SelectionDisk*>(selection);
+			if (disk != nullptr) disk->remapSelection(model, remap);
 		}
 	}
-	static_cast<LasModel*>(_models[0])->getColors().dirty();
+	_FM->unlock();
+}
+
+void LasModelScene::colorForest(bool b)
+{
+	for (LasModel* model : getLasModels())
+	{
+		model->recolor(b ? _colorMode : LAS_COLOR_SOURCE);
+	}
 }
\ No newline at end of file
@@ -10,8 +10,10 @@ class LasModelScene : public ModelScene
 public:
 	LasModelScene();
 
+	void parseArgs(osg::ArgumentParser& args) override;
 	void buildScene() override;
 	std::vector<OpenFrames::Model*>& getModels();
+	std::vector<LasModel*> getLasModels();
 
 	// Qt
 	QLabel* _circumferenceLabel[2];
@@ -21,7 +23,22 @@ public:
 	QWidget* _panelWidget;
 
 private:
+	LasLoadOptions _lasOptions;
+	LasColorMode _colorMode = LAS_COLOR_CLASSIFICATION;	// applied by the color checkbox
+	std::string _changeFrom;		// earlier epoch to measure change against, if any
+	float _m3c2Radius = 0.0f;		// cylinder radius; 0 measures plain cloud-to-cloud distances
+	LasRegistrationOptions _registrationOptions;
+	bool _alignOnLoad = false;
+
+	void measureChange();
+	// Align every scan after the first onto the first one.
+	void alignScans();
+	// Delete the points inside every disk selection.
+	void deleteSelectedPoints();
+	// Write each LAS model, minus its deleted points, next to its source as <name>_edited.las.
+	void saveEditedPoints();
 
 	void setupMenuEventListeners(PCVR_Controller* controller) override;
+	void step(OpenFrames::FramerateLimiter& waitLimiter) override;
 	void colorForest(bool b);
 };
\ No newline at end of file
@@ -0,0 +1,627 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "json.hpp"
+
+#include "LasFileReader.hpp"
+#include "PCVR_Parallel.hpp"
+
+#include "LasOctree.hpp"
+
+namespace fs = std::experimental::filesystem;
+using json = nlohmann::json;
+
+namespace
+{
+	const std::size_t MAX_LEAF_POINTS = 50000;		// nodes with fewer points are not split
+	const int MAX_LEVEL = 20;
+	const int MAX_CHUNK_LEVEL = 4;					// at most 8^4 temporary chunk files
+	const uint64_t CHUNK_TARGET_POINTS = 10000000;
+	const std::size_t READ_BATCH_POINTS = 5000000;
+	const std::size_t FLUSH_POINTS = 20000000;		// buffered points before chunk files are appended
+
+	// Per-point layout of a node in octree.bin, one column after the other:
+	// float xyz, uint16 intensity, uint8 rgba, uint8 classification, return number, number of returns.
+	const std::size_t BYTES_PER_POINT = 12 + 2 + 4 + 1 + 1 + 1;
+}
+
+int LasOctreeNode::getLevel() const
+{
+	return static_cast<int>(name.size()) - 1;
+}
+
+
+// LasOctree methods
+
+LasOctree::LasOctree(const std::string& indexPath)
+{
+	std::ifstream ifs(indexPath);
+	if (!ifs) return;
+
+	json index;
+	try
+	{
+		ifs >> index;
+		if (index.at("version").get<int>() != FORMAT_VERSION)
+		{
+			std::cout << indexPath << " was written by an incompatible octree builder." << std::endl;
+			return;
+		}
+
+		const json& center = index.at("center");
+		_center.set(center[0].get<double>(), center[1].get<double>(), center[2].get<double>());
+		_numPoints = index.at("numPoints").get<uint64_t>();
+		float halfSize = index.at("halfSize").get<float>();
+		osg::BoundingBox cube(-halfSize, -halfSize, -halfSize, halfSize, halfSize, halfSize);
+
+		// Nodes are listed parents first, so each parent is already known.
+		std::map<std::string, int> nodeIndex;
+		for (const json& entry : index.at("nodes"))
+		{
+			LasOctreeNode node;
+			node.name = entry.at("name").get<std::string>();
+			node.numPoints = entry.at("points").get<uint32_t>();
+			node.offset = entry.at("offset").get<uint64_t>();
+			node.bounds = cube;
+			for (std::size_t i = 1; i < node.name.size(); i++)
+			{
+				node.bounds = ChildBounds(node.bounds, node.name[i] - '0');
+			}
+			node.spacing = (node.bounds.xMax() - node.bounds.xMin()) / GRID_SIZE;
+
+			int self = static_cast<int>(_nodes.size());
+			if (node.name.size() > 1)
+			{
+				auto parent = nodeIndex.find(node.name.substr(0, node.name.size() - 1));
+				if (parent == nodeIndex.end()) continue;
+				node.parent = parent->second;
+				_nodes[node.parent].children[node.name.back() - '0'] = self;
+			}
+			nodeIndex[node.name] = self;
+			_nodes.push_back(node);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Could not parse octree index " << indexPath << ": " << e.what() << std::endl;
+		_nodes.clear();
+		return;
+	}
+
+	std::string dataPath = (fs::path(indexPath).parent_path() / "octree.bin").string();
+	try
+	{
+		_data.open(dataPath);
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Could not map " << dataPath << ": " << e.what() << std::endl;
+		return;
+	}
+	_open = !_nodes.empty();
+}
+
+bool LasOctree::isOpen() const
+{
+	return _open;
+}
+
+const std::vector<LasOctreeNode>& LasOctree::getNodes() const
+{
+	return _nodes;
+}
+
+const osg::Vec3d& LasOctree::getCenter() const
+{
+	return _center;
+}
+
+uint64_t LasOctree::getNumPoints() const
+{
+	return _numPoints;
+}
+
+bool LasOctree::readNode(int index, LasPointTable& table) const
+{
+	const LasOctreeNode& node = _nodes.at(index);
+	std::size_t n = node.numPoints;
+	if (!_open || node.offset + NodeDataSize(node.numPoints) > _data.size()) return false;
+
+	table.resize(n);
+	if (n == 0) return true;
+
+	const char* data = _data.data() + node.offset;
+	std::memcpy(&table.positions->front(), data, n * 12);
+	data += n * 12;
+	std::memcpy(table.intensity.data(), data, n * 2);
+	data += n * 2;
+	std::memcpy(&table.colors->front(), data, n * 4);
+	data += n * 4;
+	std::memcpy(table.classification.data(), data, n);
+	data += n;
+	std::memcpy(table.returnNumber.data(), data, n);
+	data += n;
+	std::memcpy(table.numberOfReturns.data(), data, n);
+	return true;
+}
+
+bool LasOctree::readNode(int index, LasPointTable& table, const LasPointFilter& filter) const
+{
+	if (!filter.isActive()) return readNode(index, table);
+
+	const LasOctreeNode& node = _nodes.at(index);
+	std::size_t n = node.numPoints;
+	if (!_open || node.offset + NodeDataSize(node.numPoints) > _data.size()) return false;
+
+	const char* positions = _data.data() + node.offset;
+	const char* intensity = positions + n * 12;
+	const char* colors = intensity + n * 2;
+	const uint8_t* classification = reinterpret_cast<const uint8_t*>(colors + n * 4);
+	const uint8_t* returnNumber = classification + n;
+	const uint8_t* numberOfReturns = returnNumber + n;
+
+	// Pick the passing rows from the stored columns before anything is copied.
+	// Positions only need a look when the node straddles the filter bounds.
+	const osg::BoundingBoxd bounds = getSourceBounds(index);
+	const bool inside = !filter.hasBounds() || (filter.contains(bounds._min) && filter.contains(bounds._max));
+	std::vector<uint32_t> rows;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (!filter.acceptsClass(classification[i]) || !filter.acceptsReturn(returnNumber[i], numberOfReturns[i])) continue;
+		if (!inside)
+		{
+			osg::Vec3 p;
+			std::memcpy(p.ptr(), positions + i * 12, 12);
+			if (!filter.contains(_center + osg::Vec3d(p))) continue;
+		}
+		rows.push_back(i);
+	}
+
+	table.resize(rows.size());
+	for (std::size_t j = 0; j < rows.size(); j++)
+	{
+		const uint32_t i = rows[j];
+		std::memcpy((*table.positions)[j].ptr(), positions + i * 12, 12);
+		std::memcpy(&table.intensity[j], intensity + i * 2, 2);
+		std::memcpy((*table.colors)[j].ptr(), colors + i * 4, 4);
+		table.classification[j] = classification[i];
+		table.returnNumber[j] = returnNumber[i];
+		table.numberOfReturns[j] = numberOfReturns[i];
+	}
+	return true;
+}
+
+osg::BoundingBoxd LasOctree::getSourceBounds(int index) const
+{
+	const osg::BoundingBox& bounds = _nodes.at(index).bounds;
+	return osg::BoundingBoxd(_center + osg::Vec3d(bounds._min), _center + osg::Vec3d(bounds._max));
+}
+
+bool LasOctree::IsOctreeIndex(const std::string& path)
+{
+	return fs::path(path).filename() == "octree.json";
+}
+
+osg::BoundingBox LasOctree::ChildBounds(const osg::BoundingBox& parent, int octant)
+{
+	osg::Vec3 mid = parent.center();
+	osg::BoundingBox child = parent;
+	(octant & 1 ? child._min.x() : child._max.x()) = mid.x();
+	(octant & 2 ? child._min.y() : child._max.y()) = mid.y();
+	(octant & 4 ? child._min.z() : child._max.z()) = mid.z();
+	return child;
+}
+
+int LasOctree::ChildOctant(const osg::BoundingBox& parent, const osg::Vec3& p)
+{
+	osg::Vec3 mid = parent.center();
+	return (p.x() >= mid.x() ? 1 : 0) | (p.y() >= mid.y() ? 2 : 0) | (p.z() >= mid.z() ? 4 : 0);
+}
+
+std::size_t LasOctree::NodeDataSize(uint32_t numPoints)
+{
+	// Pad nodes to 4 bytes so every position column starts aligned.
+	return (numPoints * BYTES_PER_POINT + 3) & ~std::size_t(3);
+}
+
+
+// LasOctreeBuilder methods
+
+LasOctreeBuilder::LasOctreeBuilder(const std::vector<std::string>& inputs, const std::string& outDir)
+	: _inputs(inputs)
+	, _outDir(outDir)
+{
+}
+
+bool LasOctreeBuilder::build()
+{
+	uint64_t totalPoints = 0;
+	if (!computeBounds(totalPoints)) return false;
+
+	// Pick a chunk level that keeps each chunk to a few million points.
+	while (_chunkLevel < MAX_CHUNK_LEVEL && (totalPoints >> (3 * _chunkLevel)) > CHUNK_TARGET_POINTS)
+	{
+		_chunkLevel++;
+	}
+	std::cout << "Building octree of " << totalPoints << " points in " << _outDir
+		<< " (chunk level " << _chunkLevel << ")" << std::endl;
+
+	fs::create_directories(fs::path(_outDir) / "chunks");
+	std::map<uint32_t, uint64_t> chunkCounts;
+	if (!distributeToChunks(chunkCounts)) return false;
+
+	_out.open((fs::path(_outDir) / "octree.bin").string(), std::ios::binary | std::ios::trunc);
+	if (!_out)
+	{
+		std::cout << "Could not create octree.bin in " << _outDir << std::endl;
+		return false;
+	}
+
+	// Build each chunk's subtree; the points sampled into its root replace
+	// the chunk's file, for buildUpperLevels.
+	std::size_t chunksDone = 0;
+	for (auto& chunk : chunkCounts)
+	{
+		std::vector<BuildPoint> points;
+		if (!readChunk(chunk.first, chunk.second, points)) return false;
+
+		std::string name = chunkName(chunk.first);
+		osg::BoundingBox bounds = _cube;
+		for (std::size_t i = 1; i < name.size(); i++)
+		{
+			bounds = LasOctree::ChildBounds(bounds, name[i] - '0');
+		}
+		buildSubtree(name, bounds, points, true);
+		if (!writeChunk(chunk.first, points)) return false;
+		chunk.second = points.size();
+
+		std::cout << "Built chunk " << ++chunksDone << " of " << chunkCounts.size() << std::endl;
+	}
+
+	std::vector<BuildPoint> rootPoints;
+	if (!buildUpperLevels("r", _cube, 0, chunkCounts, rootPoints)) return false;
+	writeNode("r", rootPoints);
+	_out.close();
+	fs::remove_all(fs::path(_outDir) / "chunks");
+
+	return writeIndex(totalPoints);
+}
+
+bool LasOctreeBuilder::computeBounds(uint64_t& totalPoints)
+{
+	osg::BoundingBoxd bounds;
+	for (const std::string& path : _inputs)
+	{
+		LasHeader header;
+		if (!LasFileReader::ReadHeader(path, header))
+		{
+			std::cout << "Could not read LAS header of " << path << std::endl;
+			return false;
+		}
+		bounds.expandBy(osg::Vec3d(header.min[0], header.min[1], header.min[2]));
+		bounds.expandBy(osg::Vec3d(header.max[0], header.max[1], header.max[2]));
+		totalPoints += header.pointCount;
+	}
+	if (!bounds.valid()) return false;
+
+	// The octree is a cube around the union of the headers, padded so that
+	// points on the boundary still fall inside.
+	_center = bounds.center();
+	osg::Vec3d extent = bounds._max - bounds._min;
+	float halfSize = std::max(std::max(extent.x(), extent.y()), std::max(extent.z(), 1.0)) * 0.5 * 1.001;
+	_cube = osg::BoundingBox(-halfSize, -halfSize, -halfSize, halfSize, halfSize, halfSize);
+	return true;
+}
+
+bool LasOctreeBuilder::distributeToChunks(std::map<uint32_t, uint64_t>& chunkCounts)
+{
+	std::map<uint32_t, std::vector<BuildPoint>> buffers;
+	std::size_t buffered = 0;
+
+	auto flush = [&]()
+	{
+		for (auto& buffer : buffers)
+		{
+			std::ofstream ofs(chunkPath(buffer.first), std::ios::binary | std::ios::app);
+			ofs.write(reinterpret_cast<const char*>(buffer.second.data()), buffer.second.size() * sizeof(BuildPoint));
+			chunkCounts[buffer.first] += buffer.second.size();
+		}
+		buffers.clear();
+		buffered = 0;
+	};
+
+	LasPointTable table;
+	std::vector<BuildPoint> points;
+	std::vector<uint32_t> chunks;
+	for (const std::string& path : _inputs)
+	{
+		// Only the batch being read is mapped, so inputs may exceed memory.
+		LasFileReader reader(path, false);
+		std::size_t numPoints = reader.getNumPoints();
+		std::cout << "Distributing " << numPoints << " points of " << path << std::endl;
+
+		for (std::size_t first = 0; first < numPoints; first += READ_BATCH_POINTS)
+		{
+			if (!reader.readPoints(table, _center, first, READ_BATCH_POINTS)) return false;
+
+			std::size_t n = table.size();
+			points.resize(n);
+			chunks.resize(n);
+			parallelFor(0, n, [&](std::size_t begin, std::size_t end)
+			{
+				for (std::size_t i = begin; i < end; i++)
+				{
+					BuildPoint& p = points[i];
+					const osg::Vec4ub& c = (*table.colors)[i];
+					p.pos = (*table.positions)[i];
+					p.intensity = table.intensity[i];
+					for (int k = 0; k < 3; k++)
+					{
+						p.color[k] = c[k];
+					}
+					p.classification = table.classification[i];
+					p.returnNumber = table.returnNumber[i];
+					p.numberOfReturns = table.numberOfReturns[i];
+					chunks[i] = chunkOf(p.pos);
+				}
+			});
+
+			for (std::size_t i = 0; i < n; i++)
+			{
+				buffers[chunks[i]].push_back(points[i]);
+			}
+			buffered += n;
+			if (buffered >= FLUSH_POINTS) flush();
+		}
+	}
+	flush();
+	return true;
+}
+
+uint32_t LasOctreeBuilder::chunkOf(const osg::Vec3& p) const
+{
+	// Descend with the same octant test as the rest of the build, so chunk
+	// membership always agrees with the node bounds.
+	uint32_t chunk = 0;
+	osg::BoundingBox bounds = _cube;
+	for (int level = 0; level < _chunkLevel; level++)
+	{
+		int octant = LasOctree::ChildOctant(bounds, p);
+		chunk = chunk * 8 + octant;
+		bounds = LasOctree::ChildBounds(bounds, octant);
+	}
+	return chunk;
+}
+
+std::string LasOctreeBuilder::chunkPath(uint32_t chunk) const
+{
+	return (fs::path(_outDir) / "chunks" / (std::to_string(chunk) + ".bin")).string();
+}
+
+bool LasOctreeBuilder::readChunk(uint32_t chunk, uint64_t count, std::vector<BuildPoint>& points) const
+{
+	std::string path = chunkPath(chunk);
+	points.resize(count);
+	std::ifstream ifs(path, std::ios::binary);
+	ifs.read(reinterpret_cast<char*>(points.data()), points.size() * sizeof(BuildPoint));
+	if (!ifs || static_cast<std::size_t>(ifs.gcount()) != points.size() * sizeof(BuildPoint))
+	{
+		std::cout << "Could not read " << count << " points from chunk file " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool LasOctreeBuilder::writeChunk(uint32_t chunk, const std::vector<BuildPoint>& points) const
+{
+	std::string path = chunkPath(chunk);
+	std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+	ofs.write(reinterpret_cast<const char*>(points.data()), points.size() * sizeof(BuildPoint));
+	if (!ofs)
+	{
+		std::cout << "Could not write chunk file " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+std::string LasOctreeBuilder::chunkName(uint32_t chunk) const
+{
+	std::string digits;
+	for (int level = 0; level < _chunkLevel; level++)
+	{
+		digits.insert(digits.begin(), static_cast<char>('0' + chunk % 8));
+		chunk /= 8;
+	}
+	return "r" + digits;
+}
+
+void LasOctreeBuilder::buildSubtree(const std::string& name, const osg::BoundingBox& bounds,
+	std::vector<BuildPoint>& points, bool isChunkRoot)
+{
+	int level = static_cast<int>(name.size()) - 1;
+	if (points.size() <= MAX_LEAF_POINTS || level >= MAX_LEVEL)
+	{
+		if (!isChunkRoot) writeNode(name, points);
+		return;
+	}
+
+	std::vector<BuildPoint> rest;
+	sample(bounds, points, rest);
+
+	std::vector<BuildPoint> children[8];
+	for (const BuildPoint& p : rest)
+	{
+		children[LasOctree::ChildOctant(bounds, p.pos)].push_back(p);
+	}
+	std::vector<BuildPoint>().swap(rest);
+
+	// A chunk root's own points are kept for buildUpperLevels.
+	if (!isChunkRoot)
+	{
+		writeNode(name, points);
+		std::vector<BuildPoint>().swap(points);
+	}
+
+	auto buildChild = [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			if (children[i].empty()) continue;
+			buildSubtree(name + static_cast<char>('0' + i), LasOctree::ChildBounds(bounds, i), children[i], false);
+			std::vector<BuildPoint>().swap(children[i]);
+		}
+	};
+	if (isChunkRoot)
+	{
+		parallelFor(0, 8, buildChild, 1);
+	}
+	else
+	{
+		buildChild(0, 8);
+	}
+}
+
+bool LasOctreeBuilder::buildUpperLevels(const std::string& name, const osg::BoundingBox& bounds, uint32_t chunk,
+	const std::map<uint32_t, uint64_t>& rootCounts, std::vector<BuildPoint>& points)
+{
+	// A chunk root starts out with the points its subtree sampled.
+	int level = static_cast<int>(name.size()) - 1;
+	if (level >= _chunkLevel)
+	{
+		auto count = rootCounts.find(chunk);
+		if (count == rootCounts.end()) return true;
+		return readChunk(chunk, count->second, points);
+	}
+
+	// Bottom up, so only the nodes on the path to the current chunk are held:
+	// this node samples the points its children would otherwise keep, writes
+	// the children with the rest, and passes its sample on to its parent.
+	std::vector<BuildPoint> children[8];
+	for (int i = 0; i < 8; i++)
+	{
+		if (!buildUpperLevels(name + static_cast<char>('0' + i), LasOctree::ChildBounds(bounds, i), chunk * 8 + i,
+			rootCounts, children[i]))
+		{
+			return false;
+		}
+		points.insert(points.end(), children[i].begin(), children[i].end());
+		std::vector<BuildPoint>().swap(children[i]);
+	}
+
+	std::vector<BuildPoint> rest;
+	sample(bounds, points, rest);
+	for (const BuildPoint& p : rest)
+	{
+		children[LasOctree::ChildOctant(bounds, p.pos)].push_back(p);
+	}
+	std::vector<BuildPoint>().swap(rest);
+	for (int i = 0; i < 8; i++)
+	{
+		if (!children[i].empty()) writeNode(name + static_cast<char>('0' + i), children[i]);
+	}
+	return true;
+}
+
+void LasOctreeBuilder::sample(const osg::BoundingBox& bounds, std::vector<BuildPoint>& points,
+	std::vector<BuildPoint>& rest) const
+{
+	// Keep the first point to land in each cell of the node's sampling grid,
+	// and pass every other point on to the children.
+	const int G = LasOctree::GRID_SIZE;
+	const float invCell = G / (bounds.xMax() - bounds.xMin());
+	std::vector<uint64_t> occupied((G * G * G + 63) / 64, 0);
+
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		const osg::Vec3& p = points[i].pos;
+		int ix = std::min(std::max(static_cast<int>((p.x() - bounds.xMin()) * invCell), 0), G - 1);
+		int iy = std::min(std::max(static_cast<int>((p.y() - bounds.yMin()) * invCell), 0), G - 1);
+		int iz = std::min(std::max(static_cast<int>((p.z() - bounds.zMin()) * invCell), 0), G - 1);
+		uint32_t cell = ix + G * (iy + G * iz);
+		uint64_t bit = uint64_t(1) << (cell & 63);
+
+		if (occupied[cell >> 6] & bit)
+		{
+			rest.push_back(points[i]);
+		}
+		else
+		{
+			occupied[cell >> 6] |= bit;
+			points[kept++] = points[i];
+		}
+	}
+	points.resize(kept);
+}
+
+void LasOctreeBuilder::writeNode(const std::string& name, const std::vector<BuildPoint>& points)
+{
+	std::size_t n = points.size();
+	std::vector<char> data(LasOctree::NodeDataSize(n), 0);
+
+	char* positions = data.data();
+	char* intensity = positions + n * 12;
+	char* colors = intensity + n * 2;
+	char* classification = colors + n * 4;
+	char* returnNumber = classification + n;
+	char* numberOfReturns = returnNumber + n;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		const BuildPoint& p = points[i];
+		std::memcpy(positions + i * 12, p.pos.ptr(), 12);
+		std::memcpy(intensity + i * 2, &p.intensity, 2);
+		colors[i * 4] = p.color[0];
+		colors[i * 4 + 1] = p.color[1];
+		colors[i * 4 + 2] = p.color[2];
+		colors[i * 4 + 3] = (char)UCHAR_MAX;
+		classification[i] = p.classification;
+		returnNumber[i] = p.returnNumber;
+		numberOfReturns[i] = p.numberOfReturns;
+	}
+
+	std::lock_guard<std::mutex> lock(_writeMutex);
+	_out.write(data.data(), data.size());
+	_written[name] = std::make_pair(static_cast<uint32_t>(n), _outOffset);
+	_outOffset += data.size();
+}
+
+bool LasOctreeBuilder::writeIndex(uint64_t totalPoints)
+{
+	// Every ancestor of a written node must be listed, even if it ended up empty.
+	std::map<std::string, std::pair<uint32_t, uint64_t>> nodes = _written;
+	for (auto& node : _written)
+	{
+		for (std::size_t len = 1; len < node.first.size(); len++)
+		{
+			nodes.insert(std::make_pair(node.first.substr(0, len), std::make_pair(0u, uint64_t(0))));
+		}
+	}
+
+	// Parents before children: order by level, then name.
+	std::vector<std::string> names;
+	for (auto& node : nodes) names.push_back(node.first);
+	std::stable_sort(names.begin(), names.end(),
+		[](const std::string& a, const std::string& b) { return a.size() < b.size(); });
+
+	json index;
+	index["version"] = LasOctree::FORMAT_VERSION;
+	index["center"] = { _center.x(), _center.y(), _center.z() };
+	index["halfSize"] = _cube.xMax();
+	index["numPoints"] = totalPoints;
+	index["nodes"] = json::array();
+	for (const std::string& name : names)
+	{
+		index["nodes"].push_back({ { "name", name }, { "points", nodes[name].first }, { "offset", nodes[name].second } });
+	}
+
+	std::ofstream ofs((fs::path(_outDir) / "octree.json").string());
+	if (!ofs) return false;
+	ofs << index.dump(1) << std::endl;
+
+	std::cout << "Wrote " << names.size() << " octree nodes to " << _outDir << std::endl;
+	return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <osg/BoundingBox>
+#include <osg/Vec3d>
+
+#include "LasPointFilter.hpp"
+#include "LasPointTable.hpp"
+
+// One node of an octree written by LasOctreeBuilder.
+struct LasOctreeNode
+{
+	std::string name;			// "r" for the root, then one octant digit per level
+	int parent = -1;
+	int children[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+	uint32_t numPoints = 0;
+	uint64_t offset = 0;		// byte offset of the node's points in octree.bin
+	osg::BoundingBox bounds;	// cube, in the octree's centered frame
+	float spacing = 0.0f;		// sampling grid cell size at this level
+
+	int getLevel() const;
+};
+
+//-----------------------------------------------------------------------------
+// LasOctree
+//    Read side of the on-disk LOD octree. The hierarchy comes from
+// octree.json, and octree.bin is memory-mapped so nodes can be decoded into a
+// LasPointTable from any thread.
+//
+//    The octree is additive (Potree-style nested subsampling): every point is
+// stored once, in the coarsest node whose sampling grid still had a free cell
+// for it. Drawing a node together with all of its ancestors therefore gives
+// the full density of that region.
+//-----------------------------------------------------------------------------
+class LasOctree
+{
+public:
+	static const int GRID_SIZE = 128;		// sampling cells per node edge
+	static const int FORMAT_VERSION = 1;
+
+	LasOctree(const std::string& indexPath);
+
+	bool isOpen() const;
+	const std::vector<LasOctreeNode>& getNodes() const;
+	const osg::Vec3d& getCenter() const;	// source coordinates of the octree origin
+	uint64_t getNumPoints() const;
+
+	// Decode one node's points into the table, replacing its contents.
+	bool readNode(int index, LasPointTable& table) const;
+	// Same, keeping only the points that pass the filter.
+	bool readNode(int index, LasPointTable& table, const LasPointFilter& filter) const;
+	// Source-coordinate bounds of a node.
+	osg::BoundingBoxd getSourceBounds(int index) const;
+
+	static bool IsOctreeIndex(const std::string& path);
+	static osg::BoundingBox ChildBounds(const osg::BoundingBox& parent, int octant);
+	static int ChildOctant(const osg::BoundingBox& parent, const osg::Vec3& p);
+	static std::size_t NodeDataSize(uint32_t numPoints);
+
+private:
+	boost::iostreams::mapped_file_source _data;
+	std::vector<LasOctreeNode> _nodes;
+	osg::Vec3d _center;
+	uint64_t _numPoints = 0;
+	bool _open = false;
+};
+
+//-----------------------------------------------------------------------------
+// LasOctreeBuilder
+//    Preprocessing step for --buildOctree. Builds an octree from one or more
+// LAS files without holding them in memory at once:
+//  1) Points are streamed from each file and bucketed into temporary chunk
+//     files, one per cell of a coarse grid at the "chunk level".
+//  2) Each chunk is loaded on its own and its subtree is built by nested
+//     subsampling, with the children of the chunk root built in parallel.
+//  3) The sampled points left at each chunk root replace its chunk file, and
+//     the levels above the chunk level are built bottom up from those files,
+//     each node subsampling what its children kept. Only the nodes on the
+//     path to the chunk being read are in memory at once.
+// Nodes are appended to octree.bin as they are finished, and the hierarchy is
+// written to octree.json at the end.
+//-----------------------------------------------------------------------------
+class LasOctreeBuilder
+{
+public:
+	LasOctreeBuilder(const std::vector<std::string>& inputs, const std::string& outDir);
+
+	bool build();
+
+	// Compact per-point record used while building.
+	struct BuildPoint
+	{
+		osg::Vec3 pos;
+		uint16_t intensity;
+		uint8_t color[3];
+		uint8_t classification;
+		uint8_t returnNumber;
+		uint8_t numberOfReturns;
+	};
+
+private:
+	std::vector<std::string> _inputs;
+	std::string _outDir;
+
+	osg::Vec3d _center;
+	osg::BoundingBox _cube;
+	int _chunkLevel = 0;
+
+	std::mutex _writeMutex;
+	std::ofstream _out;
+	uint64_t _outOffset = 0;
+	std::map<std::string, std::pair<uint32_t, uint64_t>> _written;	// name -> (points, offset)
+
+	bool computeBounds(uint64_t& totalPoints);
+	bool distributeToChunks(std::map<uint32_t, uint64_t>& chunkCounts);
+	uint32_t chunkOf(const osg::Vec3& p) const;
+	std::string chunkPath(uint32_t chunk) const;
+	std::string chunkName(uint32_t chunk) const;
+	bool readChunk(uint32_t chunk, uint64_t count, std::vector<BuildPoint>& points) const;
+	bool writeChunk(uint32_t chunk, const std::vector<BuildPoint>& points) const;
+
+	void buildSubtree(const std::string& name, const osg::BoundingBox& bounds,
+		std::vector<BuildPoint>& points, bool isChunkRoot);
+	bool buildUpperLevels(const std::string& name, const osg::BoundingBox& bounds, uint32_t chunk,
+		const std::map<uint32_t, uint64_t>& rootCounts, std::vector<BuildPoint>& points);
+	void sample(const osg::BoundingBox& bounds, std::vector<BuildPoint>& points,
+		std::vector<BuildPoint>& rest) const;
+	void writeNode(const std::string& name, const std::vector<BuildPoint>& points);
+	bool writeIndex(uint64_t totalPoints);
+};
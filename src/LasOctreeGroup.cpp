@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cfloat>
+#include <queue>
+
+#include <osg/Geometry>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasOctreeGroup.hpp"
+
+namespace
+{
+	const unsigned int MAX_PAGER_THREADS = 2;
+	const std::size_t MAX_REQUESTS = 64;	// nodes handed to the pagers per frame
+}
+
+LasOctreeBudget::LasOctreeBudget(std::size_t pointBudget, std::size_t cacheBudget)
+	: _pointBudget(pointBudget)
+	, _cacheBudget(cacheBudget)
+	, _cachedPoints(0)
+{
+}
+
+void LasOctreeBudget::startFrame(unsigned int frame)
+{
+	if (frame == _frame) return;
+	_lastInView = std::max<std::size_t>(_inView, 1);
+	_inView = 0;
+	_frame = frame;
+}
+
+std::size_t LasOctreeBudget::getPointShare(unsigned int frame)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	startFrame(frame);
+	return _pointBudget / _lastInView;
+}
+
+void LasOctreeBudget::markInView(unsigned int frame)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	startFrame(frame);
+	_inView++;
+}
+
+void LasOctreeBudget::addCachedPoints(std::size_t n)
+{
+	_cachedPoints += n;
+}
+
+void LasOctreeBudget::removeCachedPoints(std::size_t n)
+{
+	_cachedPoints -= n;
+}
+
+bool LasOctreeBudget::isOverCacheBudget() const
+{
+	return _cachedPoints > _cacheBudget;
+}
+
+LasOctreeGroup::LasOctreeGroup(std::unique_ptr<LasOctree> octree, const LasLoadOptions& options)
+	: _octree(std::move(octree))
+	, _options(options)
+	, _budget(options.octreeBudget ? options.octreeBudget
+		: std::make_shared<LasOctreeBudget>(options.pointBudget, options.cacheBudget))
+	, _cache(_octree->getNodes().size())
+	, _pending(_octree->getNodes().size(), 0)
+{
+	// Traverse every frame even though this group has no children of its own.
+	setCullingActive(false);
+
+	// Nodes outside the load filter's bounds are never read or drawn, and
+	// neither are their children, which lie inside them.
+	_skipped.resize(_octree->getNodes().size(), 0);
+	for (std::size_t i = 0; i < _skipped.size(); i++)
+	{
+		_skipped[i] = !_options.filter.overlaps(_octree->getSourceBounds(i));
+	}
+
+	unsigned int numPagers = std::min(numWorkerThreads(), MAX_PAGER_THREADS);
+	for (unsigned int i = 0; i < numPagers; i++)
+	{
+		_pagers.emplace_back(&LasOctreeGroup::pagerLoop, this);
+	}
+}
+
+LasOctreeGroup::~LasOctreeGroup()
+{
+	{
+		std::lock_guard<std::mutex> lock(_pagerMutex);
+		_stop = true;
+	}
+	_pagerWake.notify_all();
+	for (std::thread& t : _pagers)
+	{
+		t.join();
+	}
+	_budget->removeCachedPoints(_cachedPoints);
+}
+
+const LasOctree& LasOctreeGroup::getOctree() const
+{
+	return *_octree;
+}
+
+osg::BoundingSphere LasOctreeGroup::computeBound() const
+{
+	const std::vector<LasOctreeNode>& nodes = _octree->getNodes();
+	if (nodes.empty()) return osg::BoundingSphere();
+	return osg::BoundingSphere(nodes[0].bounds);
+}
+
+void LasOctreeGroup::traverse(osg::NodeVisitor& nv)
+{
+	osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>(&nv);
+	if (cv && !_octree->getNodes().empty())
+	{
+		// Both eyes may cull at once, and they share one node cache.
+		std::lock_guard<std::mutex> lock(_cullMutex);
+		cull(*cv);
+		return;
+	}
+	osg::Group::traverse(nv);
+}
+
+void LasOctreeGroup::cull(osgUtil::CullVisitor& cv)
+{
+	unsigned int frame = cv.getFrameStamp() ? cv.getFrameStamp()->getFrameNumber() : 0;
+	collectLoaded(frame);
+
+	const std::vector<LasOctreeNode>& nodes = _octree->getNodes();
+	typedef std::pair<float, int> Candidate;	// (projected size, node)
+	std::priority_queue<Candidate> candidates;
+	candidates.push(Candidate(FLT_MAX, 0));
+
+	std::vector<Candidate> wanted;
+	const std::size_t pointBudget = _budget->getPointShare(frame);
+	std::size_t drawnPoints = 0;
+	while (!candidates.empty() && drawnPoints < pointBudget)
+	{
+		Candidate c = candidates.top();
+		candidates.pop();
+
+		const LasOctreeNode& node = nodes[c.second];
+		if (_skipped[c.second] || cv.isCulled(node.bounds)) continue;
+
+		CachedNode& cached = _cache[c.second];
+		if (!cached.geode.valid())
+		{
+			// Children are refinements of this node, so wait for it first.
+			wanted.push_back(c);
+			continue;
+		}
+
+		cached.lastUsed = frame;
+		if (node.numPoints > 0)
+		{
+			cached.geode->accept(cv);
+			drawnPoints += node.numPoints;
+		}
+
+		osg::Vec3 center = node.bounds.center();
+		if (cv.clampedPixelSize(center, node.spacing) <= _options.screenSpaceError) continue;
+
+		for (int child : node.children)
+		{
+			if (child < 0) continue;
+			const osg::BoundingBox& bounds = nodes[child].bounds;
+			candidates.push(Candidate(cv.clampedPixelSize(bounds.center(), bounds.radius()), child));
+		}
+	}
+
+	// Both eyes cull each frame; count this octree once.
+	if ((drawnPoints > 0 || !wanted.empty()) && _inViewFrame != frame + 1)
+	{
+		_budget->markInView(frame);
+		_inViewFrame = frame + 1;
+	}
+
+	// Hand the pagers this frame's most important missing nodes.
+	std::sort(wanted.begin(), wanted.end());
+	if (wanted.size() > MAX_REQUESTS)
+	{
+		wanted.erase(wanted.begin(), wanted.end() - MAX_REQUESTS);
+	}
+	{
+		std::lock_guard<std::mutex> lock(_pagerMutex);
+		_requests.clear();
+		for (const Candidate& c : wanted)
+		{
+			_requests.push_back(c.second);
+		}
+	}
+	if (!wanted.empty()) _pagerWake.notify_all();
+
+	evict(frame);
+}
+
+void LasOctreeGroup::collectLoaded(unsigned int frame)
+{
+	std::vector<std::pair<int, osg::ref_ptr<osg::Geode>>> loaded;
+	{
+		std::lock_guard<std::mutex> lock(_pagerMutex);
+		loaded.swap(_loaded);
+		for (auto& node : loaded)
+		{
+			_pending[node.first] = 0;
+		}
+	}
+
+	for (auto& node : loaded)
+	{
+		CachedNode& cached = _cache[node.first];
+		if (cached.geode.valid()) continue;
+		cached.geode = node.second;
+		cached.lastUsed = frame;
+		_cachedPoints += _octree->getNodes()[node.first].numPoints;
+		_budget->addCachedPoints(_octree->getNodes()[node.first].numPoints);
+	}
+}
+
+void LasOctreeGroup::evict(unsigned int frame)
+{
+	if (!_budget->isOverCacheBudget()) return;
+
+	// Drop nodes that were not drawn this frame, least recently drawn first.
+	// Deeper nodes go before their ancestors when both are equally stale.
+	const std::vector<LasOctreeNode>& nodes = _octree->getNodes();
+	std::vector<int> stale;
+	for (std::size_t i = 0; i < _cache.size(); i++)
+	{
+		if (_cache[i].geode.valid() && _cache[i].lastUsed != frame) stale.push_back(i);
+	}
+	std::sort(stale.begin(), stale.end(), [&](int a, int b)
+	{
+		if (_cache[a].lastUsed != _cache[b].lastUsed) return _cache[a].lastUsed < _cache[b].lastUsed;
+		return nodes[a].getLevel() > nodes[b].getLevel();
+	});
+
+	for (int i : stale)
+	{
+		if (!_budget->isOverCacheBudget()) break;
+		_cache[i].geode = nullptr;
+		_cachedPoints -= nodes[i].numPoints;
+		_budget->removeCachedPoints(nodes[i].numPoints);
+	}
+}
+
+void LasOctreeGroup::pagerLoop()
+{
+	while (true)
+	{
+		int index = -1;
+		{
+			std::unique_lock<std::mutex> lock(_pagerMutex);
+			_pagerWake.wait(lock, [this]() { return _stop || !_requests.empty(); });
+			if (_stop) return;
+
+			index = _requests.back();
+			_requests.pop_back();
+			if (_pending[index]) continue;
+			_pending[index] = 1;
+		}
+
+		osg::ref_ptr<osg::Geode> geode = createNodeGeode(index);
+
+		std::lock_guard<std::mutex> lock(_pagerMutex);
+		if (geode.valid())
+		{
+			_loaded.push_back(std::make_pair(index, geode));
+		}
+		else
+		{
+			_pending[index] = 0;
+		}
+	}
+}
+
+osg::ref_ptr<osg::Geode> LasOctreeGroup::createNodeGeode(int index) const
+{
+	LasPointTable table;
+	if (!_octree->readNode(index, table, _options.filter)) return nullptr;
+
+	// Geometry only; the point state is shared through this group's StateSet.
+	osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+	if (!table.empty())
+	{
+		osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+		geometry->setUseDisplayList(false);
+		geometry->setUseVertexBufferObjects(true);
+		geometry->setVertexArray(table.positions);
+		geometry->setColorArray(table.colors, osg::Array::BIND_PER_VERTEX);
+		geometry->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, table.size()));
+		geode->addDrawable(geometry);
+	}
+	geode->setDataVariance(osg::Object::STATIC);
+	return geode;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <osg/Geode>
+#include <osg/Group>
+#include <osgUtil/CullVisitor>
+
+#include "LasLoadOptions.hpp"
+#include "LasOctree.hpp"
+
+//-----------------------------------------------------------------------------
+// LasOctreeBudget
+//    The point budgets of every octree in a scene, so tiles drawn side by side
+// share --pointBudget and --cacheBudget instead of each taking all of them.
+// The points drawn in a frame are split evenly among the octrees that were in
+// view the frame before. Paged-in points are counted across all octrees, and
+// each one drops its own stale nodes while the total is over budget.
+//-----------------------------------------------------------------------------
+class LasOctreeBudget
+{
+public:
+	LasOctreeBudget(std::size_t pointBudget, std::size_t cacheBudget);
+
+	// Most points one octree may draw in the given frame. Each octree in view
+	// calls markInView once per frame, after its walk.
+	std::size_t getPointShare(unsigned int frame);
+	void markInView(unsigned int frame);
+
+	void addCachedPoints(std::size_t n);
+	void removeCachedPoints(std::size_t n);
+	bool isOverCacheBudget() const;
+
+private:
+	const std::size_t _pointBudget;
+	const std::size_t _cacheBudget;
+	std::atomic<std::size_t> _cachedPoints;
+
+	std::mutex _mutex;
+	unsigned int _frame = 0;
+	std::size_t _inView = 0;		// octrees marked in view in _frame so far
+	std::size_t _lastInView = 1;	// and in the frame before
+
+	void startFrame(unsigned int frame);
+};
+
+//-----------------------------------------------------------------------------
+// LasOctreeGroup
+//    Draws a LasOctree written by --buildOctree without loading all of it.
+// Each cull traversal walks the hierarchy from the root, most visible nodes
+// first, and refines a node while its point spacing projects to more than
+// screenSpaceError pixels. The walk stops once the octree's share of the
+// scene's point budget has been drawn for the frame.
+//
+//    Nodes that the walk wants but are not loaded are queued for the pager
+// threads, which decode them from the mapped octree.bin and hand back ready
+// geodes. Loaded nodes stay cached until the scene's octrees hold more than
+// the cache budget, and then the least recently drawn ones are dropped. Since the octree is
+// additive, a node is only drawn below a loaded parent, so paging in never
+// leaves holes.
+//
+//    The points of each node are filtered by the load options' point filter
+// as the node is read, and nodes outside its bounds are skipped entirely.
+//-----------------------------------------------------------------------------
+class LasOctreeGroup : public osg::Group
+{
+public:
+	LasOctreeGroup(std::unique_ptr<LasOctree> octree, const LasLoadOptions& options);
+
+	void traverse(osg::NodeVisitor& nv) override;
+	osg::BoundingSphere computeBound() const override;
+
+	const LasOctree& getOctree() const;
+
+protected:
+	virtual ~LasOctreeGroup();
+
+private:
+	struct CachedNode
+	{
+		osg::ref_ptr<osg::Geode> geode;
+		unsigned int lastUsed = 0;		// frame number of the last cull that drew it
+	};
+
+	std::unique_ptr<LasOctree> _octree;
+	LasLoadOptions _options;
+	std::shared_ptr<LasOctreeBudget> _budget;
+	std::vector<char> _skipped;		// nodes entirely outside the filter bounds
+
+	// Touched only by the cull traversal (serialized by _cullMutex)
+	std::mutex _cullMutex;
+	std::vector<CachedNode> _cache;
+	std::size_t _cachedPoints = 0;		// this octree's part of the budget's count
+	unsigned int _inViewFrame = 0;		// the last frame marked in view, plus one
+
+	// Shared with the pager threads
+	std::mutex _pagerMutex;
+	std::condition_variable _pagerWake;
+	std::vector<int> _requests;			// wanted nodes, most important last
+	std::vector<char> _pending;			// being read, or read but not yet collected
+	std::vector<std::pair<int, osg::ref_ptr<osg::Geode>>> _loaded;
+	std::vector<std::thread> _pagers;
+	bool _stop = false;
+
+	void cull(osgUtil::CullVisitor& cv);
+	void collectLoaded(unsigned int frame);
+	void evict(unsigned int frame);
+	void pagerLoop();
+	osg::ref_ptr<osg::Geode> createNodeGeode(int index) const;
+};
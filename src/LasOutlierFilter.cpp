@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cmath>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasOutlierFilter.hpp"
+
+namespace
+{
+	const std::size_t QUERY_BLOCK = 4096;		// tree slots per statistics block
+	const unsigned int MAX_NEIGHBORS = 256;
+}
+
+std::size_t findStatisticalOutliers(const PCVR_KdTree& tree, unsigned int k, float sigma,
+	std::vector<char>& outlier)
+{
+	const std::size_t n = tree.size();
+	outlier.assign(n, 0);
+	k = std::min(k, MAX_NEIGHBORS);
+	if (n <= k || k == 0) return 0;
+
+	// Query in tree order, so neighboring queries touch the same leaves.
+	// Each block also keeps its partial sums for the global statistics.
+	std::vector<float> meanDistance(n);
+	const std::size_t numBlocks = (n + QUERY_BLOCK - 1) / QUERY_BLOCK;
+	std::vector<double> blockSum(numBlocks, 0.0), blockSum2(numBlocks, 0.0);
+	parallelFor(0, numBlocks, [&](std::size_t firstBlock, std::size_t lastBlock)
+	{
+		uint32_t indices[MAX_NEIGHBORS + 1];
+		float dist2[MAX_NEIGHBORS + 1];
+		for (std::size_t b = firstBlock; b < lastBlock; b++)
+		{
+			for (std::size_t slot = b * QUERY_BLOCK; slot < std::min((b + 1) * QUERY_BLOCK, n); slot++)
+			{
+				// The point finds itself first; skip it.
+				unsigned int found = tree.findNearest(tree.getTreePoint(slot), k + 1, indices, dist2);
+				float sum = 0.0f;
+				for (unsigned int j = 1; j < found; j++)
+				{
+					sum += std::sqrt(dist2[j]);
+				}
+				float mean = found > 1 ? sum / (found - 1) : 0.0f;
+				meanDistance[tree.getTreeIndex(slot)] = mean;
+				blockSum[b] += mean;
+				blockSum2[b] += double(mean) * mean;
+			}
+		}
+	});
+
+	double sum = 0.0, sum2 = 0.0;
+	for (std::size_t b = 0; b < numBlocks; b++)
+	{
+		sum += blockSum[b];
+		sum2 += blockSum2[b];
+	}
+	const double mean = sum / n;
+	const double stddev = std::sqrt(std::max(0.0, sum2 / n - mean * mean));
+	const float threshold = static_cast<float>(mean + sigma * stddev);
+
+	std::size_t numOutliers = 0;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		outlier[i] = meanDistance[i] > threshold;
+		numOutliers += outlier[i];
+	}
+	return numOutliers;
+}
+
+std::size_t removeStatisticalOutliers(LasPointTable& table, unsigned int k, float sigma)
+{
+	if (table.empty()) return 0;
+
+	std::vector<char> outlier;
+	{
+		PCVR_KdTree tree;
+		tree.build(&table.positions->front(), table.size());
+		if (findStatisticalOutliers(tree, k, sigma, outlier) == 0) return 0;
+	}
+	return table.erase(outlier);
+}
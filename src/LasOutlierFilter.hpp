@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+#include "LasPointTable.hpp"
+#include "PCVR_KdTree.hpp"
+
+//-----------------------------------------------------------------------------
+// Statistical outlier removal
+//    For every point, the mean distance to its k nearest neighbors is found
+// through a shared PCVR_KdTree, one parallel query per point. A point is an
+// outlier when its mean distance is more than 'sigma' standard deviations
+// above the mean over all points, which singles out isolated returns (birds,
+// multipath) while leaving sparse but consistent regions alone.
+//-----------------------------------------------------------------------------
+
+// Sets outlier[i] for each outlying point of the tree's points and returns
+// how many there are.
+std::size_t findStatisticalOutliers(const PCVR_KdTree& tree, unsigned int k, float sigma,
+	std::vector<char>& outlier);
+
+// Builds a tree over the table, then removes the outliers from it. Returns
+// the number of points removed.
+std::size_t removeStatisticalOutliers(LasPointTable& table, unsigned int k, float sigma);
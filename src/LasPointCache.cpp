@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasPointCache.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	// Bump whenever the layout below or the format of a table column changes.
+	const uint32_t CACHE_VERSION = 3;
+	const char CACHE_MAGIC[8] = { 'P', 'C', 'V', 'R', 'L', 'A', 'S', 'C' };
+	const std::size_t COLUMN_ALIGNMENT = 16;
+	const std::size_t SHIFT_BLOCK = 65536;		// points shifted to the file's center per write
+
+	struct CacheHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t reserved;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		double center[3];		// what the positions are relative to
+		uint64_t numPoints;
+		float boundsMin[3];
+		float boundsMax[3];
+	};
+	static_assert(sizeof(CacheHeader) == 88, "CacheHeader must not contain padding");
+
+	std::size_t alignUp(std::size_t offset)
+	{
+		return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+	}
+
+	// The table columns in file order, each starting on a COLUMN_ALIGNMENT boundary.
+	template <typename Visitor>
+	void forEachColumn(const LasPointTable& table, Visitor visit)
+	{
+		visit(table.positions->empty() ? nullptr : &table.positions->front(), sizeof(osg::Vec3));
+		visit(table.colors->empty() ? nullptr : &table.colors->front(), sizeof(osg::Vec4ub));
+		visit(table.classification.data(), sizeof(uint8_t));
+		visit(table.intensity.data(), sizeof(uint16_t));
+		visit(table.returnNumber.data(), sizeof(uint8_t));
+		visit(table.numberOfReturns.data(), sizeof(uint8_t));
+	}
+
+	template <typename T, typename Column>
+	void copyColumn(const char* data, std::size_t& offset, std::size_t n, Column& column)
+	{
+		offset = alignUp(offset);
+		const T* first = reinterpret_cast<const T*>(data + offset);
+		column.assign(first, first + n);
+		offset += sizeof(T) * n;
+	}
+
+	bool getSourceKey(const std::string& sourcePath, uint64_t& size, int64_t& time)
+	{
+		std::error_code ec;
+		size = fs::file_size(sourcePath, ec);
+		if (ec) return false;
+		time = static_cast<int64_t>(fs::last_write_time(sourcePath, ec).time_since_epoch().count());
+		return !ec;
+	}
+}
+
+std::string LasPointCache::GetCachePath(const std::string& sourcePath)
+{
+	return sourcePath + ".pcvrcache";
+}
+
+bool LasPointCache::Read(const std::string& sourcePath, const osg::Vec3d& origin, LasPointTable& table,
+	osg::BoundingBox& bounds)
+{
+	std::string cachePath = GetCachePath(sourcePath);
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!fs::exists(cachePath) || !getSourceKey(sourcePath, sourceSize, sourceTime)) return false;
+
+	boost::iostreams::mapped_file_source file;
+	try
+	{
+		file.open(cachePath);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+	if (file.size() < sizeof(CacheHeader)) return false;
+
+	CacheHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+		header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+	{
+		return false;
+	}
+
+	// Check the file holds every column before touching the table.
+	const std::size_t n = static_cast<std::size_t>(header.numPoints);
+	std::size_t offset = sizeof(CacheHeader);
+	forEachColumn(table, [&](const void*, std::size_t bytesPerPoint)
+	{
+		offset = alignUp(offset) + bytesPerPoint * n;
+	});
+	if (offset > file.size()) return false;
+
+	// Bulk copies straight out of the mapping; no per-point decoding.
+	const char* data = file.data();
+	offset = sizeof(CacheHeader);
+	copyColumn<osg::Vec3>(data, offset, n, *table.positions);
+	copyColumn<osg::Vec4ub>(data, offset, n, *table.colors);
+	copyColumn<uint8_t>(data, offset, n, table.classification);
+	copyColumn<uint16_t>(data, offset, n, table.intensity);
+	copyColumn<uint8_t>(data, offset, n, table.returnNumber);
+	copyColumn<uint8_t>(data, offset, n, table.numberOfReturns);
+
+	// Move the positions from the file's center to the scene origin.
+	const osg::Vec3 shift(osg::Vec3d(header.center[0], header.center[1], header.center[2]) - origin);
+	if (n > 0 && shift != osg::Vec3())
+	{
+		osg::Vec3* verts = &table.positions->front();
+		parallelFor(0, n, [verts, shift](std::size_t first, std::size_t last)
+		{
+			for (std::size_t i = first; i < last; i++)
+			{
+				verts[i] += shift;
+			}
+		});
+	}
+	bounds.set(osg::Vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]) + shift,
+		osg::Vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]) + shift);
+	return true;
+}
+
+bool LasPointCache::Write(const std::string& sourcePath, const osg::Vec3d& center, const osg::Vec3d& origin,
+	const LasPointTable& table)
+{
+	CacheHeader header = {};
+	std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	if (!getSourceKey(sourcePath, header.sourceSize, header.sourceTime)) return false;
+	for (int i = 0; i < 3; i++)
+	{
+		header.center[i] = center[i];
+	}
+	header.numPoints = table.size();
+
+	// The table is centered on the scene origin; the cache on the file's center.
+	const osg::Vec3 shift(origin - center);
+	osg::BoundingBox bounds;
+	for (const osg::Vec3& p : *table.positions)
+	{
+		bounds.expandBy(p);
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		header.boundsMin[i] = bounds.valid() ? bounds._min[i] + shift[i] : 0.0f;
+		header.boundsMax[i] = bounds.valid() ? bounds._max[i] + shift[i] : 0.0f;
+	}
+
+	// Write next to the final name and swap it in, so an interrupted write
+	// never leaves a cache that looks valid.
+	std::string cachePath = GetCachePath(sourcePath);
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream ofs(tempPath, std::ios::binary);
+		if (!ofs)
+		{
+			std::cout << "Could not write point cache " << cachePath << std::endl;
+			return false;
+		}
+
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		std::size_t offset = sizeof(header);
+		const char zeros[COLUMN_ALIGNMENT] = {};
+		std::vector<osg::Vec3> shifted;
+		forEachColumn(table, [&](const void* column, std::size_t bytesPerPoint)
+		{
+			std::size_t aligned = alignUp(offset);
+			std::size_t bytes = bytesPerPoint * table.size();
+			ofs.write(zeros, aligned - offset);
+			offset = aligned + bytes;
+			if (bytes == 0) return;
+			if (column != &table.positions->front() || shift == osg::Vec3())
+			{
+				ofs.write(static_cast<const char*>(column), bytes);
+				return;
+			}
+
+			// Shift the positions a block at a time, not into a second copy of the column.
+			const osg::Vec3* verts = &table.positions->front();
+			for (std::size_t first = 0; first < table.size(); first += SHIFT_BLOCK)
+			{
+				const std::size_t last = std::min(first + SHIFT_BLOCK, table.size());
+				shifted.resize(last - first);
+				for (std::size_t i = first; i < last; i++)
+				{
+					shifted[i - first] = verts[i] + shift;
+				}
+				ofs.write(reinterpret_cast<const char*>(shifted.data()), shifted.size() * sizeof(osg::Vec3));
+			}
+		});
+		if (!ofs)
+		{
+			std::cout << "Could not write point cache " << cachePath << std::endl;
+			ofs.close();
+			std::error_code ec;
+			fs::remove(tempPath, ec);
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::remove(cachePath, ec);
+	fs::rename(tempPath, cachePath, ec);
+	if (ec)
+	{
+		std::cout << "Could not write point cache " << cachePath << ": " << ec.message() << std::endl;
+		fs::remove(tempPath, ec);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+
+#include <osg/BoundingBox>
+#include <osg/Vec3d>
+
+#include "LasPointTable.hpp"
+
+//-----------------------------------------------------------------------------
+// LasPointCache
+//    Sidecar file (<source>.pcvrcache) holding a LasPointTable as a LasModel
+// uses it: float positions, colors in the color array's own format, and the
+// other attribute columns. Each column is stored contiguously, so loading the
+// cache is one bulk copy per column out of the mapped file.
+//
+//    Positions are stored relative to a center that depends only on the file
+// (the center of its LAS header), not on the scene origin, which changes with
+// the set of tiles loaded and --lasBounds. Read shifts them to the caller's
+// origin in one parallel pass.
+//
+//    The cache is keyed by the source file's size and modification time. Any
+// mismatch, or a cache written by a different version, makes Read fail and
+// the caller rebuilds it from the source.
+//-----------------------------------------------------------------------------
+class LasPointCache
+{
+public:
+	static std::string GetCachePath(const std::string& sourcePath);
+
+	// Fill the table from the cache of sourcePath, with positions relative to
+	// 'origin'. 'bounds' receives the bounding box of the positions.
+	static bool Read(const std::string& sourcePath, const osg::Vec3d& origin, LasPointTable& table,
+		osg::BoundingBox& bounds);
+
+	// Write the table, whose positions are relative to 'origin', as the cache
+	// of sourcePath, storing them relative to the file's own 'center'. Failure
+	// (e.g. a read-only data directory) only costs the next launch a full load.
+	static bool Write(const std::string& sourcePath, const osg::Vec3d& center, const osg::Vec3d& origin,
+		const LasPointTable& table);
+};
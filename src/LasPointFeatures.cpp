@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cmath>
+
+#include <osg/Math>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasPointFeatures.hpp"
+
+namespace
+{
+	const unsigned int MAX_NEIGHBORS = 64;
+	const std::size_t DENSITY_SAMPLES = 1024;
+
+	// Eigenvalues of a symmetric 3x3 matrix, largest first (closed form).
+	void eigenvalues(const double a[3][3], double& l1, double& l2, double& l3)
+	{
+		const double p1 = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+		const double q = (a[0][0] + a[1][1] + a[2][2]) / 3.0;
+		const double p2 = (a[0][0] - q) * (a[0][0] - q) + (a[1][1] - q) * (a[1][1] - q) + (a[2][2] - q) * (a[2][2] - q) + 2.0 * p1;
+		const double p = std::sqrt(p2 / 6.0);
+		if (p < 1e-30)
+		{
+			l1 = l2 = l3 = q;
+			return;
+		}
+
+		double b[3][3];
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				b[i][j] = (a[i][j] - (i == j ? q : 0.0)) / p;
+			}
+		}
+		double r = (b[0][0] * (b[1][1] * b[2][2] - b[1][2] * b[2][1])
+			- b[0][1] * (b[1][0] * b[2][2] - b[1][2] * b[2][0])
+			+ b[0][2] * (b[1][0] * b[2][1] - b[1][1] * b[2][0])) / 2.0;
+		r = std::min(1.0, std::max(-1.0, r));
+		const double phi = std::acos(r) / 3.0;
+		l1 = q + 2.0 * p * std::cos(phi);
+		l3 = q + 2.0 * p * std::cos(phi + 2.0 * osg::PI / 3.0);
+		l2 = 3.0 * q - l1 - l3;
+	}
+
+	// Unit eigenvector of eigenvalue l: the longest cross product of two rows of (a - l I).
+	bool eigenvector(const double a[3][3], double l, osg::Vec3d& v)
+	{
+		const osg::Vec3d r0(a[0][0] - l, a[0][1], a[0][2]);
+		const osg::Vec3d r1(a[1][0], a[1][1] - l, a[1][2]);
+		const osg::Vec3d r2(a[2][0], a[2][1], a[2][2] - l);
+		const osg::Vec3d c[3] = { r0 ^ r1, r0 ^ r2, r1 ^ r2 };
+		int best = 0;
+		for (int i = 1; i < 3; i++)
+		{
+			if (c[i].length2() > c[best].length2()) best = i;
+		}
+		double len = c[best].length();
+		if (len < 1e-30) return false;
+		v = c[best] / len;
+		return true;
+	}
+}
+
+LasPointFeatures::LasPointFeatures(unsigned int k)
+	: _k(std::max(3u, std::min(k, MAX_NEIGHBORS - 1))), _numComputed(0)
+{
+}
+
+std::size_t LasPointFeatures::getNumComputed() const
+{
+	return _numComputed;
+}
+
+std::vector<unsigned int> LasPointFeatures::takeNewlyComputed()
+{
+	std::vector<unsigned int> indices;
+	std::lock_guard<std::mutex> lock(_mutex);
+	indices.swap(_newlyComputed);
+	return indices;
+}
+
+float LasPointFeatures::getTypicalDensity() const
+{
+	return _typicalDensity;
+}
+
+std::mutex& LasPointFeatures::getMutex() const
+{
+	return _mutex;
+}
+
+const PCVR_KdTree& LasPointFeatures::getTree(const LasPointTable& table)
+{
+	std::lock_guard<std::mutex> computeLock(_computeMutex);
+	if (!_treeBuilt && !table.empty()) build(table);
+	return _tree;
+}
+
+std::size_t LasPointFeatures::compute(const LasPointTable& table, const std::vector<unsigned int>& indices)
+{
+	std::lock_guard<std::mutex> computeLock(_computeMutex);
+	if (table.empty()) return 0;
+	if (!_treeBuilt) build(table);
+
+	// Flags only change under _computeMutex, so they can be read here without _mutex.
+	std::vector<unsigned int> todo;
+	for (unsigned int i : indices)
+	{
+		if (!computed[i]) todo.push_back(i);
+	}
+	std::sort(todo.begin(), todo.end());
+	todo.erase(std::unique(todo.begin(), todo.end()), todo.end());
+	if (todo.empty()) return 0;
+
+	const osg::Vec3* points = &table.positions->front();
+	parallelFor(0, todo.size(), [&](std::size_t first, std::size_t last)
+	{
+		uint32_t neighbors[MAX_NEIGHBORS];
+		float dist2[MAX_NEIGHBORS];
+		for (std::size_t j = first; j < last; j++)
+		{
+			computePoint(points, todo[j], neighbors, dist2);
+		}
+	}, 1024);
+
+	// Publish the finished points; readers never see a half-written row.
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (unsigned int i : todo)
+	{
+		computed[i] = 1;
+	}
+	_numComputed += todo.size();
+	_newlyComputed.insert(_newlyComputed.end(), todo.begin(), todo.end());
+	return todo.size();
+}
+
+void LasPointFeatures::compact(const std::vector<uint32_t>& remap, const LasPointTable& table,
+	LasPointFeatures& compacted) const
+{
+	// Columns only change under compute(), so they can be read here without _mutex.
+	const std::size_t n = table.size();
+	compacted._k = _k;
+	compacted._typicalDensity = _typicalDensity;
+	if (computed.size() != remap.size()) return;	// never built; the copy builds on first use
+
+	compacted.normal.resize(n);
+	compacted.curvature.resize(n);
+	compacted.planarity.resize(n);
+	compacted.linearity.resize(n);
+	compacted.density.resize(n);
+	compacted.computed.resize(n);
+	parallelFor(0, remap.size(), [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			const uint32_t j = remap[i];
+			if (j >= n) continue;
+			compacted.normal[j] = normal[i];
+			compacted.curvature[j] = curvature[i];
+			compacted.planarity[j] = planarity[i];
+			compacted.linearity[j] = linearity[i];
+			compacted.density[j] = density[i];
+			compacted.computed[j] = computed[i];
+		}
+	});
+	compacted._numComputed = std::count(compacted.computed.begin(), compacted.computed.end(), 1);
+
+	if (_treeBuilt && n > 0)
+	{
+		compacted._tree.build(&table.positions->front(), n);
+		compacted._treeBuilt = true;
+	}
+}
+
+void LasPointFeatures::applyCompaction(LasPointFeatures& compacted, const std::vector<uint32_t>& remap)
+{
+	{
+		std::lock_guard<std::mutex> computeLock(_computeMutex);
+		std::lock_guard<std::mutex> lock(_mutex);
+		normal.swap(compacted.normal);
+		curvature.swap(compacted.curvature);
+		planarity.swap(compacted.planarity);
+		linearity.swap(compacted.linearity);
+		density.swap(compacted.density);
+		computed.swap(compacted.computed);
+		std::swap(_tree, compacted._tree);
+		_treeBuilt = compacted._treeBuilt;
+		_typicalDensity = compacted._typicalDensity;
+		_numComputed = compacted._numComputed.load();
+
+		std::vector<unsigned int> newlyComputed;
+		for (unsigned int i : _newlyComputed)
+		{
+			if (remap[i] < computed.size()) newlyComputed.push_back(remap[i]);
+		}
+		_newlyComputed.swap(newlyComputed);
+	}
+	compacted.clear();
+}
+
+void LasPointFeatures::clear()
+{
+	std::lock_guard<std::mutex> computeLock(_computeMutex);
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<osg::Vec3>().swap(normal);
+	std::vector<float>().swap(curvature);
+	std::vector<float>().swap(planarity);
+	std::vector<float>().swap(linearity);
+	std::vector<float>().swap(density);
+	std::vector<uint8_t>().swap(computed);
+	_tree = PCVR_KdTree();
+	_treeBuilt = false;
+	_numComputed = 0;
+	_newlyComputed.clear();
+}
+
+void LasPointFeatures::build(const LasPointTable& table)
+{
+	const std::size_t n = table.size();
+	const osg::Vec3* points = &table.positions->front();
+	_tree.build(points, n);
+	_treeBuilt = true;
+
+	// After a compaction the columns and the typical density carry over.
+	if (computed.size() == n) return;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		normal.assign(n, osg::Vec3(0.0f, 0.0f, 1.0f));
+		curvature.assign(n, 0.0f);
+		planarity.assign(n, 0.0f);
+		linearity.assign(n, 0.0f);
+		density.assign(n, 0.0f);
+		computed.assign(n, 0);
+	}
+
+	// The typical density comes from an evenly spread sample, so it does not
+	// depend on which region happens to be computed first. The sampled rows are
+	// overwritten by the real computation later.
+	const std::size_t numSamples = std::min(n, DENSITY_SAMPLES);
+	std::vector<float> sample(numSamples);
+	parallelFor(0, numSamples, [&](std::size_t first, std::size_t last)
+	{
+		uint32_t neighbors[MAX_NEIGHBORS];
+		float dist2[MAX_NEIGHBORS];
+		for (std::size_t s = first; s < last; s++)
+		{
+			std::size_t i = s * n / numSamples;
+			computePoint(points, i, neighbors, dist2);
+			sample[s] = density[i];
+		}
+	}, 64);
+	std::nth_element(sample.begin(), sample.begin() + numSamples / 2, sample.end());
+	if (numSamples > 0 && sample[numSamples / 2] > 0.0f) _typicalDensity = sample[numSamples / 2];
+}
+
+void LasPointFeatures::computePoint(const osg::Vec3* points, std::size_t i, uint32_t* neighbors, float* dist2)
+{
+	// The point finds itself first, and counts as one of the neighborhood.
+	unsigned int found = _tree.findNearest(points[i], _k + 1, neighbors, dist2);
+	if (found < 4) return;
+
+	osg::Vec3d mean;
+	for (unsigned int j = 0; j < found; j++)
+	{
+		mean += osg::Vec3d(points[neighbors[j]]);
+	}
+	mean /= found;
+
+	double cov[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+	for (unsigned int j = 0; j < found; j++)
+	{
+		osg::Vec3d d = osg::Vec3d(points[neighbors[j]]) - mean;
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = r; c < 3; c++)
+			{
+				cov[r][c] += d[r] * d[c];
+			}
+		}
+	}
+	for (int r = 0; r < 3; r++)
+	{
+		for (int c = 0; c < r; c++)
+		{
+			cov[r][c] = cov[c][r];
+		}
+	}
+
+	double l1, l2, l3;
+	eigenvalues(cov, l1, l2, l3);
+	l3 = std::max(l3, 0.0);
+	const double sum = l1 + l2 + l3;
+	if (l1 > 0.0)
+	{
+		linearity[i] = static_cast<float>((l1 - l2) / l1);
+		planarity[i] = static_cast<float>((l2 - l3) / l1);
+		curvature[i] = static_cast<float>(l3 / sum);
+	}
+
+	osg::Vec3d n;
+	if (eigenvector(cov, l3, n))
+	{
+		if (n.z() < 0.0) n = -n;
+		normal[i] = osg::Vec3(n);
+	}
+
+	const double radius = std::sqrt(dist2[found - 1]);
+	const double volume = 4.0 / 3.0 * osg::PI * radius * radius * radius;
+	density[i] = volume > 0.0 ? static_cast<float>(found / volume) : 0.0f;
+}
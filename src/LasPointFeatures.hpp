@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <osg/Vec3>
+
+#include "LasPointTable.hpp"
+#include "PCVR_KdTree.hpp"
+
+//-----------------------------------------------------------------------------
+// LasPointFeatures
+//    Local geometry of the points of a LasPointTable, as extra columns indexed
+// like the table's own. For each point, the covariance of its k nearest
+// neighbors is decomposed into eigenvalues l1 >= l2 >= l3, which give
+//    normal       eigenvector of l3, flipped to point up
+//    curvature    l3 / (l1 + l2 + l3): 0 on a plane, 1/3 for isotropic scatter
+//    planarity    (l2 - l3) / l1
+//    linearity    (l1 - l2) / l1: high along trunks, branches and lianas
+//    density      neighbors per unit volume within the k-th neighbor distance
+//
+//    Features are computed on demand for the points asked for, so a region
+// can be shown long before the whole cloud is done. The kd-tree over the
+// table is built by the first call. compute() may run on a worker thread;
+// readers lock getMutex() and only look at points whose computed flag is set.
+//-----------------------------------------------------------------------------
+class LasPointFeatures
+{
+public:
+	static const unsigned int DEFAULT_NEIGHBORS = 16;
+
+	LasPointFeatures(unsigned int k = DEFAULT_NEIGHBORS);
+
+	// Compute the features of the listed points that do not have them yet.
+	// Returns how many were computed.
+	std::size_t compute(const LasPointTable& table, const std::vector<unsigned int>& indices);
+
+	std::size_t getNumComputed() const;
+
+	// Points computed since the last call, for showing them incrementally.
+	std::vector<unsigned int> takeNewlyComputed();
+
+	// Median density of a sample of the points, a neutral value for coloring.
+	float getTypicalDensity() const;
+
+	std::mutex& getMutex() const;
+
+	// Neighbor index over the table, built here if compute() has not run yet.
+	// Other neighbor searches over the same points (e.g. registration) share it.
+	const PCVR_KdTree& getTree(const LasPointTable& table);
+
+	// Follow the table through a compaction: copy the features of the kept
+	// rows into 'compacted', an unused object, at the rows 'remap' takes them
+	// to in 'table', the compacted table; rows mapped past its end are
+	// dropped. If this object has its kd-tree, the copy gets one over 'table'
+	// too. Runs beside readers of this object (e.g. on a background thread),
+	// but not beside compute(). The features of the points next to the
+	// removed ones are not recomputed.
+	void compact(const std::vector<uint32_t>& remap, const LasPointTable& table,
+		LasPointFeatures& compacted) const;
+
+	// Take over the columns and kd-tree compact() made with the same remap,
+	// leaving 'compacted' empty. Points computed but not taken yet carry over.
+	void applyCompaction(LasPointFeatures& compacted, const std::vector<uint32_t>& remap);
+
+	// Drop every column and the kd-tree.
+	void clear();
+
+	std::vector<osg::Vec3> normal;
+	std::vector<float> curvature;
+	std::vector<float> planarity;
+	std::vector<float> linearity;
+	std::vector<float> density;
+	std::vector<uint8_t> computed;
+
+private:
+	unsigned int _k;
+	PCVR_KdTree _tree;
+	bool _treeBuilt = false;
+	float _typicalDensity = 1.0f;
+	std::atomic<std::size_t> _numComputed;
+	std::vector<unsigned int> _newlyComputed;
+
+	std::mutex _computeMutex;		// one compute() at a time
+	mutable std::mutex _mutex;		// guards the computed flags and column sizes against readers
+
+	void build(const LasPointTable& table);
+	void computePoint(const osg::Vec3* points, std::size_t i, uint32_t* neighbors, float* dist2);
+};
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasPointFilter.hpp"
+
+namespace
+{
+	// Parse "a,b,c" into integers within [lo, hi]; false on anything else.
+	bool parseList(const std::string& list, long lo, long hi, std::vector<long>& values)
+	{
+		std::stringstream ss(list);
+		std::string item;
+		while (std::getline(ss, item, ','))
+		{
+			char* end = nullptr;
+			long v = std::strtol(item.c_str(), &end, 10);
+			if (item.empty() || *end != '\0' || v < lo || v > hi) return false;
+			values.push_back(v);
+		}
+		return !values.empty();
+	}
+}
+
+void readLasPointFilter(osg::ArgumentParser& args, LasPointFilter& filter)
+{
+	std::string classes, returns;
+	if (args.read("--lasClasses", classes) && !filter.setClasses(classes))
+	{
+		std::cout << "Bad --lasClasses " << classes << ", expected classification codes such as 2,3" << std::endl;
+	}
+	if (args.read("--lasReturns", returns) && !filter.setReturns(returns))
+	{
+		std::cout << "Bad --lasReturns " << returns << ", expected first, last, single or return numbers such as 1,2" << std::endl;
+	}
+
+	osg::Vec3d lo(-DBL_MAX, -DBL_MAX, -DBL_MAX), hi(DBL_MAX, DBL_MAX, DBL_MAX);
+	if (args.read("--lasBounds", lo.x(), lo.y(), lo.z(), hi.x(), hi.y(), hi.z())
+		|| args.read("--lasBounds", lo.x(), lo.y(), hi.x(), hi.y()))
+	{
+		filter.setBounds(osg::BoundingBoxd(lo, hi));
+	}
+}
+
+bool LasPointFilter::setClasses(const std::string& list)
+{
+	std::vector<long> classes;
+	if (!parseList(list, 0, 255, classes)) return false;
+
+	_classes.reset();
+	for (long c : classes) _classes.set(c);
+	_filterClasses = true;
+	return true;
+}
+
+bool LasPointFilter::setReturns(const std::string& spec)
+{
+	_returnMask = 0;
+	_lastReturns = false;
+	if (spec == "first")
+	{
+		_returnMask = 1 << 1;
+	}
+	else if (spec == "last")
+	{
+		_lastReturns = true;
+	}
+	else if (spec == "single")
+	{
+		_returnMask = 1 << 1;
+		_lastReturns = true;
+	}
+	else
+	{
+		std::vector<long> numbers;
+		if (!parseList(spec, 1, 15, numbers)) return false;
+		for (long r : numbers) _returnMask |= 1 << r;
+	}
+	return true;
+}
+
+void LasPointFilter::setBounds(const osg::BoundingBoxd& bounds)
+{
+	_bounds = bounds;
+	_hasBounds = true;
+}
+
+bool LasPointFilter::isActive() const
+{
+	return _filterClasses || _returnMask != 0 || _lastReturns || _hasBounds;
+}
+
+bool LasPointFilter::hasBounds() const
+{
+	return _hasBounds;
+}
+
+const osg::BoundingBoxd& LasPointFilter::getBounds() const
+{
+	return _bounds;
+}
+
+bool LasPointFilter::overlaps(const osg::BoundingBoxd& box) const
+{
+	return !_hasBounds || _bounds.intersects(box);
+}
+
+bool LasPointFilter::getRawBounds(const double scale[3], const double offset[3], int64_t rawMin[3], int64_t rawMax[3]) const
+{
+	for (int i = 0; i < 3; i++)
+	{
+		// A hair of slack keeps points lying exactly on a side. Open sides, and
+		// sides beyond what 32-bit records can hold, clamp to the record range.
+		double lo = _hasBounds ? std::ceil((_bounds._min[i] - offset[i]) / scale[i] - 1e-6) : -DBL_MAX;
+		double hi = _hasBounds ? std::floor((_bounds._max[i] - offset[i]) / scale[i] + 1e-6) : DBL_MAX;
+		rawMin[i] = static_cast<int64_t>(std::max(lo, static_cast<double>(INT32_MIN)));
+		rawMax[i] = static_cast<int64_t>(std::min(hi, static_cast<double>(INT32_MAX)));
+		if (rawMin[i] > rawMax[i]) return false;
+	}
+	return true;
+}
+
+std::size_t LasPointFilter::apply(LasPointTable& table, const osg::Vec3d& origin) const
+{
+	if (!isActive() || table.empty()) return 0;
+
+	const std::size_t n = table.size();
+	const osg::Vec3* positions = &table.positions->front();
+	std::vector<char> removed(n, 0);
+	parallelFor(0, n, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			removed[i] = !acceptsClass(table.classification[i])
+				|| !acceptsReturn(table.returnNumber[i], table.numberOfReturns[i])
+				|| !contains(origin + positions[i]);
+		}
+	});
+	return table.erase(removed);
+}
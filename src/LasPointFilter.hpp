@@ -0,0 +1,76 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+
+#include <osg/ArgumentParser>
+#include <osg/BoundingBox>
+#include <osg/Vec3d>
+
+#include "LasPointTable.hpp"
+
+//-----------------------------------------------------------------------------
+// LasPointFilter
+//    Which points of a LAS file get loaded at all: a set of classifications
+// (--lasClasses), of returns (--lasReturns) and an area (--lasBounds, in
+// source coordinates). The decoders test it on the raw fields of each record,
+// so rejected points are never converted, stored or drawn; the bounds are
+// compared as the integers stored in the file. Files and octree nodes whose
+// bounds miss the area are skipped whole.
+//-----------------------------------------------------------------------------
+class LasPointFilter
+{
+public:
+	// Comma-separated classification codes, e.g. "2" or "2,3,4,5".
+	bool setClasses(const std::string& list);
+	// "first", "last", "single", or comma-separated return numbers, e.g. "1,2".
+	bool setReturns(const std::string& spec);
+	// Only z may be left open, as +/-DBL_MAX.
+	void setBounds(const osg::BoundingBoxd& bounds);
+
+	bool isActive() const;
+	bool hasBounds() const;
+	const osg::BoundingBoxd& getBounds() const;
+
+	bool acceptsClass(uint8_t classification) const
+	{
+		return !_filterClasses || _classes[classification];
+	}
+
+	bool acceptsReturn(uint8_t returnNumber, uint8_t numberOfReturns) const
+	{
+		if (_returnMask != 0 && (returnNumber > 15 || !(_returnMask & (1u << returnNumber)))) return false;
+		return !_lastReturns || returnNumber == numberOfReturns;
+	}
+
+	bool contains(const osg::Vec3d& p) const
+	{
+		return !_hasBounds || _bounds.contains(p);
+	}
+
+	// True if any point of the box may pass the bounds.
+	bool overlaps(const osg::BoundingBoxd& box) const;
+
+	// The bounds as raw LAS integer coordinates of a file with this scale and
+	// offset, rounded inwards. False if no integer lies inside.
+	bool getRawBounds(const double scale[3], const double offset[3], int64_t rawMin[3], int64_t rawMax[3]) const;
+
+	// Drop the rows of an already decoded table that do not pass, for the
+	// decoders that cannot filter as they go (LAZ, liblas, the point cache).
+	// 'origin' is the source position of the table's local origin. Returns
+	// the number of rows removed.
+	std::size_t apply(LasPointTable& table, const osg::Vec3d& origin) const;
+
+private:
+	std::bitset<256> _classes;
+	bool _filterClasses = false;
+	uint16_t _returnMask = 0;		// bit r set: return number r passes; 0 = any
+	bool _lastReturns = false;		// only the last return of each pulse passes
+	osg::BoundingBoxd _bounds;
+	bool _hasBounds = false;
+};
+
+// Read --lasClasses <list>, --lasReturns <spec> and --lasBounds <minX minY maxX maxY>
+// (or <minX minY minZ maxX maxY maxZ>) into the filter, reporting bad values.
+void readLasPointFilter(osg::ArgumentParser& args, LasPointFilter& filter);
@@ -0,0 +1,93 @@
+#include "LasPointTable.hpp"
+
+LasPointTable::LasPointTable()
+	: positions(new osg::Vec3Array())
+	, colors(new osg::Vec4ubArray())
+{
+	colors->setNormalize(true);
+}
+
+std::size_t LasPointTable::size() const
+{
+	return positions->size();
+}
+
+bool LasPointTable::empty() const
+{
+	return positions->empty();
+}
+
+void LasPointTable::reserve(std::size_t n)
+{
+	positions->reserve(n);
+	colors->reserve(n);
+	classification.reserve(n);
+	intensity.reserve(n);
+	returnNumber.reserve(n);
+	numberOfReturns.reserve(n);
+}
+
+void LasPointTable::resize(std::size_t n)
+{
+	positions->resize(n);
+	colors->resize(n);
+	classification.resize(n);
+	intensity.resize(n);
+	returnNumber.resize(n);
+	numberOfReturns.resize(n);
+}
+
+void LasPointTable::clear()
+{
+	positions->clear();
+	colors->clear();
+	classification.clear();
+	intensity.clear();
+	returnNumber.clear();
+	numberOfReturns.clear();
+}
+
+std::size_t LasPointTable::erase(const std::vector<char>& removed)
+{
+	const std::size_t n = size();
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		if (removed[i]) continue;
+		if (kept != i)
+		{
+			(*positions)[kept] = (*positions)[i];
+			(*colors)[kept] = (*colors)[i];
+			classification[kept] = classification[i];
+			intensity[kept] = intensity[i];
+			returnNumber[kept] = returnNumber[i];
+			numberOfReturns[kept] = numberOfReturns[i];
+		}
+		kept++;
+	}
+	resize(kept);
+	return n - kept;
+}
+
+void LasPointTable::append(const LasPointTable& other)
+{
+	positions->insert(positions->end(), other.positions->begin(), other.positions->end());
+	colors->insert(colors->end(), other.colors->begin(), other.colors->end());
+	classification.insert(classification.end(), other.classification.begin(), other.classification.end());
+	intensity.insert(intensity.end(), other.intensity.begin(), other.intensity.end());
+	returnNumber.insert(returnNumber.end(), other.returnNumber.begin(), other.returnNumber.end());
+	numberOfReturns.insert(numberOfReturns.end(), other.numberOfReturns.begin(), other.numberOfReturns.end());
+}
+
+std::size_t LasPointTable::capacityBytes() const
+{
+	return positions->capacity() * sizeof(osg::Vec3) + colors->capacity() * sizeof(osg::Vec4ub)
+		+ classification.capacity() + intensity.capacity() * sizeof(uint16_t)
+		+ returnNumber.capacity() + numberOfReturns.capacity();
+}
+
+std::ostream& LasPointTable::writeToStream(std::ostream& o, std::size_t i) const
+{
+	const osg::Vec3& p = (*positions)[i];
+	return o << p.x() << ',' << p.y() << ',' << p.z() << std::endl;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <osg/Array>
+
+// Structure-of-arrays store for the points of a LasModel.
+// Every column is indexed by point number. Positions and colors are the
+// OSG arrays that the point geometry draws from; colors are normalized 8-bit
+// RGBA, a quarter of the memory of float colors on both the CPU and the GPU.
+// The other LAS attributes are plain typed columns so tools can scan them
+// without touching osg.
+class LasPointTable
+{
+public:
+	LasPointTable();
+
+	std::size_t size() const;
+	bool empty() const;
+
+	void reserve(std::size_t n);
+	void resize(std::size_t n);
+	void clear();
+
+	// Remove the rows whose flag is set, keeping the rest in order. Returns
+	// the number of rows removed.
+	std::size_t erase(const std::vector<char>& removed);
+
+	// Add the rows of another table after the last row.
+	void append(const LasPointTable& other);
+
+	// Bytes allocated by the columns, reserved capacity included.
+	std::size_t capacityBytes() const;
+
+	// Write point i as "x,y,z" in the same format as PCVR_Selectable::writeToStream.
+	std::ostream& writeToStream(std::ostream& o, std::size_t i) const;
+
+	osg::ref_ptr<osg::Vec3Array> positions;
+	osg::ref_ptr<osg::Vec4ubArray> colors;
+	std::vector<uint8_t> classification;
+	std::vector<uint16_t> intensity;
+	std::vector<uint8_t> returnNumber;
+	std::vector<uint8_t> numberOfReturns;
+};
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include "PCVR_Parallel.hpp"
+
+#include "LasRegistration.hpp"
+
+namespace
+{
+	const uint32_t NO_MATCH = 0xffffffff;
+	const std::size_t PAIR_BLOCK = 4096;		// pairs per partial sum
+	const std::size_t MIN_PAIRS = 100;			// fewer pairs do not constrain a rigid transform reliably
+
+	// Normal equations J^T J x = -J^T r of the linearized point-to-plane problem,
+	// with unknowns (rotation vector, translation).
+	struct NormalEquations
+	{
+		double h[6][6];
+		double g[6];
+		std::size_t numPairs;
+		double sumSquares;
+
+		NormalEquations()
+		{
+			std::fill(&h[0][0], &h[0][0] + 36, 0.0);
+			std::fill(g, g + 6, 0.0);
+			numPairs = 0;
+			sumSquares = 0.0;
+		}
+
+		void add(const double j[6], double r)
+		{
+			for (int a = 0; a < 6; a++)
+			{
+				g[a] += j[a] * r;
+				for (int b = a; b < 6; b++)
+				{
+					h[a][b] += j[a] * j[b];
+				}
+			}
+			numPairs++;
+			sumSquares += r * r;
+		}
+
+		void add(const NormalEquations& other)
+		{
+			for (int a = 0; a < 6; a++)
+			{
+				g[a] += other.g[a];
+				for (int b = a; b < 6; b++)
+				{
+					h[a][b] += other.h[a][b];
+				}
+			}
+			numPairs += other.numPairs;
+			sumSquares += other.sumSquares;
+		}
+
+		// Cholesky solve. A little damping keeps directions the scene does not
+		// constrain (e.g. sliding along flat ground) at zero instead of failing.
+		bool solve(double x[6]) const
+		{
+			double trace = 0.0;
+			for (int a = 0; a < 6; a++) trace += h[a][a];
+			if (trace <= 0.0) return false;
+
+			double l[6][6] = {};
+			for (int a = 0; a < 6; a++)
+			{
+				for (int b = 0; b <= a; b++)
+				{
+					double s = h[b][a] + (a == b ? 1e-9 * trace : 0.0);
+					for (int k = 0; k < b; k++) s -= l[a][k] * l[b][k];
+					if (a == b)
+					{
+						if (s <= 0.0) return false;
+						l[a][a] = std::sqrt(s);
+					}
+					else
+					{
+						l[a][b] = s / l[b][b];
+					}
+				}
+			}
+
+			double y[6];
+			for (int a = 0; a < 6; a++)
+			{
+				double s = -g[a];
+				for (int k = 0; k < a; k++) s -= l[a][k] * y[k];
+				y[a] = s / l[a][a];
+			}
+			for (int a = 5; a >= 0; a--)
+			{
+				double s = y[a];
+				for (int k = a + 1; k < 6; k++) s -= l[k][a] * x[k];
+				x[a] = s / l[a][a];
+			}
+			return true;
+		}
+	};
+}
+
+LasRegistration::LasRegistration(const LasRegistrationOptions& options)
+	: _options(options)
+{
+}
+
+bool LasRegistration::align(const LasPointTable& source, const LasPointTable& target, LasPointFeatures& targetFeatures,
+	osg::Matrixd& transform, LasRegistrationResult& result) const
+{
+	result = LasRegistrationResult();
+	if (source.empty() || target.empty()) return false;
+
+	const PCVR_KdTree& tree = targetFeatures.getTree(target);
+	const osg::Vec3* targetPoints = &target.positions->front();
+
+	// The same evenly spread samples every iteration, so the fit cannot jitter
+	// between subsets.
+	const std::size_t n = source.size();
+	const std::size_t m = std::min<std::size_t>(n, std::max(1u, _options.numSamples));
+	std::vector<osg::Vec3> samples(m);
+	for (std::size_t j = 0; j < m; j++)
+	{
+		samples[j] = (*source.positions)[j * n / m];
+	}
+
+	std::vector<osg::Vec3> moved(m);
+	std::vector<osg::Vec3> normals(m);
+	std::vector<uint32_t> match(m);
+	std::vector<float> residual(m);
+	const float maxDist2 = _options.maxDistance * _options.maxDistance;
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+
+	for (unsigned int iteration = 1; iteration <= _options.maxIterations; iteration++)
+	{
+		result.iterations = iteration;
+
+		parallelFor(0, m, [&](std::size_t first, std::size_t last)
+		{
+			for (std::size_t j = first; j < last; j++)
+			{
+				moved[j] = samples[j] * transform;
+				float dist2;
+				if (!tree.findNearest(moved[j], match[j], dist2, maxDist2)) match[j] = NO_MATCH;
+			}
+		}, 1024);
+
+		std::vector<unsigned int> matched;
+		float extent = 0.0f;
+		for (std::size_t j = 0; j < m; j++)
+		{
+			if (match[j] == NO_MATCH) continue;
+			matched.push_back(match[j]);
+			extent = std::max(extent, moved[j].length());
+		}
+		if (matched.size() < MIN_PAIRS) return false;
+		targetFeatures.compute(target, matched);
+
+		// Signed distance of each sample to the tangent plane of its match.
+		{
+			std::lock_guard<std::mutex> lock(targetFeatures.getMutex());
+			parallelFor(0, m, [&](std::size_t first, std::size_t last)
+			{
+				for (std::size_t j = first; j < last; j++)
+				{
+					if (match[j] == NO_MATCH)
+					{
+						residual[j] = nan;
+						continue;
+					}
+					normals[j] = targetFeatures.normal[match[j]];
+					residual[j] = (moved[j] - targetPoints[match[j]]) * normals[j];
+				}
+			}, 4096);
+		}
+
+		// Pairs more than three robust standard deviations out are outliers:
+		// surfaces missing from one scan, or moved between the scans.
+		std::vector<float> magnitude;
+		magnitude.reserve(matched.size());
+		for (float r : residual)
+		{
+			if (!std::isnan(r)) magnitude.push_back(std::abs(r));
+		}
+		std::nth_element(magnitude.begin(), magnitude.begin() + magnitude.size() / 2, magnitude.end());
+		const float threshold = std::max(3.0f * 1.4826f * magnitude[magnitude.size() / 2], _options.convergence);
+
+		// Moving a sample x by a small rotation w and translation t changes its
+		// plane distance by (x ^ n) . w + n . t.
+		const std::size_t numBlocks = (m + PAIR_BLOCK - 1) / PAIR_BLOCK;
+		std::vector<NormalEquations> partial(numBlocks);
+		parallelFor(0, numBlocks, [&](std::size_t firstBlock, std::size_t lastBlock)
+		{
+			for (std::size_t b = firstBlock; b < lastBlock; b++)
+			{
+				const std::size_t last = std::min(m, (b + 1) * PAIR_BLOCK);
+				for (std::size_t j = b * PAIR_BLOCK; j < last; j++)
+				{
+					if (!(std::abs(residual[j]) <= threshold)) continue;
+					const osg::Vec3d x(moved[j]), nrm(normals[j]);
+					const osg::Vec3d c = x ^ nrm;
+					const double jac[6] = { c.x(), c.y(), c.z(), nrm.x(), nrm.y(), nrm.z() };
+					partial[b].add(jac, residual[j]);
+				}
+			}
+		}, 1);
+
+		NormalEquations equations;
+		for (const NormalEquations& p : partial)
+		{
+			equations.add(p);
+		}
+		result.numPairs = equations.numPairs;
+		if (equations.numPairs < MIN_PAIRS) return false;
+		result.rms = static_cast<float>(std::sqrt(equations.sumSquares / equations.numPairs));
+
+		double delta[6];
+		if (!equations.solve(delta)) return false;
+		const osg::Vec3d rotation(delta[0], delta[1], delta[2]);
+		const osg::Vec3d translation(delta[3], delta[4], delta[5]);
+		const double angle = rotation.length();
+		osg::Matrixd step = osg::Matrixd::translate(translation);
+		if (angle > 0.0) step = osg::Matrixd::rotate(angle, rotation / angle) * step;
+		transform = transform * step;
+
+		// No sample moved farther than this bound.
+		if (angle * extent + translation.length() < _options.convergence)
+		{
+			result.converged = true;
+			break;
+		}
+	}
+	return true;
+}
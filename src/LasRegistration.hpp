@@ -0,0 +1,52 @@
+#pragma once
+
+#include <osg/Matrixd>
+
+#include "LasPointFeatures.hpp"
+#include "LasPointTable.hpp"
+
+// Settings of LasRegistration. Lengths are in model units, normally meters.
+struct LasRegistrationOptions
+{
+	unsigned int numSamples = 50000;	// source points matched per iteration
+	unsigned int maxIterations = 50;
+	float maxDistance = 1.0f;			// pairs farther apart are ignored; must cover the initial misalignment
+	float convergence = 1e-4f;			// stop once an iteration moves no sample farther than this
+};
+
+// Outcome of one registration.
+struct LasRegistrationResult
+{
+	unsigned int iterations = 0;
+	std::size_t numPairs = 0;		// pairs used by the last iteration
+	float rms = 0.0f;				// point-to-plane RMS distance of those pairs
+	bool converged = false;
+};
+
+//-----------------------------------------------------------------------------
+// LasRegistration
+//    Point-to-plane ICP between two overlapping scans. A fixed, evenly spread
+// subsample of the source points is matched to the nearest target point
+// through the kd-tree of the target's LasPointFeatures, and the normals of
+// just the matched target points are computed on demand (and kept for later
+// use). Each iteration then solves the linearized 6-DOF least squares problem
+// that moves the samples onto the tangent planes of their matches.
+//
+//    Correspondence search, normal estimation and the least squares sums all
+// run in parallel. Pairs whose plane distance is far above the median are
+// dropped as outliers, so overlap that is only partial does not bias the fit.
+//-----------------------------------------------------------------------------
+class LasRegistration
+{
+public:
+	LasRegistration(const LasRegistrationOptions& options = LasRegistrationOptions());
+
+	// Refine 'transform', which maps source positions into the target's
+	// coordinates (osg row-vector convention, p * transform) and starts out as
+	// the current placement of the source. False if too few pairs were found.
+	bool align(const LasPointTable& source, const LasPointTable& target, LasPointFeatures& targetFeatures,
+		osg::Matrixd& transform, LasRegistrationResult& result) const;
+
+private:
+	LasRegistrationOptions _options;
+};
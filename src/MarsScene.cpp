@@ -8,20 +8,22 @@
 #include <QStackedWidget>
 
 #include "csv.h"
+#include "PCVR_Color.hpp"
 #include "MarsScene.hpp"
 
 namespace fs = std::experimental::filesystem;
 
-Seed::Seed(int offset, osg::ref_ptr<osg::Vec3Array> verts, osg::ref_ptr<osg::Vec4Array> colors)
+Seed::Seed(int offset, osg::ref_ptr<osg::Vec3Array> verts, osg::ref_ptr<osg::Vec4ubArray> colors)
 	: frameOffset(offset)
 	, ptVerts(verts)
 	, ptColors(colors)
 {
+	ptColors->setNormalize(true);
 }
 
-#define YELLOW osg::Vec4(1, 1, 0.5, 0)
-#define TRAIL_COLOR osg::Vec4(0.227, 0.147, 0.472, 0)
-#define TRAIL_DOT_COLOR osg::Vec4(1, 1, 0.5, 0)
+#define YELLOW quantizeColor(osg::Vec4(1, 1, 0.5, 0))
+#define TRAIL_COLOR quantizeColor(osg::Vec4(0.227, 0.147, 0.472, 0))
+#define TRAIL_DOT_COLOR quantizeColor(osg::Vec4(1, 1, 0.5, 0))
 
 MarsScene::MarsScene() : PCVR_Scene::PCVR_Scene()
 {
@@ -38,13 +40,19 @@ void MarsScene::buildScene()
 
 	_ptSwitch = new osg::Switch();
 	std::unordered_map<std::string, Seed*> seedMap;
+
+	// Every particle of a frame is drawn in the same color, so the frames
+	// share one overall color instead of carrying a color per point.
+	osg::ref_ptr<osg::Vec4ubArray> frameColors = new osg::Vec4ubArray(1);
+	frameColors->setNormalize(true);
+	(*frameColors)[0] = YELLOW;
+
 	int frameNum = 0;
 	for (auto& path : _dataPaths)
 	{
 		for (auto& fname : fs::directory_iterator(path))
 		{
 			osg::ref_ptr<osg::Vec3Array> ptVerts = new osg::Vec3Array();
-			osg::ref_ptr<osg::Vec4Array> ptColors = new osg::Vec4Array();
 
 			if (fname.path().extension() == ".txt" || fname.path().extension() == ".csv")
 			{
@@ -62,7 +70,7 @@ void MarsScene::buildScene()
 					auto itr = seedMap.find(seedId);
 					if (itr == seedMap.end())
 					{
-						seed = new Seed(frameNum, new osg::Vec3Array(), new osg::Vec4Array());
+						seed = new Seed(frameNum, new osg::Vec3Array(), new osg::Vec4ubArray());
 						seedMap.insert(std::make_pair(seedId, seed));
 						_seeds.push_back(seed);
 					}
@@ -73,7 +81,6 @@ void MarsScene::buildScene()
 					seed->ptColors->push_back(TRAIL_COLOR);
 
 					ptVerts->push_back(vert);
-					ptColors->push_back(YELLOW);
 				}
 			}
 			else if (fname.path().extension() == ".bin")
@@ -112,7 +119,7 @@ void MarsScene::buildScene()
 					auto itr = seedMap.find(std::to_string(seedInt));
 					if (itr == seedMap.end())
 					{
-						seed = new Seed(frameNum, new osg::Vec3Array(), new osg::Vec4Array());
+						seed = new Seed(frameNum, new osg::Vec3Array(), new osg::Vec4ubArray());
 						seedMap.insert(std::make_pair(std::to_string(seedInt), seed));
 						_seeds.push_back(seed);
 					}
@@ -123,7 +130,6 @@ void MarsScene::buildScene()
 					seed->ptColors->push_back(TRAIL_COLOR);
 
 					ptVerts->push_back(vert);
-					ptColors->push_back(YELLOW);
 				}
 
 				// dispose of vertex array
@@ -142,7 +148,7 @@ void MarsScene::buildScene()
 			frameGeom->setUseDisplayList(true);
 			frameGeom->setUseVertexBufferObjects(true);
 			frameGeom->setVertexArray(ptVerts);
-			frameGeom->setColorArray(ptColors, osg::Array::BIND_PER_PRIMITIVE_SET);
+			frameGeom->setColorArray(frameColors, osg::Array::BIND_OVERALL);
 			frameGeom->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, ptVerts->size()));
 
 			osg::ref_ptr<osg::Geode> frameGeode = new osg::Geode();
@@ -153,7 +159,8 @@ void MarsScene::buildScene()
 		}
 	}
 
-	_trailColors = new osg::Vec4Array();
+	_trailColors = new osg::Vec4ubArray();
+	_trailColors->setNormalize(true);
 	for (int i = 0; i < 10; i++)
 	{
 		float mixParam = i / 9.0;
@@ -162,7 +169,7 @@ void MarsScene::buildScene()
 		osg::Vec4 tailColor = osg::Vec4(1, 0, 0, 0);
 		osg::Vec4 headColor = osg::Vec4(1, 1, 0.5, 1.0);
 		osg::Vec4 color = headColor * mixParam + tailColor * (1 - mixParam);
-		_trailColors->push_back(color);
+		_trailColors->push_back(quantizeColor(color));
 	}
 	for (int i = 0; i < _seeds.size(); i += 50)
 	{
@@ -296,10 +303,11 @@ void MarsScene::animateShortTrails()
 				}
 				static_cast<osg::DrawArrays*>(geom->getPrimitiveSet(0))->setFirst(i);
 				//osg::Vec4Array* colorArray = new osg::Vec4Array(i + 9);
-				osg::Vec4Array* colorArray = new osg::Vec4Array;
+				osg::Vec4ubArray* colorArray = new osg::Vec4ubArray;
+				colorArray->setNormalize(true);
 				for (int k = 0; k < i; k++)
 				{
-					colorArray->push_back(osg::Vec4(0, 0, 0, 0));
+					colorArray->push_back(osg::Vec4ub(0, 0, 0, 0));
 				}
 				for (int k = 0; k < 10; k++)
 				{
@@ -11,11 +11,11 @@
 
 struct Seed
 {
-	Seed::Seed(int offset, osg::ref_ptr<osg::Vec3Array> verts, osg::ref_ptr<osg::Vec4Array> colors);
+	Seed::Seed(int offset, osg::ref_ptr<osg::Vec3Array> verts, osg::ref_ptr<osg::Vec4ubArray> colors);
 
 	int frameOffset;
 	osg::ref_ptr<osg::Vec3Array> ptVerts;
-	osg::ref_ptr<osg::Vec4Array> ptColors;
+	osg::ref_ptr<osg::Vec4ubArray> ptColors;
 };
 
 enum ShowMode {
@@ -40,7 +40,7 @@ private:
 	osg::ref_ptr<osg::Switch> _ptSwitch;
 	osg::ref_ptr<osg::Geode> _shortTrailsGeode = new osg::Geode();
 	osg::ref_ptr<osg::Geode> _trailsGeode;
-	osg::ref_ptr<osg::Vec4Array> _trailColors;
+	osg::ref_ptr<osg::Vec4ubArray> _trailColors;
 
 	std::vector<Seed*> _seeds;
 
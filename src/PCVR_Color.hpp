@@ -0,0 +1,20 @@
+#pragma once
+
+#include <algorithm>
+
+#include <osg/Vec4>
+#include <osg/Vec4ub>
+
+// Point colors are stored as normalized 8-bit RGBA (osg::Vec4ubArray), a
+// quarter of the size of float colors. These round float colors in [0, 1]
+// to that form; values outside the range are clamped.
+inline unsigned char quantizeColorChannel(float v)
+{
+	return static_cast<unsigned char>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+inline osg::Vec4ub quantizeColor(const osg::Vec4& c)
+{
+	return osg::Vec4ub(quantizeColorChannel(c.r()), quantizeColorChannel(c.g()),
+		quantizeColorChannel(c.b()), quantizeColorChannel(c.a()));
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+
+#include <osg/BoundingBox>
+
+#include "PCVR_Parallel.hpp"
+
+#include "PCVR_KdTree.hpp"
+
+namespace
+{
+	const std::size_t MAX_LEAF_POINTS = 32;
+	const int MAX_DEPTH = 40;
+
+	struct Visit
+	{
+		uint32_t node;
+		uint32_t first, last;	// entry range of the node
+		int depth;
+		float dist2;			// lower bound on the squared distance to the node
+	};
+}
+
+PCVR_KdTree::PCVR_KdTree()
+{
+}
+
+std::size_t PCVR_KdTree::size() const
+{
+	return _entries.size();
+}
+
+const osg::Vec3& PCVR_KdTree::getTreePoint(std::size_t i) const
+{
+	return _entries[i].point;
+}
+
+uint32_t PCVR_KdTree::getTreeIndex(std::size_t i) const
+{
+	return _entries[i].index;
+}
+
+void PCVR_KdTree::build(const osg::Vec3* points, std::size_t n)
+{
+	_entries.resize(n);
+	parallelFor(0, n, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			_entries[i].point = points[i];
+			_entries[i].index = static_cast<uint32_t>(i);
+		}
+	});
+
+	// Deep enough that every leaf holds at most MAX_LEAF_POINTS.
+	_depth = 0;
+	while (((n + (std::size_t(1) << _depth) - 1) >> _depth) > MAX_LEAF_POINTS && _depth < MAX_DEPTH)
+	{
+		_depth++;
+	}
+	_split.assign((std::size_t(1) << _depth) - 1, 0.0f);
+	_axis.assign(_split.size(), 0);
+
+	// Split one level at a time; the nodes of a level are independent.
+	std::vector<std::pair<uint32_t, uint32_t>> ranges(1, std::make_pair(0u, static_cast<uint32_t>(n)));
+	for (int depth = 0; depth < _depth; depth++)
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> next(ranges.size() * 2);
+		const std::size_t levelStart = (std::size_t(1) << depth) - 1;
+		parallelFor(0, ranges.size(), [&](std::size_t firstNode, std::size_t lastNode)
+		{
+			for (std::size_t j = firstNode; j < lastNode; j++)
+			{
+				const uint32_t first = ranges[j].first, last = ranges[j].second;
+				const uint32_t mid = first + (last - first) / 2;
+				next[2 * j] = std::make_pair(first, mid);
+				next[2 * j + 1] = std::make_pair(mid, last);
+				if (first == last) continue;
+
+				osg::BoundingBox box;
+				for (uint32_t i = first; i < last; i++)
+				{
+					box.expandBy(_entries[i].point);
+				}
+				osg::Vec3 extent = box._max - box._min;
+				int axis = extent.x() >= extent.y() ? (extent.x() >= extent.z() ? 0 : 2) : (extent.y() >= extent.z() ? 1 : 2);
+
+				std::nth_element(_entries.begin() + first, _entries.begin() + mid, _entries.begin() + last,
+					[axis](const Entry& a, const Entry& b) { return a.point[axis] < b.point[axis]; });
+				_split[levelStart + j] = _entries[mid].point[axis];
+				_axis[levelStart + j] = static_cast<uint8_t>(axis);
+			}
+		}, 1);
+		ranges.swap(next);
+	}
+}
+
+unsigned int PCVR_KdTree::findNearest(const osg::Vec3& q, unsigned int k, uint32_t* indices, float* dist2,
+	float maxDist2) const
+{
+	if (k == 0 || _entries.empty()) return 0;
+
+	unsigned int found = 0;
+	float worst = maxDist2;	// squared distance a point must beat to be reported
+
+	Visit stack[2 * MAX_DEPTH + 2];
+	int top = 0;
+	stack[top++] = { 0, 0, static_cast<uint32_t>(_entries.size()), 0, 0.0f };
+	while (top > 0)
+	{
+		const Visit v = stack[--top];
+		if (v.dist2 > worst) continue;
+
+		if (v.depth == _depth)
+		{
+			for (uint32_t i = v.first; i < v.last; i++)
+			{
+				float d = (_entries[i].point - q).length2();
+				if (d > worst || (d == worst && found == k)) continue;
+
+				// Insertion into the sorted result list.
+				unsigned int pos = found < k ? found++ : k - 1;
+				while (pos > 0 && dist2[pos - 1] > d)
+				{
+					dist2[pos] = dist2[pos - 1];
+					indices[pos] = indices[pos - 1];
+					pos--;
+				}
+				dist2[pos] = d;
+				indices[pos] = _entries[i].index;
+				if (found == k) worst = std::min(worst, dist2[k - 1]);
+			}
+			continue;
+		}
+
+		// Visit the near side first; the far side only if the plane is close enough.
+		const uint32_t mid = v.first + (v.last - v.first) / 2;
+		const float diff = q[_axis[v.node]] - _split[v.node];
+		const float planeDist2 = std::max(v.dist2, diff * diff);
+		const Visit left = { 2 * v.node + 1, v.first, mid, v.depth + 1, diff < 0.0f ? v.dist2 : planeDist2 };
+		const Visit right = { 2 * v.node + 2, mid, v.last, v.depth + 1, diff < 0.0f ? planeDist2 : v.dist2 };
+		if (diff < 0.0f)
+		{
+			stack[top++] = right;
+			stack[top++] = left;
+		}
+		else
+		{
+			stack[top++] = left;
+			stack[top++] = right;
+		}
+	}
+	return found;
+}
+
+bool PCVR_KdTree::findNearest(const osg::Vec3& q, uint32_t& index, float& dist2, float maxDist2) const
+{
+	return findNearest(q, 1, &index, &dist2, maxDist2) == 1;
+}
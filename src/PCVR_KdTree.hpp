@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include <osg/Vec3>
+
+//-----------------------------------------------------------------------------
+// PCVR_KdTree
+//    Static, balanced kd-tree over a copy of a point array, for nearest
+// neighbor queries. Every split is at the median along the widest axis of a
+// node, so the tree is implicit: node i has children 2i+1 and 2i+2, and only
+// the split planes are stored. Leaves hold at most a few dozen points, kept
+// contiguous in tree order next to their original indices.
+//
+//    Building sorts each level of the tree in parallel. Queries are const and
+// may run from any number of threads at once; visiting points in tree order
+// (getTreeIndex / getTreePoint) keeps consecutive queries cache-friendly.
+//-----------------------------------------------------------------------------
+class PCVR_KdTree
+{
+public:
+	PCVR_KdTree();
+
+	void build(const osg::Vec3* points, std::size_t n);
+	std::size_t size() const;
+
+	// The k points nearest q, closest first, as indices into the built array
+	// with their squared distances. A query point that is in the tree finds
+	// itself first. Returns the number found (less than k only if the tree
+	// holds fewer points). Points farther than sqrt(maxDist2) are not reported.
+	unsigned int findNearest(const osg::Vec3& q, unsigned int k, uint32_t* indices, float* dist2,
+		float maxDist2 = FLT_MAX) const;
+
+	// The single nearest point; false if the tree is empty or none is within maxDist2.
+	bool findNearest(const osg::Vec3& q, uint32_t& index, float& dist2, float maxDist2 = FLT_MAX) const;
+
+	// Point in tree slot i, and the index it had in the built array.
+	const osg::Vec3& getTreePoint(std::size_t i) const;
+	uint32_t getTreeIndex(std::size_t i) const;
+
+private:
+	struct Entry
+	{
+		osg::Vec3 point;
+		uint32_t index;
+	};
+
+	std::vector<Entry> _entries;	// in tree order
+	std::vector<float> _split;		// per internal node
+	std::vector<uint8_t> _axis;		// per internal node
+	int _depth = 0;					// nodes at this depth are leaves
+};
@@ -0,0 +1,525 @@
+#include <algorithm>
+
+#include "PCVR_Kernels.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define PCVR_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define PCVR_TARGET_AVX2
+#else
+#define PCVR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	KernelPath detectKernelPath()
+	{
+#if defined(PCVR_KERNELS_X86) && defined(_MSC_VER)
+		// AVX2 needs both the instructions and OS support for saving the ymm registers.
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			bool avx2 = (info[1] & (1 << 5)) != 0;
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			if (avx2 && osxsave && (_xgetbv(0) & 6) == 6) return KERNEL_AVX2;
+		}
+		return KERNEL_SSE2;
+#elif defined(PCVR_KERNELS_X86)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? KERNEL_AVX2 : KERNEL_SSE2;
+#else
+		return KERNEL_SCALAR;
+#endif
+	}
+
+	KernelPath& currentPath()
+	{
+		static KernelPath path = detectKernelPath();
+		return path;
+	}
+
+	//-------------------------------------------------------------------------
+	// Shape tests. Each one answers for a single point, 4 points (SSE2) and
+	// 8 points (AVX2) with the same float operations in the same order, so
+	// every path agrees bit for bit.
+	//-------------------------------------------------------------------------
+
+	struct CylinderTest
+	{
+		float p1[3], d[3], lengthsq, radius_sq;
+
+		CylinderTest(const KernelCylinder& cyl)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				p1[i] = cyl.pt1[i];
+				d[i] = cyl.pt2[i] - cyl.pt1[i];
+			}
+			lengthsq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+			radius_sq = cyl.radius * cyl.radius;
+		}
+
+		bool test(float x, float y, float z) const
+		{
+			float pdx = x - p1[0], pdy = y - p1[1], pdz = z - p1[2];
+			float dot = pdx * d[0] + pdy * d[1] + pdz * d[2];
+			float dsq = (pdx * pdx + pdy * pdy + pdz * pdz) - dot * dot / lengthsq;
+			return dot >= 0.0f && dot <= lengthsq && dsq <= radius_sq;
+		}
+
+#ifdef PCVR_KERNELS_X86
+		__m128 test(__m128 x, __m128 y, __m128 z) const
+		{
+			__m128 pdx = _mm_sub_ps(x, _mm_set1_ps(p1[0]));
+			__m128 pdy = _mm_sub_ps(y, _mm_set1_ps(p1[1]));
+			__m128 pdz = _mm_sub_ps(z, _mm_set1_ps(p1[2]));
+			__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pdx, _mm_set1_ps(d[0])), _mm_mul_ps(pdy, _mm_set1_ps(d[1]))),
+				_mm_mul_ps(pdz, _mm_set1_ps(d[2])));
+			__m128 pd2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pdx, pdx), _mm_mul_ps(pdy, pdy)), _mm_mul_ps(pdz, pdz));
+			__m128 len = _mm_set1_ps(lengthsq);
+			__m128 dsq = _mm_sub_ps(pd2, _mm_div_ps(_mm_mul_ps(dot, dot), len));
+			__m128 inCaps = _mm_and_ps(_mm_cmpge_ps(dot, _mm_setzero_ps()), _mm_cmple_ps(dot, len));
+			return _mm_and_ps(inCaps, _mm_cmple_ps(dsq, _mm_set1_ps(radius_sq)));
+		}
+
+		PCVR_TARGET_AVX2 __m256 test(__m256 x, __m256 y, __m256 z) const
+		{
+			__m256 pdx = _mm256_sub_ps(x, _mm256_set1_ps(p1[0]));
+			__m256 pdy = _mm256_sub_ps(y, _mm256_set1_ps(p1[1]));
+			__m256 pdz = _mm256_sub_ps(z, _mm256_set1_ps(p1[2]));
+			__m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pdx, _mm256_set1_ps(d[0])), _mm256_mul_ps(pdy, _mm256_set1_ps(d[1]))),
+				_mm256_mul_ps(pdz, _mm256_set1_ps(d[2])));
+			__m256 pd2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pdx, pdx), _mm256_mul_ps(pdy, pdy)), _mm256_mul_ps(pdz, pdz));
+			__m256 len = _mm256_set1_ps(lengthsq);
+			__m256 dsq = _mm256_sub_ps(pd2, _mm256_div_ps(_mm256_mul_ps(dot, dot), len));
+			__m256 inCaps = _mm256_and_ps(_mm256_cmp_ps(dot, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(dot, len, _CMP_LE_OQ));
+			return _mm256_and_ps(inCaps, _mm256_cmp_ps(dsq, _mm256_set1_ps(radius_sq), _CMP_LE_OQ));
+		}
+#endif
+	};
+
+	struct SphereTest
+	{
+		float c[3], radius_sq;
+
+		SphereTest(const KernelSphere& sphere)
+		{
+			for (int i = 0; i < 3; i++) c[i] = sphere.center[i];
+			radius_sq = sphere.radius * sphere.radius;
+		}
+
+		bool test(float x, float y, float z) const
+		{
+			float dx = x - c[0], dy = y - c[1], dz = z - c[2];
+			return (dx * dx + dy * dy + dz * dz) <= radius_sq;
+		}
+
+#ifdef PCVR_KERNELS_X86
+		__m128 test(__m128 x, __m128 y, __m128 z) const
+		{
+			__m128 dx = _mm_sub_ps(x, _mm_set1_ps(c[0]));
+			__m128 dy = _mm_sub_ps(y, _mm_set1_ps(c[1]));
+			__m128 dz = _mm_sub_ps(z, _mm_set1_ps(c[2]));
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			return _mm_cmple_ps(d2, _mm_set1_ps(radius_sq));
+		}
+
+		PCVR_TARGET_AVX2 __m256 test(__m256 x, __m256 y, __m256 z) const
+		{
+			__m256 dx = _mm256_sub_ps(x, _mm256_set1_ps(c[0]));
+			__m256 dy = _mm256_sub_ps(y, _mm256_set1_ps(c[1]));
+			__m256 dz = _mm256_sub_ps(z, _mm256_set1_ps(c[2]));
+			__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+			return _mm256_cmp_ps(d2, _mm256_set1_ps(radius_sq), _CMP_LE_OQ);
+		}
+#endif
+	};
+
+	struct BoxTest
+	{
+		float lo[3], hi[3];
+
+		BoxTest(const osg::BoundingBox& box)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				lo[i] = box._min[i];
+				hi[i] = box._max[i];
+			}
+		}
+
+		bool test(float x, float y, float z) const
+		{
+			return x >= lo[0] && x <= hi[0] && y >= lo[1] && y <= hi[1] && z >= lo[2] && z <= hi[2];
+		}
+
+#ifdef PCVR_KERNELS_X86
+		__m128 test(__m128 x, __m128 y, __m128 z) const
+		{
+			__m128 inX = _mm_and_ps(_mm_cmpge_ps(x, _mm_set1_ps(lo[0])), _mm_cmple_ps(x, _mm_set1_ps(hi[0])));
+			__m128 inY = _mm_and_ps(_mm_cmpge_ps(y, _mm_set1_ps(lo[1])), _mm_cmple_ps(y, _mm_set1_ps(hi[1])));
+			__m128 inZ = _mm_and_ps(_mm_cmpge_ps(z, _mm_set1_ps(lo[2])), _mm_cmple_ps(z, _mm_set1_ps(hi[2])));
+			return _mm_and_ps(_mm_and_ps(inX, inY), inZ);
+		}
+
+		PCVR_TARGET_AVX2 __m256 test(__m256 x, __m256 y, __m256 z) const
+		{
+			__m256 inX = _mm256_and_ps(_mm256_cmp_ps(x, _mm256_set1_ps(lo[0]), _CMP_GE_OQ), _mm256_cmp_ps(x, _mm256_set1_ps(hi[0]), _CMP_LE_OQ));
+			__m256 inY = _mm256_and_ps(_mm256_cmp_ps(y, _mm256_set1_ps(lo[1]), _CMP_GE_OQ), _mm256_cmp_ps(y, _mm256_set1_ps(hi[1]), _CMP_LE_OQ));
+			__m256 inZ = _mm256_and_ps(_mm256_cmp_ps(z, _mm256_set1_ps(lo[2]), _CMP_GE_OQ), _mm256_cmp_ps(z, _mm256_set1_ps(hi[2]), _CMP_LE_OQ));
+			return _mm256_and_ps(_mm256_and_ps(inX, inY), inZ);
+		}
+#endif
+	};
+
+	struct HalfSpaceTest
+	{
+		float n[4];
+
+		HalfSpaceTest(const osg::Plane& plane)
+		{
+			for (int i = 0; i < 4; i++) n[i] = plane[i];
+		}
+
+		bool test(float x, float y, float z) const
+		{
+			return (x * n[0] + y * n[1] + z * n[2]) + n[3] >= 0.0f;
+		}
+
+#ifdef PCVR_KERNELS_X86
+		__m128 test(__m128 x, __m128 y, __m128 z) const
+		{
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(n[0])), _mm_mul_ps(y, _mm_set1_ps(n[1]))),
+				_mm_mul_ps(z, _mm_set1_ps(n[2]))), _mm_set1_ps(n[3]));
+			return _mm_cmpge_ps(dist, _mm_setzero_ps());
+		}
+
+		PCVR_TARGET_AVX2 __m256 test(__m256 x, __m256 y, __m256 z) const
+		{
+			__m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(n[0])), _mm256_mul_ps(y, _mm256_set1_ps(n[1]))),
+				_mm256_mul_ps(z, _mm256_set1_ps(n[2]))), _mm256_set1_ps(n[3]));
+			return _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_GE_OQ);
+		}
+#endif
+	};
+
+	//-------------------------------------------------------------------------
+	// Drivers. Positions are xyz-interleaved; each SIMD block loads 4 points
+	// as three vectors and shuffles them into x, y and z vectors. The AVX2
+	// path does two such blocks at once, one per 128-bit lane.
+	// The sink receives (first point, bit per point inside, number of points).
+	//-------------------------------------------------------------------------
+
+	template <typename Test, typename Sink>
+	void runScalar(const float* p, std::size_t first, std::size_t n, const Test& t, Sink& sink)
+	{
+		for (std::size_t i = first; i < n; i++)
+		{
+			if (t.test(p[3 * i], p[3 * i + 1], p[3 * i + 2])) sink(i, 1u, 1);
+		}
+	}
+
+#ifdef PCVR_KERNELS_X86
+	template <typename Test, typename Sink>
+	std::size_t runSSE2(const float* p, std::size_t n, const Test& t, Sink& sink)
+	{
+		std::size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			const float* q = p + 3 * i;
+			__m128 a = _mm_loadu_ps(q), b = _mm_loadu_ps(q + 4), c = _mm_loadu_ps(q + 8);
+			__m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 1, 0, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+			__m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 0, 1)),
+				_mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 2, 0, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 1, 0, 2)),
+				_mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+			unsigned int bits = _mm_movemask_ps(t.test(x, y, z));
+			if (bits) sink(i, bits, 4);
+		}
+		return i;
+	}
+
+	inline PCVR_TARGET_AVX2 __m256 load2x128(const float* lo, const float* hi)
+	{
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+	}
+
+	template <typename Test, typename Sink>
+	PCVR_TARGET_AVX2 std::size_t runAVX2(const float* p, std::size_t n, const Test& t, Sink& sink)
+	{
+		std::size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+		{
+			const float* q = p + 3 * i;
+			__m256 a = load2x128(q, q + 12), b = load2x128(q + 4, q + 16), c = load2x128(q + 8, q + 20);
+			__m256 x = _mm256_shuffle_ps(a, _mm256_shuffle_ps(b, c, _MM_SHUFFLE(0, 1, 0, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+			__m256 y = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 0, 1)),
+				_mm256_shuffle_ps(b, c, _MM_SHUFFLE(0, 2, 0, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			__m256 z = _mm256_shuffle_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(0, 1, 0, 2)),
+				_mm256_shuffle_ps(c, c, _MM_SHUFFLE(0, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+			unsigned int bits = _mm256_movemask_ps(t.test(x, y, z));
+			if (bits) sink(i, bits, 8);
+		}
+		return i;
+	}
+#endif
+
+	template <typename Test, typename Sink>
+	void run(const osg::Vec3* points, std::size_t n, const Test& t, Sink& sink)
+	{
+		if (n == 0) return;
+		const float* p = points->ptr();
+		std::size_t done = 0;
+#ifdef PCVR_KERNELS_X86
+		switch (currentPath())
+		{
+		case KERNEL_AVX2:
+			done = runAVX2(p, n, t, sink);
+			break;
+		case KERNEL_SSE2:
+			done = runSSE2(p, n, t, sink);
+			break;
+		default:
+			break;
+		}
+#endif
+		runScalar(p, done, n, t, sink);
+	}
+
+	inline unsigned int lowestBit(unsigned int bits)
+	{
+#if defined(_MSC_VER)
+		unsigned long k;
+		_BitScanForward(&k, bits);
+		return k;
+#else
+		return __builtin_ctz(bits);
+#endif
+	}
+
+	struct IndexSink
+	{
+		std::vector<unsigned int>& indices;
+		unsigned int base;
+
+		void operator()(std::size_t first, unsigned int bits, int)
+		{
+			unsigned int start = base + static_cast<unsigned int>(first);
+			for (; bits != 0; bits &= bits - 1)
+			{
+				indices.push_back(start + lowestBit(bits));
+			}
+		}
+	};
+
+	struct MaskSink
+	{
+		uint64_t* words;
+
+		// Blocks never straddle a word: they start at multiples of their size.
+		void operator()(std::size_t first, unsigned int bits, int)
+		{
+			words[first >> 6] |= uint64_t(bits) << (first & 63);
+		}
+	};
+
+	//-------------------------------------------------------------------------
+	// Motion. Each block reads 4 (SSE2) or 8 (AVX2) points from the columns
+	// and shuffles the results back into xyz order, the inverse of the loads
+	// above.
+	//-------------------------------------------------------------------------
+
+	void motionScalar(const KernelMotionColumns& c, std::size_t first, std::size_t last, const KernelMotion& m,
+		osg::Vec3* out)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			out[i] = m.apply(osg::Vec3(c.x[i], c.y[i], c.z[i]), osg::Vec3(c.u[i], c.v[i], c.w[i]));
+		}
+	}
+
+#ifdef PCVR_KERNELS_X86
+	std::size_t motionSSE2(const KernelMotionColumns& c, std::size_t first, std::size_t last, const KernelMotion& m,
+		osg::Vec3* out)
+	{
+		const __m128 xu = _mm_set1_ps(m.xu), xv = _mm_set1_ps(m.xv), yx = _mm_set1_ps(m.yx), yu = _mm_set1_ps(m.yu),
+			yv = _mm_set1_ps(m.yv), zz = _mm_set1_ps(m.zz), zw = _mm_set1_ps(m.zw);
+		std::size_t i = first;
+		for (; i + 4 <= last; i += 4)
+		{
+			__m128 x0 = _mm_loadu_ps(c.x + i), y0 = _mm_loadu_ps(c.y + i), z0 = _mm_loadu_ps(c.z + i);
+			__m128 u = _mm_loadu_ps(c.u + i), v = _mm_loadu_ps(c.v + i), w = _mm_loadu_ps(c.w + i);
+			__m128 x = _mm_add_ps(_mm_add_ps(x0, _mm_mul_ps(xu, u)), _mm_mul_ps(xv, v));
+			__m128 y = _mm_add_ps(_mm_add_ps(_mm_add_ps(y0, _mm_mul_ps(yx, x0)), _mm_mul_ps(yu, u)), _mm_mul_ps(yv, v));
+			__m128 z = _mm_add_ps(_mm_mul_ps(zz, z0), _mm_mul_ps(zw, w));
+
+			float* q = out[i].ptr();
+			__m128 xy01 = _mm_unpacklo_ps(x, y), xy23 = _mm_unpackhi_ps(x, y);
+			_mm_storeu_ps(q, _mm_shuffle_ps(xy01, _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0)));
+			_mm_storeu_ps(q + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), xy23, _MM_SHUFFLE(1, 0, 2, 0)));
+			_mm_storeu_ps(q + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+				_mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+		}
+		return i;
+	}
+
+	inline PCVR_TARGET_AVX2 void store2x128(float* lo, float* hi, __m256 a)
+	{
+		_mm_storeu_ps(lo, _mm256_castps256_ps128(a));
+		_mm_storeu_ps(hi, _mm256_extractf128_ps(a, 1));
+	}
+
+	PCVR_TARGET_AVX2 std::size_t motionAVX2(const KernelMotionColumns& c, std::size_t first, std::size_t last,
+		const KernelMotion& m, osg::Vec3* out)
+	{
+		const __m256 xu = _mm256_set1_ps(m.xu), xv = _mm256_set1_ps(m.xv), yx = _mm256_set1_ps(m.yx),
+			yu = _mm256_set1_ps(m.yu), yv = _mm256_set1_ps(m.yv), zz = _mm256_set1_ps(m.zz), zw = _mm256_set1_ps(m.zw);
+		std::size_t i = first;
+		for (; i + 8 <= last; i += 8)
+		{
+			__m256 x0 = _mm256_loadu_ps(c.x + i), y0 = _mm256_loadu_ps(c.y + i), z0 = _mm256_loadu_ps(c.z + i);
+			__m256 u = _mm256_loadu_ps(c.u + i), v = _mm256_loadu_ps(c.v + i), w = _mm256_loadu_ps(c.w + i);
+			__m256 x = _mm256_add_ps(_mm256_add_ps(x0, _mm256_mul_ps(xu, u)), _mm256_mul_ps(xv, v));
+			__m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(y0, _mm256_mul_ps(yx, x0)), _mm256_mul_ps(yu, u)),
+				_mm256_mul_ps(yv, v));
+			__m256 z = _mm256_add_ps(_mm256_mul_ps(zz, z0), _mm256_mul_ps(zw, w));
+
+			// Shuffles stay within 128-bit lanes: the low lane holds points
+			// i..i+3 and the high lane points i+4..i+7.
+			float* q = out[i].ptr();
+			__m256 xy01 = _mm256_unpacklo_ps(x, y), xy23 = _mm256_unpackhi_ps(x, y);
+			store2x128(q, q + 12, _mm256_shuffle_ps(xy01, _mm256_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)),
+				_MM_SHUFFLE(2, 0, 1, 0)));
+			store2x128(q + 4, q + 16, _mm256_shuffle_ps(_mm256_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), xy23,
+				_MM_SHUFFLE(1, 0, 2, 0)));
+			store2x128(q + 8, q + 20, _mm256_shuffle_ps(_mm256_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+				_mm256_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+		}
+		return i;
+	}
+#endif
+
+	template <typename Test>
+	void select(const osg::Vec3* points, std::size_t n, const Test& t, std::vector<unsigned int>& indices, unsigned int base)
+	{
+		IndexSink sink = { indices, base };
+		run(points, n, t, sink);
+	}
+
+	template <typename Test>
+	void mask(const osg::Vec3* points, std::size_t n, const Test& t, std::vector<uint64_t>& words)
+	{
+		words.assign((n + 63) / 64, 0);
+		MaskSink sink = { words.data() };
+		run(points, n, t, sink);
+	}
+}
+
+KernelPath getKernelPath()
+{
+	return currentPath();
+}
+
+void setKernelPath(KernelPath path)
+{
+	currentPath() = std::min(path, detectKernelPath());
+}
+
+const char* getKernelPathName(KernelPath path)
+{
+	switch (path)
+	{
+	case KERNEL_AVX2: return "AVX2";
+	case KERNEL_SSE2: return "SSE2";
+	default: return "scalar";
+	}
+}
+
+void selectInCylinder(const osg::Vec3* points, std::size_t n, const KernelCylinder& cyl,
+	std::vector<unsigned int>& indices, unsigned int base)
+{
+	CylinderTest t(cyl);
+	if (t.lengthsq > 0.0f) select(points, n, t, indices, base);
+}
+
+void selectInSphere(const osg::Vec3* points, std::size_t n, const KernelSphere& sphere,
+	std::vector<unsigned int>& indices, unsigned int base)
+{
+	select(points, n, SphereTest(sphere), indices, base);
+}
+
+void selectInBox(const osg::Vec3* points, std::size_t n, const osg::BoundingBox& box,
+	std::vector<unsigned int>& indices, unsigned int base)
+{
+	if (box.valid()) select(points, n, BoxTest(box), indices, base);
+}
+
+void selectInHalfSpace(const osg::Vec3* points, std::size_t n, const osg::Plane& plane,
+	std::vector<unsigned int>& indices, unsigned int base)
+{
+	select(points, n, HalfSpaceTest(plane), indices, base);
+}
+
+void maskInCylinder(const osg::Vec3* points, std::size_t n, const KernelCylinder& cyl, std::vector<uint64_t>& words)
+{
+	CylinderTest t(cyl);
+	if (t.lengthsq > 0.0f)
+	{
+		mask(points, n, t, words);
+	}
+	else
+	{
+		words.assign((n + 63) / 64, 0);
+	}
+}
+
+void maskInSphere(const osg::Vec3* points, std::size_t n, const KernelSphere& sphere, std::vector<uint64_t>& words)
+{
+	mask(points, n, SphereTest(sphere), words);
+}
+
+void maskInBox(const osg::Vec3* points, std::size_t n, const osg::BoundingBox& box, std::vector<uint64_t>& words)
+{
+	if (box.valid())
+	{
+		mask(points, n, BoxTest(box), words);
+	}
+	else
+	{
+		words.assign((n + 63) / 64, 0);
+	}
+}
+
+void maskInHalfSpace(const osg::Vec3* points, std::size_t n, const osg::Plane& plane, std::vector<uint64_t>& words)
+{
+	mask(points, n, HalfSpaceTest(plane), words);
+}
+
+void propagateMotion(const KernelMotionColumns& columns, std::size_t first, std::size_t last,
+	const KernelMotion& motion, osg::Vec3* out)
+{
+	std::size_t done = first;
+#ifdef PCVR_KERNELS_X86
+	switch (currentPath())
+	{
+	case KERNEL_AVX2:
+		done = motionAVX2(columns, first, last, motion, out);
+		break;
+	case KERNEL_SSE2:
+		done = motionSSE2(columns, first, last, motion, out);
+		break;
+	default:
+		break;
+	}
+#endif
+	motionScalar(columns, done, last, motion, out);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <osg/BoundingBox>
+#include <osg/Plane>
+#include <osg/Vec3>
+
+//-----------------------------------------------------------------------------
+// Containment kernels
+//    Test a contiguous run of positions (e.g. the front of an osg::Vec3Array)
+// against a selection shape. The shape must be given in the same space as the
+// positions.
+//
+//    Each shape has two forms:
+//  - select*: appends the indices (offset by 'base') of the points inside the
+//    shape to 'indices', in increasing order.
+//  - mask*: resizes 'mask' to (n + 63) / 64 words and sets bit i for each
+//    point i inside the shape.
+//
+//    The kernels pick the widest SIMD path the CPU supports at run time
+// (AVX2, then SSE2, then scalar). All paths give the same answer.
+//-----------------------------------------------------------------------------
+
+// Cylinder with its axis from pt1 to pt2; same test as CylTest_CapsFirst.
+struct KernelCylinder
+{
+	osg::Vec3 pt1, pt2;
+	float radius;
+};
+
+struct KernelSphere
+{
+	osg::Vec3 center;
+	float radius;
+};
+
+enum KernelPath { KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2 };
+
+// SIMD path used by the kernels; can be lowered (e.g. for benchmarking).
+KernelPath getKernelPath();
+void setKernelPath(KernelPath path);
+const char* getKernelPathName(KernelPath path);
+
+void selectInCylinder(const osg::Vec3* points, std::size_t n, const KernelCylinder& cyl,
+	std::vector<unsigned int>& indices, unsigned int base = 0);
+void selectInSphere(const osg::Vec3* points, std::size_t n, const KernelSphere& sphere,
+	std::vector<unsigned int>& indices, unsigned int base = 0);
+void selectInBox(const osg::Vec3* points, std::size_t n, const osg::BoundingBox& box,
+	std::vector<unsigned int>& indices, unsigned int base = 0);
+// Points on the positive side of the plane (distance >= 0) are inside.
+void selectInHalfSpace(const osg::Vec3* points, std::size_t n, const osg::Plane& plane,
+	std::vector<unsigned int>& indices, unsigned int base = 0);
+
+void maskInCylinder(const osg::Vec3* points, std::size_t n, const KernelCylinder& cyl, std::vector<uint64_t>& mask);
+void maskInSphere(const osg::Vec3* points, std::size_t n, const KernelSphere& sphere, std::vector<uint64_t>& mask);
+void maskInBox(const osg::Vec3* points, std::size_t n, const osg::BoundingBox& box, std::vector<uint64_t>& mask);
+void maskInHalfSpace(const osg::Vec3* points, std::size_t n, const osg::Plane& plane, std::vector<uint64_t>& mask);
+
+//-----------------------------------------------------------------------------
+// Motion kernel
+//    Moves points along closed-form trajectories that are linear in their
+// start position (x0, y0, z0) and velocity (u, v, w), as the epicycle
+// approximation and straight line motion both are:
+//    x = x0 + xu * u + xv * v
+//    y = y0 + yx * x0 + yu * u + yv * v
+//    z = zz * z0 + zw * w
+// The coefficients depend only on the time, so they are computed once per
+// frame. Start positions and velocities are read from separate columns; the
+// moved points are written xyz-interleaved (e.g. into an osg::Vec3Array).
+// Every SIMD path gives the same answer as KernelMotion::apply.
+//-----------------------------------------------------------------------------
+
+struct KernelMotion
+{
+	float xu, xv, yx, yu, yv, zz, zw;
+
+	osg::Vec3 apply(const osg::Vec3& p, const osg::Vec3& vel) const
+	{
+		return osg::Vec3(p.x() + xu * vel.x() + xv * vel.y(),
+			p.y() + yx * p.x() + yu * vel.x() + yv * vel.y(),
+			zz * p.z() + zw * vel.z());
+	}
+};
+
+struct KernelMotionColumns
+{
+	const float* x;
+	const float* y;
+	const float* z;
+	const float* u;
+	const float* v;
+	const float* w;
+};
+
+// Moves points [first, last) of the columns into out[first, last).
+void propagateMotion(const KernelMotionColumns& columns, std::size_t first, std::size_t last,
+	const KernelMotion& motion, osg::Vec3* out);
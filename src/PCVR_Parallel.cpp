@@ -0,0 +1,41 @@
+#include "PCVR_Parallel.hpp"
+
+namespace
+{
+	const std::size_t BOUNDS_BLOCK_POINTS = 65536;
+}
+
+unsigned int numWorkerThreads()
+{
+	static const unsigned int n = std::max(1u, std::thread::hardware_concurrency());
+	return n;
+}
+
+unsigned int& threadBudget()
+{
+	thread_local unsigned int budget = numWorkerThreads();
+	return budget;
+}
+
+osg::BoundingBox computeBounds(const osg::Vec3* verts, std::size_t n)
+{
+	// One box per fixed block, merged in order, so the result does not depend on the thread count.
+	std::vector<osg::BoundingBox> blocks((n + BOUNDS_BLOCK_POINTS - 1) / BOUNDS_BLOCK_POINTS);
+	parallelFor(0, blocks.size(), [&](std::size_t firstBlock, std::size_t lastBlock)
+	{
+		for (std::size_t b = firstBlock; b < lastBlock; b++)
+		{
+			for (std::size_t i = b * BOUNDS_BLOCK_POINTS; i < std::min((b + 1) * BOUNDS_BLOCK_POINTS, n); i++)
+			{
+				blocks[b].expandBy(verts[i]);
+			}
+		}
+	}, 1);
+
+	osg::BoundingBox bounds;
+	for (const osg::BoundingBox& box : blocks)
+	{
+		bounds.expandBy(box);
+	}
+	return bounds;
+}
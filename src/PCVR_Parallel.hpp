@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <osg/BoundingBox>
+
+// Number of hardware threads (at least 1).
+unsigned int numWorkerThreads();
+
+// Bounding box of n points, computed in parallel blocks.
+osg::BoundingBox computeBounds(const osg::Vec3* verts, std::size_t n);
+
+// Number of threads a parallelFor started from the calling thread may use.
+// Workers of an outer parallelFor get an equal share of the outer call's
+// threads, so nested loops (e.g. decoding several files at once, each with a
+// parallel decoder) do not oversubscribe the machine.
+unsigned int& threadBudget();
+
+//-----------------------------------------------------------------------------
+// Name: parallelFor
+// Desc:
+//    Splits [begin, end) into blocks of 'grain' indices and calls
+// func(blockBegin, blockEnd) for each block from a set of std::threads.
+// Blocks are handed out dynamically, so uneven work balances itself.
+// The calling thread takes part in the work, and the call returns once every
+// block is done. func must be safe to call concurrently on disjoint ranges.
+//-----------------------------------------------------------------------------
+template <typename Func>
+void parallelFor(std::size_t begin, std::size_t end, Func func, std::size_t grain = 65536)
+{
+	if (end <= begin) return;
+	grain = std::max<std::size_t>(grain, 1);
+
+	std::size_t numBlocks = (end - begin + grain - 1) / grain;
+	unsigned int budget = threadBudget();
+	std::size_t numThreads = std::min<std::size_t>(budget, numBlocks);
+	if (numThreads <= 1)
+	{
+		func(begin, end);
+		return;
+	}
+
+	unsigned int share = std::max<unsigned int>(1, budget / static_cast<unsigned int>(numThreads));
+	std::atomic<std::size_t> nextBlock(0);
+	auto worker = [&]()
+	{
+		unsigned int outer = threadBudget();
+		threadBudget() = share;
+		for (std::size_t block = nextBlock++; block < numBlocks; block = nextBlock++)
+		{
+			std::size_t first = begin + block * grain;
+			func(first, std::min(first + grain, end));
+		}
+		threadBudget() = outer;
+	};
+
+	std::vector<std::thread> threads;
+	for (std::size_t t = 1; t < numThreads; t++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& t : threads)
+	{
+		t.join();
+	}
+}
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cmath>
+
+#include "PCVR_Kernels.hpp"
+#include "PCVR_Parallel.hpp"
+
+#include "PCVR_PointGrid.hpp"
+
+namespace
+{
+	const float POINTS_PER_CELL = 16.0f;	// target density when sizing cells
+	const int MAX_CELLS_PER_AXIS = 2048;
+	const std::size_t QUERY_GRAIN = 64;	// cells per parallel query block
+
+	enum CellResult { CELL_OUTSIDE, CELL_PARTIAL, CELL_INSIDE };
+
+	// Distance squared from p to the segment a-b.
+	float segmentDistance2(const osg::Vec3& a, const osg::Vec3& b, const osg::Vec3& p)
+	{
+		osg::Vec3 d = b - a;
+		float len2 = d.length2();
+		float t = len2 > 0.0f ? std::min(std::max(((p - a) * d) / len2, 0.0f), 1.0f) : 0.0f;
+		return (a + d * t - p).length2();
+	}
+}
+
+PCVR_PointGrid::PCVR_PointGrid()
+{
+}
+
+bool PCVR_PointGrid::isBuilt() const
+{
+	return _positions.valid();
+}
+
+void PCVR_PointGrid::build(const osg::Vec3Array* positions)
+{
+	_positions = positions;
+	_cellStart.clear();
+	_indices.clear();
+	_bounds.init();
+
+	const std::size_t n = positions ? positions->size() : 0;
+	if (n == 0) return;
+	const osg::Vec3* verts = &positions->front();
+
+	for (std::size_t i = 0; i < n; i++)
+	{
+		_bounds.expandBy(verts[i]);
+	}
+
+	// Size cells for a few points each, then coarsen until the cell table
+	// stays well below the point count.
+	osg::Vec3 extent = _bounds._max - _bounds._min;
+	float volume = std::max(extent.x(), 1e-3f) * std::max(extent.y(), 1e-3f) * std::max(extent.z(), 1e-3f);
+	_cellSize = std::cbrt(volume * POINTS_PER_CELL / n);
+	std::size_t maxCells = std::max<std::size_t>(n / 8, 1);
+	while (true)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			_dims[axis] = std::max(1, static_cast<int>(std::ceil(extent[axis] / _cellSize)));
+		}
+		std::size_t numCells = std::size_t(_dims[0]) * _dims[1] * _dims[2];
+		if (numCells <= maxCells && std::max(_dims[0], std::max(_dims[1], _dims[2])) <= MAX_CELLS_PER_AXIS) break;
+		_cellSize *= 1.25f;
+	}
+	const std::size_t numCells = std::size_t(_dims[0]) * _dims[1] * _dims[2];
+
+	// Counting sort of the point indices by cell.
+	std::vector<uint32_t> cells(n);
+	parallelFor(0, n, [&](std::size_t first, std::size_t last)
+	{
+		for (std::size_t i = first; i < last; i++)
+		{
+			cells[i] = cellOf(verts[i]);
+		}
+	});
+
+	_cellStart.assign(numCells + 1, 0);
+	for (uint32_t c : cells)
+	{
+		_cellStart[c + 1]++;
+	}
+	for (std::size_t c = 0; c < numCells; c++)
+	{
+		_cellStart[c + 1] += _cellStart[c];
+	}
+
+	_indices.resize(n);
+	std::vector<uint32_t> next(_cellStart.begin(), _cellStart.end() - 1);
+	for (std::size_t i = 0; i < n; i++)
+	{
+		_indices[next[cells[i]]++] = static_cast<uint32_t>(i);
+	}
+}
+
+int PCVR_PointGrid::cellCoord(float v, int axis) const
+{
+	int c = static_cast<int>((v - _bounds._min[axis]) / _cellSize);
+	return std::min(std::max(c, 0), _dims[axis] - 1);
+}
+
+uint32_t PCVR_PointGrid::cellOf(const osg::Vec3& p) const
+{
+	return cellCoord(p.x(), 0) + _dims[0] * (cellCoord(p.y(), 1) + _dims[1] * cellCoord(p.z(), 2));
+}
+
+template <typename CellTest, typename Kernel>
+void PCVR_PointGrid::query(const osg::BoundingBox& region, CellTest cellTest, Kernel kernel,
+	std::vector<unsigned int>& result) const
+{
+	result.clear();
+	if (_indices.empty() || !region.valid() || !region.intersects(_bounds)) return;
+
+	int lo[3], hi[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		lo[axis] = cellCoord(region._min[axis], axis);
+		hi[axis] = cellCoord(region._max[axis], axis);
+	}
+
+	// Classify the overlapped cells first, keeping only non-empty ones.
+	std::vector<std::pair<uint32_t, bool>> cells;	// (cell, fully inside)
+	const osg::Vec3 size(_cellSize, _cellSize, _cellSize);
+	const osg::Vec3 pad = size * 0.01f;
+	for (int z = lo[2]; z <= hi[2]; z++)
+	{
+		for (int y = lo[1]; y <= hi[1]; y++)
+		{
+			for (int x = lo[0]; x <= hi[0]; x++)
+			{
+				uint32_t c = x + _dims[0] * (y + _dims[1] * z);
+				if (_cellStart[c] == _cellStart[c + 1]) continue;
+
+				// Pad the cell a little so rounding can never call a cell inside
+				// when one of its points tests outside.
+				osg::Vec3 cellMin = _bounds._min + osg::Vec3(x, y, z) * _cellSize;
+				osg::BoundingBox cellBox(cellMin - pad, cellMin + size + pad);
+				CellResult r = cellTest(cellBox);
+				if (r != CELL_OUTSIDE) cells.push_back(std::make_pair(c, r == CELL_INSIDE));
+			}
+		}
+	}
+
+	const osg::Vec3* verts = &_positions->front();
+	std::vector<std::vector<unsigned int>> blocks((cells.size() + QUERY_GRAIN - 1) / QUERY_GRAIN);
+	parallelFor(0, cells.size(), [&](std::size_t first, std::size_t last)
+	{
+		// Points of inside cells are taken as is; the rest are gathered into a
+		// contiguous run for the kernel.
+		std::vector<unsigned int>& out = blocks[first / QUERY_GRAIN];
+		std::vector<unsigned int> candidates, hits;
+		std::vector<osg::Vec3> gathered;
+		for (std::size_t k = first; k < last; k++)
+		{
+			uint32_t c = cells[k].first;
+			std::vector<unsigned int>& dest = cells[k].second ? out : candidates;
+			dest.insert(dest.end(), _indices.begin() + _cellStart[c], _indices.begin() + _cellStart[c + 1]);
+		}
+
+		gathered.reserve(candidates.size());
+		for (unsigned int i : candidates)
+		{
+			gathered.push_back(verts[i]);
+		}
+		if (!gathered.empty()) kernel(gathered.data(), gathered.size(), hits);
+		for (unsigned int h : hits)
+		{
+			out.push_back(candidates[h]);
+		}
+	}, QUERY_GRAIN);
+
+	for (const std::vector<unsigned int>& block : blocks)
+	{
+		result.insert(result.end(), block.begin(), block.end());
+	}
+}
+
+void PCVR_PointGrid::queryCylinder(const osg::Vec3& pt1, const osg::Vec3& pt2, float radius,
+	std::vector<unsigned int>& result) const
+{
+	osg::Vec3 axis = pt2 - pt1;
+	float lengthsq = axis.length2();
+	if (lengthsq <= 0.0f)
+	{
+		result.clear();
+		return;
+	}
+
+	// Bounding box of the cylinder: the caps extend r * sin(angle to each axis).
+	osg::Vec3 dir = axis / std::sqrt(lengthsq);
+	osg::BoundingBox region;
+	for (int i = 0; i < 3; i++)
+	{
+		float e = radius * std::sqrt(std::max(0.0f, 1.0f - dir[i] * dir[i]));
+		region._min[i] = std::min(pt1[i], pt2[i]) - e;
+		region._max[i] = std::max(pt1[i], pt2[i]) + e;
+	}
+
+	KernelCylinder cyl = { pt1, pt2, radius };
+	query(region,
+		[&](const osg::BoundingBox& cell)
+		{
+			float reach = radius + cell.radius();
+			if (segmentDistance2(pt1, pt2, cell.center()) > reach * reach) return CELL_OUTSIDE;
+
+			osg::Vec3 corners[8];
+			for (unsigned int k = 0; k < 8; k++)
+			{
+				corners[k] = cell.corner(k);
+			}
+			std::vector<uint64_t> mask;
+			maskInCylinder(corners, 8, cyl, mask);
+			return mask[0] == 0xff ? CELL_INSIDE : CELL_PARTIAL;
+		},
+		[&](const osg::Vec3* points, std::size_t n, std::vector<unsigned int>& hits)
+		{
+			selectInCylinder(points, n, cyl, hits);
+		},
+		result);
+}
+
+void PCVR_PointGrid::querySphere(const osg::Vec3& center, float radius, std::vector<unsigned int>& result) const
+{
+	osg::Vec3 r(radius, radius, radius);
+	KernelSphere sphere = { center, radius };
+	query(osg::BoundingBox(center - r, center + r),
+		[&](const osg::BoundingBox& cell)
+		{
+			float d = (cell.center() - center).length();
+			if (d > radius + cell.radius()) return CELL_OUTSIDE;
+			return d + cell.radius() <= radius ? CELL_INSIDE : CELL_PARTIAL;
+		},
+		[&](const osg::Vec3* points, std::size_t n, std::vector<unsigned int>& hits)
+		{
+			selectInSphere(points, n, sphere, hits);
+		},
+		result);
+}
+
+void PCVR_PointGrid::queryBox(const osg::BoundingBox& box, std::vector<unsigned int>& result) const
+{
+	query(box,
+		[&](const osg::BoundingBox& cell)
+		{
+			return box.contains(cell._min) && box.contains(cell._max) ? CELL_INSIDE : CELL_PARTIAL;
+		},
+		[&](const osg::Vec3* points, std::size_t n, std::vector<unsigned int>& hits)
+		{
+			selectInBox(points, n, box, hits);
+		},
+		result);
+}
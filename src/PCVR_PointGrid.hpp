@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <osg/Array>
+#include <osg/BoundingBox>
+
+//-----------------------------------------------------------------------------
+// PCVR_PointGrid
+//    Uniform grid over the indices of a point array, for region queries that
+// should only look at points near the region. Point indices are counting-
+// sorted by cell, so each cell is one contiguous run of _indices.
+//
+//    Queries visit only the cells overlapping the region's bounding box, skip
+// cells that are provably outside the region, and test the points of the
+// remaining cells exactly. Results are point indices in cell order.
+//
+//    The grid keeps a pointer to the positions it was built from; rebuild it
+// if they move.
+//-----------------------------------------------------------------------------
+class PCVR_PointGrid
+{
+public:
+	PCVR_PointGrid();
+
+	void build(const osg::Vec3Array* positions);
+	bool isBuilt() const;
+
+	// Points inside the cylinder whose axis runs from pt1 to pt2.
+	void queryCylinder(const osg::Vec3& pt1, const osg::Vec3& pt2, float radius,
+		std::vector<unsigned int>& result) const;
+	void querySphere(const osg::Vec3& center, float radius, std::vector<unsigned int>& result) const;
+	void queryBox(const osg::BoundingBox& box, std::vector<unsigned int>& result) const;
+
+private:
+	osg::ref_ptr<const osg::Vec3Array> _positions;
+	osg::BoundingBox _bounds;
+	float _cellSize = 1.0f;
+	int _dims[3] = { 0, 0, 0 };
+	std::vector<uint32_t> _cellStart;	// _indices[_cellStart[c], _cellStart[c + 1]) are in cell c
+	std::vector<uint32_t> _indices;
+
+	int cellCoord(float v, int axis) const;
+	uint32_t cellOf(const osg::Vec3& p) const;
+
+	template <typename CellTest, typename Kernel>
+	void query(const osg::BoundingBox& region, CellTest cellTest, Kernel kernel,
+		std::vector<unsigned int>& result) const;
+};
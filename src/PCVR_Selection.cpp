@@ -29,6 +29,10 @@ void PCVR_Selection::ShowAllSelections(bool b)
 	}
 }
 
+const std::list<PCVR_Selection*>& PCVR_Selection::GetSelections()
+{
+	return _Selections;
+}
 
 PCVR_Selection::PCVR_Selection()
 	: Removable()
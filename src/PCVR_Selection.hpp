@@ -25,6 +25,7 @@ class PCVR_Selection : public Removable
 public:
 	static void SaveAllSelections(const std::string& path, const std::vector<PCVR_Selectable*>& points);
 	static void ShowAllSelections(bool b);
+	static const std::list<PCVR_Selection*>& GetSelections();
 
 	PCVR_Selection();
 	virtual void remove() override;
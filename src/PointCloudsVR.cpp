@@ -22,6 +22,7 @@ permissions and limitations under the License.
 
 **********************************************************************/
 
+#include <chrono>
 #include <iostream>
 
 #include <osgDB/FileNameUtils>
@@ -33,8 +34,13 @@ permissions and limitations under the License.
 #include "ModelScene.hpp"
 #include "LasModelScene.hpp"
 #include "FlowScene.hpp"
+#include "LasDbhEstimator.hpp"
+#include "LasModel.hpp"
+#include "LasOctree.hpp"
 
 PCVR_Scene* chooseScene(osg::ArgumentParser& args);
+int buildOctree(osg::ArgumentParser& args, const std::string& outDir);
+int runBatch(osg::ArgumentParser& args, const std::string& task);
 void checkArgs(osg::ArgumentParser& args);
 void usage();
 
@@ -44,6 +50,12 @@ int main(int argc, char **argv)
 
 	if (args.argc() == 1 || args.read("--help")) usage();
 
+	std::string octreeDir;
+	if (args.read("--buildOctree", octreeDir)) return buildOctree(args, octreeDir);
+
+	std::string batchTask;
+	if (args.read("--batch", batchTask)) return runBatch(args, batchTask);
+
 	PCVR_Scene* scene = chooseScene(args);
 
 	scene->parseArgs(args);
@@ -61,8 +73,8 @@ PCVR_Scene* chooseScene(osg::ArgumentParser& args)
 	if (!args.read("--scene", sceneArg))
 	{
 		int i = args.find("--data");
-		if (i != -1 &&
-			osgDB::getLowerCaseFileExtension(args[i + 1]) == "las")
+		std::string ext = i != -1 ? osgDB::getLowerCaseFileExtension(args[i + 1]) : "";
+		if (i != -1 && (ext == "las" || ext == "laz" || LasOctree::IsOctreeIndex(args[i + 1])))
 		{
 			return new LasModelScene();
 		}
@@ -89,6 +101,82 @@ PCVR_Scene* chooseScene(osg::ArgumentParser& args)
 	exit(1);
 }
 
+int buildOctree(osg::ArgumentParser& args, const std::string& outDir)
+{
+	std::vector<std::string> inputs;
+	std::string dataPath;
+	while (args.read("--data", dataPath))
+	{
+		inputs.push_back(dataPath);
+	}
+	checkArgs(args);
+
+	if (inputs.empty())
+	{
+		std::cout << "--buildOctree needs at least one --data LAS file." << std::endl;
+		return 1;
+	}
+
+	LasOctreeBuilder builder(inputs, outDir);
+	return builder.build() ? 0 : 1;
+}
+
+int runBatch(osg::ArgumentParser& args, const std::string& task)
+{
+	if (task != "dbh")
+	{
+		std::cout << "--batch must be followed by one of the following values: dbh" << std::endl;
+		return 1;
+	}
+
+	// Batch jobs never open a window, so --novr is implied.
+	args.read("--novr");
+
+	std::vector<std::string> inputs;
+	std::string dataPath;
+	while (args.read("--data", dataPath))
+	{
+		inputs.push_back(dataPath);
+	}
+	std::string outPath = "dbh.csv";
+	args.read("--output", outPath);
+
+	LasLoadOptions loadOptions;
+	args.read("--removeOutliers", loadOptions.outlierNeighbors, loadOptions.outlierSigma);
+	readLasPointFilter(args, loadOptions.filter);
+	LasDbhOptions dbhOptions;
+	args.read("--breastHeight", dbhOptions.breastHeight);
+	args.read("--sliceThickness", dbhOptions.sliceThickness);
+	args.read("--stemDistance", dbhOptions.clusterDistance);
+	args.read("--fitTolerance", dbhOptions.fitTolerance);
+	checkArgs(args);
+
+	if (inputs.empty())
+	{
+		std::cout << "--batch dbh needs at least one --data LAS file." << std::endl;
+		return 1;
+	}
+
+	LasDbhEstimator estimator(dbhOptions);
+	std::vector<LasStem> stems;
+	for (const std::string& input : inputs)
+	{
+		auto start = std::chrono::steady_clock::now();
+		osg::ref_ptr<LasModel> model = new LasModel(input, loadOptions);
+		if (!model->load() || model->isOctree())
+		{
+			std::cout << "Skipping " << input << ": DBH needs a LAS or LAZ file." << std::endl;
+			continue;
+		}
+		std::size_t numStems = estimator.estimate(model->getPointTable(), model->getOrigin(), stems);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << input << ": " << numStems << " stems from " << model->getPointTable().size()
+			<< " points in " << seconds << " s" << std::endl;
+	}
+
+	return LasDbhEstimator::WriteCsv(outPath, stems) ? 0 : 1;
+}
+
 void checkArgs(osg::ArgumentParser& args)
 {
 	args.reportRemainingOptionsAsUnrecognized();
@@ -111,6 +199,46 @@ void usage()
 		"    --winRes <num pixels>              Change width, height for square mirror window from default 600x600.\n"
 		"                                           Higher resolution means worse performance, but better screenshots.\n"
 		"\n"
+		"LAS options:\n"
+		"    --buildOctree <directory>          Build an LOD octree of the --data LAS files in <directory> and exit.\n"
+		"                                           Pass <directory>/octree.json to --data to view it.\n"
+		"    --pointBudget <num points>         Most octree points drawn per frame, across all octrees (default 5000000).\n"
+		"    --cacheBudget <num points>         Most octree points kept in memory, across all octrees (default 20000000).\n"
+		"    --screenSpaceError <pixels>        Refine octree nodes whose point spacing looks larger than this (default 2).\n"
+		"    --removeOutliers <k> <sigma>       Remove points whose mean distance to their k nearest neighbors is more than\n"
+		"                                           sigma standard deviations above average, as each LAS file loads.\n"
+		"    --voxel <size>                     Downsample each LAS file to one point per voxel of this size as it loads.\n"
+		"    --maxPoints <num points>           Downsample each LAS file to at most this many points as it loads.\n"
+		"    --memoryBudget <megabytes>         Stream uncompressed LAS files whose points would need more memory than this\n"
+		"                                           a window at a time, decimating as they load, and report the peak.\n"
+		"    --lasClasses <list>                Load only points of these classifications, e.g. 2 for ground or 3,4,5.\n"
+		"    --lasReturns <spec>                Load only these returns: first, last, single, or numbers such as 1,2.\n"
+		"    --lasBounds <minX minY maxX maxY>  Load only points inside this area, in the file's coordinates; add minZ\n"
+		"                                           and maxZ as <minX minY minZ maxX maxY maxZ> to bound heights too.\n"
+		"                                           Points are filtered as they are decoded, and octree nodes outside\n"
+		"                                           the area are never read.\n"
+		"    --colorBy <mode>                   What the color checkbox colors points by (default class): class, return,\n"
+		"                                           intensity, change, or a local geometry feature: normal, curvature,\n"
+		"                                           planarity, linearity or density. Features are computed nearest the\n"
+		"                                           viewer first.\n"
+		"    --align                            Align each additional --data LAS file onto the first with point-to-plane\n"
+		"                                           ICP after loading (also on the controller menu's Align Scans button).\n"
+		"    --alignDistance <distance>         Largest misalignment the alignment corrects (default 1).\n"
+		"    --changeFrom <LAS file>            Measure how far each point moved since this earlier survey of the same\n"
+		"                                           area, as the distance to its nearest point; colors by change unless\n"
+		"                                           --colorBy says otherwise.\n"
+		"    --m3c2 <radius>                    With --changeFrom, measure signed change along each point's normal,\n"
+		"                                           averaged over a cylinder of this radius (M3C2).\n"
+		"\n"
+		"Batch options (no window is opened):\n"
+		"    --batch dbh                        Fit a circle to every trunk at breast height in the --data LAS files and\n"
+		"                                           write x, y, ground z, diameter and fit quality per stem to a CSV file.\n"
+		"    --output <file>                    CSV file to write (default dbh.csv).\n"
+		"    --breastHeight <height>            Height above ground of the measured slice (default 1.3).\n"
+		"    --sliceThickness <thickness>       Thickness of the measured slice (default 0.1).\n"
+		"    --stemDistance <distance>          Slice points closer than this belong to the same stem (default 0.1).\n"
+		"    --fitTolerance <distance>          Points this close to a fitted circle count as trunk points (default 0.02).\n"
+		"\n"
 		"Gaia options :\n"
 		"    --minPc       <parsecs>            Filter out stars closer than --minPc or farther than --maxPc.\n"
 		"    --maxPc       <parsecs>\n"
@@ -120,7 +248,8 @@ void usage()
 		"    --maxMag      <abs mag>\n"
 		"    --minTeff     <effective temp>     Filter out stars with effective temperature less than --minTeff or greater than --maxTeff.\n"
 		"    --maxTeff     <effective temp>\n"
-		"    --magColor                         If present, color stars by magnitude as opposed to by teff(which is the default)."
+		"    --magColor                         If present, color stars by magnitude as opposed to by teff(which is the default).\n"
+		"    --isochroneTolerance <mag>         Match stars to isochrone entries within this many magnitudes in G and BP-RP (default 0.25).\n"
 		"\n"
 		"Flow options:\n"
 		"    --diatom					Filter by showing only diatom Phytoplanktons.\n"
@@ -1,5 +1,7 @@
 #include <filesystem>
 
+#include "PCVR_Kernels.hpp"
+
 #include "SphereDrawer.hpp"
 
 namespace fs = std::experimental::filesystem;
@@ -38,14 +40,40 @@ void SelectionSphere::save(const std::string& path, const std::vector<PCVR_Selec
 	file << "#Origin: " << x << " " << y << " " << z << std::endl;
 	file << "#Radius: " << getRadius() << std::endl;
 
-	osg::Vec3 selPos = osg::Vec3(x, y, z);
+	for (PCVR_Selectable* p : getPointsInside(points))
+	{
+		p->writeToStream(file);
+	}
+}
+
+std::vector<PCVR_Selectable*> SelectionSphere::getPointsInside(const std::vector<PCVR_Selectable*>& points)
+{
+	// Copy the positions into one contiguous run for the sphere kernel.
+	std::vector<osg::Vec3> positions;
+	positions.reserve(points.size());
 	for (PCVR_Selectable* p : points)
 	{
-		if ((p->getPos() - selPos).length() <= getRadius())
-		{
-			p->writeToStream(file);
-		}
+		positions.push_back(p->getPos());
+	}
+	return getPointsInside(points, positions.data());
+}
+
+std::vector<PCVR_Selectable*> SelectionSphere::getPointsInside(const std::vector<PCVR_Selectable*>& points,
+	const osg::Vec3* positions)
+{
+	double x, y, z;
+	getSpherePosition(x, y, z);
+	KernelSphere sphere = { osg::Vec3(x, y, z), static_cast<float>(getRadius()) };
+	std::vector<unsigned int> inside;
+	selectInSphere(positions, points.size(), sphere, inside);
+
+	std::vector<PCVR_Selectable*> result;
+	result.reserve(inside.size());
+	for (unsigned int i : inside)
+	{
+		result.push_back(points[i]);
 	}
+	return result;
 }
 
 void SelectionSphere::remove()
@@ -14,6 +14,14 @@ public:
 	virtual void save(const std::string& path, const std::vector<PCVR_Selectable*>& points) override;
 	virtual void show(bool b) override;
 	virtual void remove() override;
+
+protected:
+	// The given points that lie inside the sphere, in their original order.
+	std::vector<PCVR_Selectable*> getPointsInside(const std::vector<PCVR_Selectable*>& points);
+	// Same, for a scene that also keeps the points' positions contiguously
+	// (positions[i] is points[i]->getPos()), so none are gathered.
+	std::vector<PCVR_Selectable*> getPointsInside(const std::vector<PCVR_Selectable*>& points,
+		const osg::Vec3* positions);
 };
 
 template <typename S>
@@ -0,0 +1,176 @@
+//-----------------------------------------------------------------------------
+// KernelBench
+//    Compares the containment kernels in PCVR_Kernels against the scalar
+// selection tests they replaced: CylTest_CapsFirst for the disk tool and the
+// (p - center).length() <= radius loop of the sphere tools. Also times the
+// motion kernel against the per-star epicycle loop the Gaia scene used.
+//
+//    Usage: PCVR_KernelBench [num points] [repeats]
+//-----------------------------------------------------------------------------
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <osg/Vec3>
+
+#include "../PCVR_Kernels.hpp"
+#include "../PCVR_Math.hpp"
+
+namespace
+{
+	template <typename Func>
+	double timeMs(int repeats, Func func)
+	{
+		double best = 1e30;
+		for (int r = 0; r < repeats; r++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			func();
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			best = std::min(best, elapsed.count());
+		}
+		return best;
+	}
+
+	void report(const char* name, std::size_t numPoints, double ms, std::size_t hits, double baselineMs)
+	{
+		std::cout << "  " << name << ": " << ms << " ms, " << numPoints / ms / 1000.0 << " Mpts/s, "
+			<< hits << " inside";
+		if (baselineMs > 0.0) std::cout << ", " << baselineMs / ms << "x";
+		std::cout << std::endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::size_t numPoints = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+	int repeats = argc > 2 ? std::atoi(argv[2]) : 5;
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> coord(-50.0f, 50.0f);
+	std::vector<osg::Vec3> points(numPoints);
+	for (osg::Vec3& p : points)
+	{
+		p.set(coord(rng), coord(rng), coord(rng) * 0.3f);
+	}
+
+	KernelCylinder cyl = { osg::Vec3(1.0f, -2.0f, -10.0f), osg::Vec3(3.0f, 0.0f, 10.0f), 8.0f };
+	KernelSphere sphere = { osg::Vec3(5.0f, 5.0f, 0.0f), 20.0f };
+	osg::BoundingBox box(-10.0f, -20.0f, -5.0f, 15.0f, 10.0f, 5.0f);
+	osg::Plane plane(osg::Vec3(0.3f, 0.5f, 0.8f), osg::Vec3(0.0f, 0.0f, 0.0f));
+
+	std::cout << numPoints << " points, best of " << repeats << " runs" << std::endl;
+
+	std::vector<unsigned int> indices;
+	indices.reserve(numPoints);
+	std::vector<uint64_t> mask;
+
+	// Baselines: the scalar tests the selection tools used before.
+	std::cout << "Cylinder" << std::endl;
+	float lengthsq = (cyl.pt2 - cyl.pt1).length2();
+	double cylBase = timeMs(repeats, [&]()
+	{
+		indices.clear();
+		for (std::size_t i = 0; i < numPoints; i++)
+		{
+			if (CylTest_CapsFirst(cyl.pt1, cyl.pt2, lengthsq, cyl.radius * cyl.radius, points[i]) != -1.0f) indices.push_back(i);
+		}
+	});
+	report("CylTest_CapsFirst", numPoints, cylBase, indices.size(), 0.0);
+
+	std::cout << "Sphere" << std::endl;
+	double sphereBase = timeMs(repeats, [&]()
+	{
+		indices.clear();
+		for (std::size_t i = 0; i < numPoints; i++)
+		{
+			if ((points[i] - sphere.center).length() <= sphere.radius) indices.push_back(i);
+		}
+	});
+	report("length() <= radius", numPoints, sphereBase, indices.size(), 0.0);
+
+	KernelPath best = getKernelPath();
+	for (int path = KERNEL_SCALAR; path <= best; path++)
+	{
+		setKernelPath(static_cast<KernelPath>(path));
+		std::cout << getKernelPathName(getKernelPath()) << " kernels" << std::endl;
+
+		double ms = timeMs(repeats, [&]() { indices.clear(); selectInCylinder(points.data(), numPoints, cyl, indices); });
+		report("selectInCylinder", numPoints, ms, indices.size(), cylBase);
+		ms = timeMs(repeats, [&]() { indices.clear(); selectInSphere(points.data(), numPoints, sphere, indices); });
+		report("selectInSphere", numPoints, ms, indices.size(), sphereBase);
+		ms = timeMs(repeats, [&]() { indices.clear(); selectInBox(points.data(), numPoints, box, indices); });
+		report("selectInBox", numPoints, ms, indices.size(), 0.0);
+		ms = timeMs(repeats, [&]() { indices.clear(); selectInHalfSpace(points.data(), numPoints, plane, indices); });
+		report("selectInHalfSpace", numPoints, ms, indices.size(), 0.0);
+		ms = timeMs(repeats, [&]() { maskInSphere(points.data(), numPoints, sphere, mask); });
+		std::size_t bits = 0;
+		for (uint64_t w : mask)
+		{
+			for (; w; w &= w - 1) bits++;
+		}
+		report("maskInSphere", numPoints, ms, bits, sphereBase);
+	}
+
+	// Epicyclic motion over 100,000 years. The baseline evaluates the closed
+	// form for each point, sines and cosines included.
+	std::vector<osg::Vec3> velocities(numPoints), moved(numPoints);
+	std::uniform_real_distribution<float> speed(-0.05f, 0.05f);
+	for (osg::Vec3& v : velocities)
+	{
+		v.set(speed(rng), speed(rng), speed(rng));
+	}
+	std::vector<float> columns[6];
+	for (int k = 0; k < 3; k++)
+	{
+		columns[k].resize(numPoints);
+		columns[k + 3].resize(numPoints);
+		for (std::size_t i = 0; i < numPoints; i++)
+		{
+			columns[k][i] = points[i][k];
+			columns[k + 3][i] = velocities[i][k];
+		}
+	}
+	KernelMotionColumns motionColumns = { columns[0].data(), columns[1].data(), columns[2].data(),
+		columns[3].data(), columns[4].data(), columns[5].data() };
+
+	const float t = 100.0f;
+	const float omega = 2.828427e-5f, nu = 7.5e-5f, a = omega / 2, b = -omega / 2;
+	const float kappa = std::sqrt(-4 * omega * b);
+	KernelMotion motion;
+	motion.xu = std::sin(kappa * t) / kappa;
+	motion.xv = b / 2 * (1.0f - std::cos(kappa * t));
+	motion.yx = 2 * a * t;
+	motion.yu = 2 * omega / (kappa * kappa) * (1.0f - std::cos(kappa * t));
+	motion.yv = 2 * a * t / (2 * b) - omega / (b * kappa) * std::sin(kappa * t);
+	motion.zz = std::cos(nu * t);
+	motion.zw = std::sin(nu * t) / nu;
+
+	std::cout << "Motion" << std::endl;
+	double motionBase = timeMs(repeats, [&]()
+	{
+		for (std::size_t i = 0; i < numPoints; i++)
+		{
+			float x0 = points[i].x(), y0 = points[i].y(), z0 = points[i].z();
+			float u = velocities[i].x(), v = velocities[i].y(), w = velocities[i].z();
+			float x = x0 + (v / 2 * b) * (1.0f - std::cos(kappa * t)) + (u / kappa) * std::sin(kappa * t);
+			float y = y0 + 2 * a * (x0 + (v / (2 * b))) * t - (omega / (b * kappa)) * v * std::sin(kappa * t)
+				+ (2 * omega / (kappa * kappa)) * u * (1.0f - std::cos(kappa * t));
+			float z = (w / nu) * std::sin(nu * t) + z0 * std::cos(nu * t);
+			moved[i].set(x, y, z);
+		}
+	});
+	report("per-point epicycle", numPoints, motionBase, numPoints, 0.0);
+	for (int path = KERNEL_SCALAR; path <= best; path++)
+	{
+		setKernelPath(static_cast<KernelPath>(path));
+		double ms = timeMs(repeats, [&]() { propagateMotion(motionColumns, 0, numPoints, motion, moved.data()); });
+		report(getKernelPathName(getKernelPath()), numPoints, ms, numPoints, motionBase);
+	}
+
+	return 0;
+}